@@ -177,12 +177,18 @@ class CoreAssignHandler(BaseHandler):
 
                 {
                     "donor_token": "token", // optional
-                    "target_id": "target_id" // optional
+                    "target_id": "target_id", // optional
+                    "max_atoms": 25000 // optional
                 }
 
             .. note:: If ``target_id`` is specified, then the CC will disregard
                 the assignment algorithm.
 
+            .. note:: If ``max_atoms`` is specified, targets whose
+                ``n_atoms`` option is larger are not considered. Cores send
+                it when packing several streams onto one device. Targets
+                without an ``n_atoms`` option are always considered.
+
             **Example reply**
 
             .. sourcecode:: javascript
@@ -243,13 +249,18 @@ class CoreAssignHandler(BaseHandler):
                                    'stage': 'public'},
                                   {'owner': 1,
                                    '_id': 1,
-                                   'weight': 1})
+                                   'weight': 1,
+                                   'options.n_atoms': 1})
             owner_weights = dict()
             target_weights = dict()
             target_owners = dict()
             # target_shards = dict()
             while (yield results.fetch_next):
                 document = results.next_object()
+                if 'max_atoms' in content:
+                    n_atoms = document.get('options', {}).get('n_atoms')
+                    if n_atoms is not None and n_atoms > content['max_atoms']:
+                        continue
                 if document['_id'] in self.application.shards:
                     owner_weights[document['owner']] = None
                     target_weights[document['_id']] = document['weight']
@@ -567,7 +578,8 @@ class TargetsHandler(BaseHandler):
                         "category": "Benchmark",
                         "steps_per_frame": 50000,
                         "xtc_precision": 3,
-                        "discard_water": True
+                        "discard_water": True,
+                        "n_atoms": 23558 // used to pack small targets
                     }
                     "weight": 1 // weight of the target relative to others
                 }
@@ -24,21 +24,17 @@
 #include <Poco/StreamCopier.h>
 #include <Poco/URI.h>
 #include <Poco/Dynamic/Var.h>
+#include <Poco/Path.h>
 
-#include <Poco/Base64Decoder.h>
 #include <Poco/Base64Encoder.h>
-#include <Poco/InflatingStream.h>
-#include <Poco/DeflatingStream.h>
 
-#include <openssl/ssl.h>
-#include <openssl/bio.h>
-#include <openssl/x509.h>
 
 #include <fstream>
 #include <string>
 #include <streambuf>
 #include <sstream>
 #include <stdexcept>
+#include <limits>
 #include <algorithm>
 #include <locale>
 #include <cstdlib>
@@ -47,36 +43,13 @@
 #include <ctime>
 
 #include "Core.h"
-#include "md5.h"
+#include "PayloadEncoder.h"
+#include "SessionCache.h"
+#include "UploadSpool.h"
+#include "StartReply.h"
 
 using namespace std;
 
-static void read_cert_into_ctx(istream &some_stream, SSL_CTX *ctx) {
-    // Add a stream of PEM formatted certificate strings to the trusted store
-    // of the ctx.
-    string line;
-    string buffer;
-	int count = 0;
-    while(getline(some_stream, line)) {
-		buffer.append(line);
-        buffer.append("\n");
-        if(line.find("END CERTIFICATE") != string::npos ) {
-			BIO *bio;
-            X509 *certificate;
-            bio = BIO_new(BIO_s_mem());
-            BIO_puts(bio, buffer.c_str());
-            certificate = PEM_read_bio_X509(bio, NULL, NULL, NULL);
-            if(certificate == NULL)
-                throw std::runtime_error("could not add certificate to trusted\
-                                          CAs");
-            X509_STORE* store = SSL_CTX_get_cert_store(ctx);
-            int result = X509_STORE_add_cert(store, certificate);
-            BIO_free(bio);
-            buffer = "";
-        }
-    }
-}
-
 static int getPort(const std::string &s, char delim=':') {
     std::vector<std::string> elems;
     std::stringstream ss(s);
@@ -104,60 +77,15 @@ static std::string getHost(const std::string &s, char delim=':') {
     return elems[0];
 }
 
-static string encode_b64(const string &binary) {
-    ostringstream binary_ostream(std::ios_base::binary);
-    Poco::Base64Encoder b64encoder(binary_ostream);
-    b64encoder << binary;
-    b64encoder.close();
-    string b64_string(binary_ostream.str());
-    // POCO B64 adds "\r\n" when the line buffer is full - we can either remove
-    // it, or manually escape. We choose the former. 
-    b64_string.erase(std::remove(b64_string.begin(), b64_string.end(), '\n'), b64_string.end());
-    b64_string.erase(std::remove(b64_string.begin(), b64_string.end(), '\r'), b64_string.end());
-    return b64_string;
-}
-
-static string encode_gz(const string &binary) {
-    ostringstream binary_ostream(std::ios_base::binary);
-    Poco::DeflatingOutputStream deflater(binary_ostream,
-        Poco::DeflatingStreamBuf::STREAM_GZIP);
-    deflater << binary;
-    deflater.close();
-    return binary_ostream.str();
-}
-
-static string decode_b64(const string &encoded_string) {
-    istringstream encoded_stream(encoded_string, std::ios_base::binary);
-    Poco::Base64Decoder b64decoder(encoded_stream);
-    std::string decoded_b64_string((std::istreambuf_iterator<char>(b64decoder)), std::istreambuf_iterator<char>());
-    return decoded_b64_string;
-}
-
-static string decode_gz(const string &gzipped_string) {
-    istringstream gzip_stream(gzipped_string, std::ios_base::binary);
-    Poco::InflatingInputStream inflater(gzip_stream, 
-        Poco::InflatingStreamBuf::STREAM_GZIP);
-    std::string data((std::istreambuf_iterator<char>(inflater)),
-                     std::istreambuf_iterator<char>());
-    return data; 
-}
-
-static string decode_gz_b64(const string &encoded_string) {
-    return decode_gz(decode_b64(encoded_string));
-}
-
-static string compute_md5(const string &binary_string) {
-    md5_state_s state;
-    md5_init(&state);
-    md5_append(&state, reinterpret_cast<const unsigned char *>(&binary_string[0]), binary_string.size());
-    unsigned char digest[16] = "";
-    md5_finish(&state, digest);
-    char converted[16*2+1];
-    converted[32] = '\0'; 
-    for(int i=0; i < 16; i++) {
-        sprintf(&converted[i*2], "%02x", digest[i]);
+// name of a file once its ".b64" and ".gz" suffixes are decoded
+static string decoded_name(string filename) {
+    if(filename.find(".b64") != string::npos) {
+        filename = filename.substr(0, filename.length()-4);
+        if(filename.find(".gz") != string::npos) {
+            filename = filename.substr(0, filename.length()-3);
+        }
     }
-    return converted;
+    return filename;
 }
 
 static vector<string> delimit(const string& input, char token) {
@@ -196,14 +124,77 @@ static void parse_proxy_string(const string &input_string, string &username, str
     }
 }
 
+static void set_proxy(Poco::Net::HTTPSClientSession &session,
+                      const string &proxy_string,
+                      ostream &log) {
+    log << "setting up proxy credentials... " << endl;
+    string proxy_user, proxy_pass, proxy_host;
+    int proxy_port;
+    parse_proxy_string(proxy_string, proxy_user, proxy_pass, proxy_host, proxy_port);
+    session.setProxy(proxy_host, proxy_port);
+    log << "setting proxy_host, proxy_port " << proxy_host << " " << proxy_port << endl;
+    if(proxy_user.size() > 0 && proxy_pass.size() > 0) {
+        session.setProxyCredentials(proxy_user, proxy_pass);
+        log << "setting proxy_user, proxy_pass " << proxy_user << " " << proxy_pass << endl;
+    }
+}
+
 Core::Core(std::string core_key, std::ostream& log) :
     core_key_(core_key),
     logStream(log),
-    session_(NULL) {
+    session_(NULL),
+    upload_queue_(NULL),
+    upload_queue_size_(0),
+    file_cache_(NULL),
+    max_atoms_(0),
+    spool_bytes_(0),
+    spool_max_outage_(0),
+    exiting_(NULL),
+    frame_gzip_level_(6),
+    checkpoint_gzip_level_(6),
+    gzip_threads_(1),
+    binary_uploads_(false),
+    heartbeat_interval_(0),
+    last_contact_(0) {
 }
 
 Core::~Core() {
-    delete session_;
+    delete upload_queue_;
+    SessionCache::instance().release(session_, false);
+}
+
+void Core::setUploadQueueSize(int size) {
+    upload_queue_size_ = size;
+}
+
+void Core::setUploadSpool(const string &spool_dir, size_t max_bytes,
+                          int max_outage) {
+    spool_dir_ = spool_dir;
+    spool_bytes_ = max_bytes;
+    spool_max_outage_ = max_outage;
+}
+
+void Core::setExitCheck(bool (*exiting)()) {
+    exiting_ = exiting;
+}
+
+void Core::setGzipThreads(int threads) {
+    gzip_threads_ = max(threads, 1);
+}
+
+void Core::setGzipLevels(int frame_level, int checkpoint_level) {
+    if(frame_level < 1 || frame_level > 9 || checkpoint_level < 1 || checkpoint_level > 9)
+        throw std::runtime_error("gzip levels must be between 1 and 9");
+    frame_gzip_level_ = frame_level;
+    checkpoint_gzip_level_ = checkpoint_level;
+}
+
+void Core::setFileCache(FileCache *cache) {
+    file_cache_ = cache;
+}
+
+void Core::setMaxAtoms(int max_atoms) {
+    max_atoms_ = max_atoms;
 }
 
 // see if host is a domain name or an ip address by checking the last char
@@ -215,10 +206,39 @@ static bool is_domain(const string &host) {
         return true;
 }
 
+Assignment::Assignment() :
+    binary_uploads(false),
+    heartbeat_interval(0),
+    session(NULL),
+    scv_port(0),
+    verify_mode(Poco::Net::Context::VERIFY_NONE) {
+
+}
+
+Assignment::~Assignment() {
+    SessionCache::instance().release(session, false);
+}
+
+void Assignment::swap(Assignment &other) {
+    core_token.swap(other.core_token);
+    stream_id.swap(other.stream_id);
+    target_id.swap(other.target_id);
+    options.swap(other.options);
+    files.swap(other.files);
+    std::swap(binary_uploads, other.binary_uploads);
+    std::swap(heartbeat_interval, other.heartbeat_interval);
+    std::swap(session, other.session);
+    scv_host.swap(other.scv_host);
+    std::swap(scv_port, other.scv_port);
+    std::swap(verify_mode, other.verify_mode);
+    proxy.swap(other.proxy);
+}
+
 void Core::assign(const string &cc_uri,
                   const string &donor_token,
                   const string &target_id,
-                  const string &proxy_string) {
+                  const string &proxy_string,
+                  Assignment &assignment) const {
     logStream << "preparing for assignment..." << endl;
     Poco::Net::Context::VerificationMode verify_mode;
     if(is_domain(getHost(cc_uri))) {
@@ -226,82 +246,19 @@ void Core::assign(const string &cc_uri,
     } else {
         verify_mode = Poco::Net::Context::VERIFY_NONE;
     }
-    Poco::Net::Context::Ptr context = new Poco::Net::Context(
-        Poco::Net::Context::CLIENT_USE, "", 
-        verify_mode, 9, true);
-	
-	SSL_CTX *ctx = context->sslContext();
-
-    // hacky as hell way to load certs:)
-	{
-	    #include "certs/certs_bundle_0.pem"
-		stringstream ss;
-		ss << ssl_string_0;
-		read_cert_into_ctx(ss, ctx);
-	}
-
-	{
-		#include "certs/certs_bundle_1.pem"
-		stringstream ss;
-		ss << ssl_string_1;
-		read_cert_into_ctx(ss, ctx);
-	}
-
-	{
-		#include "certs/certs_bundle_2.pem"
-		stringstream ss;
-		ss << ssl_string_2;
-		read_cert_into_ctx(ss, ctx);
-	}
-
-	{
-		#include "certs/certs_bundle_3.pem"
-		stringstream ss;
-		ss << ssl_string_3;
-		read_cert_into_ctx(ss, ctx);
-	}
-
-	{
-		#include "certs/certs_bundle_4.pem"
-		stringstream ss;
-		ss << ssl_string_4;
-		read_cert_into_ctx(ss, ctx);
-	}
-
-	{
-		#include "certs/certs_bundle_5.pem"
-		stringstream ss;
-		ss << ssl_string_5;
-		read_cert_into_ctx(ss, ctx);
-	}
-
-	{
-		#include "certs/certs_bundle_6.pem"
-		;
-		stringstream ss;
-		ss << ssl_string_6;
-		read_cert_into_ctx(ss, ctx);
-	}
-
     logStream << "connecting to cc... " << endl;
 
-    Poco::Net::HTTPSClientSession cc_session(getHost(cc_uri),
-                                             getPort(cc_uri),
-                                             context);
-
-    if(proxy_string.size() > 0) {
-        logStream << "setting up proxy credentials... " << endl;
-        string proxy_user, proxy_pass, proxy_host;
-        int proxy_port;
-        parse_proxy_string(proxy_string, proxy_user, proxy_pass, proxy_host, proxy_port);
-        cc_session.setProxy(proxy_host, proxy_port);
-        logStream << "setting proxy_host, proxy_port " << proxy_host << " " << proxy_port << endl;
-        if(proxy_user.size() > 0 && proxy_pass.size() > 0) {
-            cc_session.setProxyCredentials(proxy_user, proxy_pass);
-            logStream << "setting proxy_user, proxy_pass " << proxy_user << " " << proxy_pass << endl;
-        }
+    SessionCache &cache = SessionCache::instance();
+    bool reused;
+    Poco::Net::HTTPSClientSession *cc_session = cache.acquire(
+        getHost(cc_uri), getPort(cc_uri), verify_mode, proxy_string, reused);
+    if(reused) {
+        logStream << "reusing connection to cc..." << endl;
+    } else if(proxy_string.size() > 0) {
+        set_proxy(*cc_session, proxy_string, logStream);
     }
 
+    Poco::URI poco_url;
 	try {
         logStream << "assigning core to a stream..." << flush;
         Poco::Net::HTTPRequest request("POST", "/core/assign");
@@ -310,12 +267,14 @@ void Core::assign(const string &cc_uri,
             obj["donor_token"] = picojson::value(donor_token);
         if(target_id.length() > 0)
             obj["target_id"] = picojson::value(target_id);
+        if(max_atoms_ > 0)
+            obj["max_atoms"] = picojson::value(double(max_atoms_));
         string body = picojson::value(obj).serialize();
         request.set("Authorization", core_key_);
         request.setContentLength(body.length());
-        cc_session.sendRequest(request) << body;
+        cc_session->sendRequest(request) << body;
         Poco::Net::HTTPResponse response;
-        istream &content_stream = cc_session.receiveResponse(response);
+        istream &content_stream = cc_session->receiveResponse(response);
 
         if(response.getStatus() == 200) {
             logStream << "ok" << endl;
@@ -334,215 +293,383 @@ void Core::assign(const string &cc_uri,
             throw std::runtime_error("FATAL Assignment");
         }
         picojson::value json_value;
-        content_stream >> json_value;
-        string err = picojson::get_last_error();
+        // picojson::get_last_error() is shared by all threads
+        string err = picojson::parse(json_value, content_stream);
         if(!err.empty())
             throw(std::runtime_error("assign() picojson error"+err));
         if(!json_value.is<picojson::object>())
             throw(std::runtime_error("no JSON object could be read"+err));
         picojson::value::object &json_object = json_value.get<picojson::object>();
         string ws_url(json_object["url"].get<string>());
-        Poco::URI poco_url(ws_url);
-        core_token_ = json_object["token"].get<string>();
-        logStream << "connecting to scv " << poco_url.getHost() << "... " << endl;
-        session_ = new Poco::Net::HTTPSClientSession(poco_url.getHost(), poco_url.getPort(), context);
-        if(proxy_string.size() > 0) {
-            logStream << "setting up proxy credentials... " << endl;
-            string proxy_user, proxy_pass, proxy_host;
-            int proxy_port;
-            parse_proxy_string(proxy_string, proxy_user, proxy_pass, proxy_host, proxy_port);
-            session_->setProxy(proxy_host, proxy_port);
-            logStream << "setting proxy_host, proxy_port " << proxy_host << " " << proxy_port << endl;
-            if(proxy_user.size() > 0 && proxy_pass.size() > 0) {
-                session_->setProxyCredentials(proxy_user, proxy_pass);
-                logStream << "setting proxy_user, proxy_pass " << proxy_user << " " << proxy_pass << endl;
-            }
-        }
+        poco_url = Poco::URI(ws_url);
+        assignment.core_token = json_object["token"].get<string>();
+        // drain what is left of the reply so the connection can be reused
+        content_stream.ignore(std::numeric_limits<std::streamsize>::max());
 	} catch(Poco::Net::SSLException &se) {
 		logStream << se.message() << endl;
 		logStream << se.displayText() << endl;
+		cache.release(cc_session, false);
+		throw;
+	} catch(...) {
+		cache.release(cc_session, false);
 		throw;
 	}
+    cache.release(cc_session, true);
+
+    logStream << "connecting to scv " << poco_url.getHost() << "... " << endl;
+    assignment.scv_host = poco_url.getHost();
+    assignment.scv_port = poco_url.getPort();
+    assignment.verify_mode = verify_mode;
+    assignment.proxy = proxy_string;
+    assignment.session = cache.acquire(assignment.scv_host,
+        assignment.scv_port, verify_mode, proxy_string, reused);
+    if(!reused && proxy_string.size() > 0) {
+        set_proxy(*assignment.session, proxy_string, logStream);
+    }
 }
 
 void Core::startStream(const string &cc_uri,
                        const string &donor_token,
                        const string &target_id,
                        const string &proxy_string) {
+    Assignment assignment;
+    fetchAssignment(cc_uri, donor_token, target_id, proxy_string, assignment);
+    startStream(assignment);
+}
+
+void Core::startStream(Assignment &assignment) {
+    if(upload_queue_ != NULL) {
+        delete upload_queue_;
+        upload_queue_ = NULL;
+    }
     if(session_ != NULL) {
-        delete session_;
+        SessionCache::instance().release(session_, false);
         session_ = NULL;
     }
-    assign(cc_uri, donor_token, target_id, proxy_string);
-    logStream << "preparing to start stream..." << endl;
-    Poco::Net::HTTPRequest request("GET", "/core/start");
-    request.set("Authorization", core_token_);
-    session_->sendRequest(request);
-    Poco::Net::HTTPResponse response;
-    logStream << "receiving response..." << endl;
-    istream &content_stream = session_->receiveResponse(response);
-    if(response.getStatus() != 200)
-        throw std::runtime_error("Could not start a stream from SCV");
-    std::string data((std::istreambuf_iterator<char>(content_stream)),
-                 (std::istreambuf_iterator<char>()));
-    if(response.has("Content-MD5")) {
-        // compute md5sum
-        logStream << "verifying hash..." << endl;
-        string expected(response.get("Content-MD5"));
-        if(compute_md5(data) != expected) {
-            logStream << compute_md5(data) << endl;
-            logStream << expected << endl;
-            throw std::runtime_error("MD5 mismatch");
+    core_token_.swap(assignment.core_token);
+    stream_id_.swap(assignment.stream_id);
+    target_id_.swap(assignment.target_id);
+    options_.swap(assignment.options);
+    files_.swap(assignment.files);
+    binary_uploads_ = assignment.binary_uploads;
+    heartbeat_interval_ = assignment.heartbeat_interval;
+    // the SCV started its clock when it handed out the stream
+    last_contact_ = time(NULL);
+    status_.clear();
+    session_ = assignment.session;
+    assignment.session = NULL;
+    if(upload_queue_size_ > 0) {
+        // uploads get their own connection so they never contend with
+        // requests made from the simulation thread
+        bool reused;
+        Poco::Net::HTTPSClientSession* upload_session =
+            SessionCache::instance().acquire(assignment.scv_host,
+                assignment.scv_port,
+                Poco::Net::Context::VerificationMode(assignment.verify_mode),
+                assignment.proxy, reused);
+        if(!reused && assignment.proxy.size() > 0) {
+            set_proxy(*upload_session, assignment.proxy, logStream);
         }
+        UploadSpool *spool = NULL;
+        if(spool_dir_.size() > 0) {
+            Poco::Path spool_path(Poco::Path(spool_dir_).makeDirectory(), stream_id_);
+            spool = new UploadSpool(spool_path.toString(), spool_bytes_);
+        }
+        upload_queue_ = new UploadQueue(upload_session, core_token_,
+                                        upload_queue_size_, &metrics_,
+                                        spool, spool_max_outage_, exiting_);
     }
+}
+
+void Core::fetchAssignment(const string &cc_uri,
+                           const string &donor_token,
+                           const string &target_id,
+                           const string &proxy_string,
+                           Assignment &assignment) const {
+    assign(cc_uri, donor_token, target_id, proxy_string, assignment);
+    Poco::Net::HTTPSClientSession *session = assignment.session;
+    logStream << "preparing to start stream..." << endl;
     picojson::value json_value;
-    std::istringstream input(data);
-    input >> json_value;
-    string err = picojson::get_last_error();
-    if(!err.empty())
-        throw(std::runtime_error("assign() picojson error"+err));
-    if(!json_value.is<picojson::object>())
-        throw(std::runtime_error("no JSON object could be read"+err));
+    // a cached file that went missing since the index was taken, eg. evicted
+    // by another core sharing the cache, is fetched again in full
+    bool use_cache = file_cache_ != NULL;
+    while(true) {
+        Poco::Net::HTTPRequest request("GET", "/core/start");
+        request.set("Authorization", assignment.core_token);
+        // besides xml, see PreparedStream; the SCV does not hand out streams
+        // last checkpointed in a format missing here
+        request.set("Checkpoint-Formats", "binary,delta");
+        if(use_cache) {
+            string cached = file_cache_->index();
+            if(cached.size() > 0)
+                request.set("Cached-Files", cached);
+        }
+        session->sendRequest(request);
+        Poco::Net::HTTPResponse response;
+        logStream << "receiving response..." << endl;
+        istream &content_stream = session->receiveResponse(response);
+        if(response.getStatus() != 200)
+            throw std::runtime_error("Could not start a stream from SCV");
+        map<string, string> file_md5s;
+        string body_md5;
+        assignment.files.clear();
+        // files are decoded as they arrive, none of them is held encoded
+        StartReply::read(content_stream, file_cache_, json_value, assignment.files,
+                         file_md5s, body_md5);
+        if(response.has("Content-MD5")) {
+            logStream << "verifying hash..." << endl;
+            string expected(response.get("Content-MD5"));
+            if(body_md5 != expected) {
+                logStream << body_md5 << endl;
+                logStream << expected << endl;
+                throw std::runtime_error("MD5 mismatch");
+            }
+        }
+        picojson::value::object &json_object = json_value.get<picojson::object>();
+        assignment.stream_id = json_object["stream_id"].get<string>();
+        assignment.target_id = json_object["target_id"].get<string>();
+        if(target_id.size() > 0 && target_id != assignment.target_id) {
+            throw std::runtime_error("FATAL: Specified target_id mismatch");
+        }
+        for(map<string, string>::const_iterator it = file_md5s.begin();
+            it != file_md5s.end(); it++) {
+            file_cache_->put(assignment.target_id, it->second, assignment.files[it->first]);
+        }
+        // files the SCV left out because we listed them in Cached-Files
+        bool missing = false;
+        if(json_object["cached"].is<picojson::object>()) {
+            picojson::value::object &json_cached = json_object["cached"].get<picojson::object>();
+            for(picojson::value::object::const_iterator it = json_cached.begin();
+                it != json_cached.end(); ++it) {
+                string filename = decoded_name(it->first);
+                if(!use_cache || !it->second.is<string>() ||
+                   !file_cache_->get(assignment.target_id, it->second.get<string>(),
+                                     assignment.files[filename])) {
+                    if(!use_cache)
+                        throw std::runtime_error("Cannot find cached "+filename);
+                    logStream << "cached " << filename << " is gone, downloading in full..." << endl;
+                    missing = true;
+                    break;
+                }
+                logStream << "using cached " << filename << endl;
+            }
+        }
+        if(!missing)
+            break;
+        use_cache = false;
+    }
     picojson::value::object &json_object = json_value.get<picojson::object>();
-    stream_id_ = json_object["stream_id"].get<string>();
-    target_id_ = json_object["target_id"].get<string>();
+    logStream << "assigned to stream " << assignment.stream_id.substr(0, 8);
+    logStream << " from target " << assignment.target_id.substr(0, 8) << endl;
+    StreamOptions(json_object["options"]).swap(assignment.options);
+    // SCVs that predate binary uploads do not list their formats
+    assignment.binary_uploads = false;
+    if(json_object["upload_formats"].is<picojson::array>()) {
+        const picojson::array &formats = json_object["upload_formats"].get<picojson::array>();
+        for(unsigned i=0; i < formats.size(); i++)
+            if(formats[i].is<string>() && formats[i].get<string>() == "binary")
+                assignment.binary_uploads = true;
+    }
+    assignment.heartbeat_interval = 0;
+    if(json_object["heartbeat_interval"].is<double>())
+        assignment.heartbeat_interval = static_cast<int>(json_object["heartbeat_interval"].get<double>());
+    logStream << "finished decoding..." << endl;
+}
 
-    logStream << "assigned to stream " << stream_id_.substr(0, 8);
-    logStream << " from target " << target_id_.substr(0, 8) << endl;
+static size_t encoded_size(const map<string, string> &files, bool binary) {
+    size_t size = 64;
+    for(map<string, string>::const_iterator it=files.begin();
+        it != files.end(); it++) {
+        if(binary)
+            size += PayloadEncoder::partSize(it->first, it->second.size());
+        else
+            size += PayloadEncoder::encodedSize(it->first, it->second.size());
+    }
+    return size;
+}
 
-    if(target_id.size() > 0 && target_id != target_id_) {
-        throw std::runtime_error("FATAL: Specified target_id mismatch");
+static void append_files(PayloadEncoder &encoder,
+    const map<string, string> &files, bool gzip) {
+    encoder.append("\"files\":{");
+    for(map<string, string>::const_iterator it=files.begin();
+        it != files.end(); it++) {
+        if(it != files.begin())
+            encoder.append(",");
+        encoder.appendFile(it->first, it->second, gzip);
     }
-    picojson::value::object &json_files = json_object["files"].get<picojson::object>();
-    for(picojson::value::object::const_iterator it = json_files.begin();
-         it != json_files.end(); ++it) {
-        string filename = it->first;
-        string filedata = it->second.get<string>();
-        if(filename.find(".b64") != string::npos) {
-            filename = filename.substr(0, filename.length()-4);
-            filedata = decode_b64(filedata);
-            if(filename.find(".gz") != string::npos) {       
-                filename = filename.substr(0, filename.length()-3);
-                filedata = decode_gz(filedata);
-            }
-        }
-        files_[filename] = filedata;
+    encoder.append("}");
+}
+
+static void append_parts(PayloadEncoder &encoder,
+    const map<string, string> &files, bool gzip) {
+    for(map<string, string>::const_iterator it=files.begin();
+        it != files.end(); it++) {
+        encoder.appendPart(it->first, it->second, gzip);
     }
-    options_ = json_object["options"].serialize();
-    logStream << "finished decoding..." << endl;
 }
 
 void Core::sendFrame(const map<string, string> &files, 
     int frame_count, bool gzip) const {
     logStream << "sending frame (" << flush;
-    Poco::Net::HTTPRequest request("PUT", "/core/frame");
     stringstream frame_count_str;
     frame_count_str << frame_count;
-    string message;
-    message += "{";
-    message += "\"frames\":"+frame_count_str.str()+",";
-    message += "\"files\":{";
-    for(map<string, string>::const_iterator it=files.begin();
-        it != files.end(); it++) {
-        string filename = it->first;
-        string filedata = it->second;
-        if(gzip) {
-            filedata = encode_gz(filedata);
-            filename += ".gz";
+    // gzipped frames are reserved at full size too, xtc barely compresses
+    Upload upload;
+    upload.method = "PUT";
+    upload.uri = "/core/frame";
+    upload.name = "Core::sendFrame";
+    {
+        ScopedTimer timer(&metrics_, "encode");
+        PayloadEncoder encoder(encoded_size(files, binary_uploads_));
+        encoder.setGzip(frame_gzip_level_, gzip_threads_);
+        if(binary_uploads_) {
+            encoder.appendBinary("{\"frames\":"+frame_count_str.str()+takeStatus()+"}");
+            append_parts(encoder, files, gzip);
+            upload.content_type = PayloadEncoder::BINARY_CONTENT_TYPE;
+        } else {
+            encoder.append("{\"frames\":"+frame_count_str.str()+takeStatus()+",");
+            append_files(encoder, files, gzip);
+            encoder.append("}");
         }
-        filedata = encode_b64(filedata);
-        if(it != files.begin())
-            message += ",";
-        message += "\""+filename+".b64\"";
-        message += ":";
-        message += "\""+filedata+"\"";
+        encoder.finish(upload.body, upload.md5);
     }
-    message += "}}";
-    logStream << message.size()/1000 << "KB)..." << flush;
-    request.set("Content-MD5", compute_md5(message));
-    request.set("Authorization", core_token_);
-    request.setContentLength(message.length());
-    session_->sendRequest(request) << message;
-    Poco::Net::HTTPResponse response;
-    session_->receiveResponse(response);
-    if(response.getStatus() != 200) {
-        throw std::runtime_error("Core::sendFrame bad status code");
-    }
-    logStream << " ok" << endl;
+    logStream << upload.body.size()/1000 << "KB)..." << flush;
+    dispatch(upload);
 }
 
 void Core::sendCheckpoint(const map<string, string> &files, double frames, bool gzip) const {
     logStream << "sending checkpoint (" << flush;
-    Poco::Net::HTTPRequest request("PUT", "/core/checkpoint");
-    string message;
-    message += "{\"files\":{";
-    for(map<string, string>::const_iterator it=files.begin();
-        it != files.end(); it++) {
-        string filename = it->first;
-        string filedata = it->second;
-        if(gzip) {
-            filedata = encode_gz(filedata);
-            filename += ".gz";
-        }
-        filedata = encode_b64(filedata);
-        if(it != files.begin())
-            message += ",";
-        message += "\""+filename+".b64\"";
-        message += ":";
-        message += "\""+filedata+"\"";
-    }
-    message += "},";
-    message += "\"frames\":";
     stringstream frames_string;
     frames_string << frames;
-    message += frames_string.str();
-    message += "}";
-    logStream << message.size()/1000 << "KB)..." << flush;
-    request.set("Content-MD5", compute_md5(message));
-    request.set("Authorization", core_token_);
-    request.setContentLength(message.length());
-    session_->sendRequest(request) << message;
-    Poco::Net::HTTPResponse response;
-    session_->receiveResponse(response);
-    if(response.getStatus() != 200) {
-        throw std::runtime_error("Core::sendCheckpointFiles bad status code");
+    Upload upload;
+    upload.method = "PUT";
+    upload.uri = "/core/checkpoint";
+    upload.name = "Core::sendCheckpointFiles";
+    {
+        ScopedTimer timer(&metrics_, "encode");
+        PayloadEncoder encoder(gzip ? 0 : encoded_size(files, binary_uploads_));
+        // checkpoints stay single member gzip, cores up to version 20 read
+        // them back with Poco's InflatingInputStream, which stops after the
+        // first member
+        encoder.setGzip(checkpoint_gzip_level_, 1);
+        if(binary_uploads_) {
+            encoder.appendBinary("{\"frames\":"+frames_string.str()+takeStatus()+"}");
+            append_parts(encoder, files, gzip);
+            upload.content_type = PayloadEncoder::BINARY_CONTENT_TYPE;
+        } else {
+            encoder.append("{");
+            append_files(encoder, files, gzip);
+            encoder.append(",\"frames\":"+frames_string.str()+takeStatus()+"}");
+        }
+        encoder.finish(upload.body, upload.md5);
+    }
+    logStream << upload.body.size()/1000 << "KB)..." << flush;
+    dispatch(upload);
+}
+
+Metrics &Core::metrics() const {
+    return metrics_;
+}
+
+void Core::flushUploads() const {
+    ScopedTimer timer(&metrics_, "blocked");
+    if(upload_queue_ != NULL) {
+        upload_queue_->flush();
+    }
+}
+
+string Core::takeStatus() const {
+    if(status_.empty())
+        return "";
+    string status = ",\"status\":"+status_;
+    status_.clear();
+    return status;
+}
+
+void Core::dispatch(Upload &upload) const {
+    // time the caller waits for the network, or for room in the queue
+    ScopedTimer timer(&metrics_, "blocked");
+    last_contact_ = time(NULL);
+    if(upload_queue_ != NULL) {
+        upload_queue_->push(upload);
+        logStream << " queued" << endl;
+    } else {
+        sendUpload(*session_, core_token_, upload, &metrics_);
+        logStream << " ok" << endl;
     }
-    logStream << " ok" << endl;
 }
 
 void Core::stopStream(string err_msg) {
+    if(upload_queue_ != NULL) {
+        // everything the MD loop produced must reach the SCV before the
+        // stream is stopped; a failed upload turns this into an error stop
+        try {
+            upload_queue_->flush();
+        } catch(const std::exception &e) {
+            // uploads abandoned on exit are not the stream's fault
+            if(exiting_ != NULL && exiting_())
+                logStream << "dropping uploads on exit: " << e.what() << endl;
+            else if(err_msg.length() == 0)
+                err_msg = e.what();
+        }
+        delete upload_queue_;
+        upload_queue_ = NULL;
+    }
     Poco::Net::HTTPRequest request("PUT", "/core/stop");
-    string message;
-    message += "{";
+    PayloadEncoder encoder;
+    encoder.append("{");
     if(err_msg.length() > 0) {
         logStream << "stopping stream with error: " << err_msg << endl;
-        string b64_error(encode_b64(err_msg));
-        message += "\"error\": \"" + b64_error + "\"";
+        encoder.append("\"error\": ");
+        encoder.appendBase64(err_msg);
     }
-    message += "}";
+    encoder.append("}");
+    string message;
+    string md5;
+    encoder.finish(message, md5);
     request.set("Authorization", core_token_);
     request.setContentLength(message.length());
     session_->sendRequest(request) << message;
     Poco::Net::HTTPResponse response;
-    session_->receiveResponse(response);
+    istream &content_stream = session_->receiveResponse(response);
+    content_stream.ignore(std::numeric_limits<std::streamsize>::max());
     if(response.getStatus() != 200) {
         throw std::runtime_error("Core::stopStream bad status code");
     }
+    // the exchange completed, so the connection can serve the next stream
+    SessionCache::instance().release(session_, true);
+    session_ = NULL;
 }
 
-void Core::sendHeartbeat() const {
-    Poco::Net::HTTPRequest request("POST", "/core/heartbeat");
-    string message("{}");
-    request.set("Authorization", core_token_);
-    request.setContentLength(message.length());
-    session_->sendRequest(request) << message;
-    Poco::Net::HTTPResponse response;
-    session_->receiveResponse(response);
-    if(response.getStatus() != 200) {
-        throw std::runtime_error("Core::sendHeartbeat bad status code");
+void Core::sendHeartbeat(const picojson::object &status) const {
+    Upload upload;
+    upload.method = "POST";
+    upload.uri = "/core/heartbeat";
+    upload.body = picojson::value(status).serialize();
+    upload.name = "Core::sendHeartbeat";
+    // it carries a newer status than the one waiting for an upload
+    status_.clear();
+    last_contact_ = time(NULL);
+    ScopedTimer timer(&metrics_, "blocked");
+    if(upload_queue_ != NULL) {
+        upload_queue_->push(upload);
+    } else {
+        sendUpload(*session_, core_token_, upload, &metrics_);
     }
 }
 
+void Core::setStatus(const picojson::object &status) {
+    status_ = picojson::value(status).serialize();
+}
+
+int Core::heartbeatInterval() const {
+    return heartbeat_interval_;
+}
+
+time_t Core::lastContact() const {
+    return last_contact_;
+}
+
 void Core::main() {
 
 }
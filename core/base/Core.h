@@ -22,8 +22,47 @@
 #include <ostream>
 #include <sstream>
 #include <iostream>
+#include <stdexcept>
+#include <ctime>
 
 #include "picojson.h"
+#include "UploadQueue.h"
+#include "FileCache.h"
+#include "Metrics.h"
+#include "StreamOptions.h"
+
+/* A stream assigned by the CC and downloaded from its SCV, but not yet
+   engaged by any Core. Filled in by Core::fetchAssignment(), which may run on
+   a different thread and Core than the one that later starts the stream. */
+struct Assignment {
+    Assignment();
+
+    /* Releases the SCV session if no Core took it */
+    ~Assignment();
+
+    void swap(Assignment &other);
+
+    std::string core_token;
+    std::string stream_id;
+    std::string target_id;
+    StreamOptions options;
+    std::map<std::string, std::string> files;
+    // the SCV takes uploads as binary parts, see PayloadEncoder
+    bool binary_uploads;
+    // seconds between heartbeats the SCV asks for, 0 if it does not say
+    int heartbeat_interval;
+
+    // connection used for /core/start, and what is needed to open more
+    Poco::Net::HTTPSClientSession *session;
+    std::string scv_host;
+    int scv_port;
+    int verify_mode;
+    std::string proxy;
+
+private:
+    Assignment(const Assignment &);
+    Assignment &operator=(const Assignment &);
+};
 
 /**
  * A Core provides the basic interface for talking to the Siegetank Backend.
@@ -42,6 +81,46 @@ public:
 
     /* Main MD loop */
     virtual void main();
+
+    /* Number of uploads that may be outstanding on the background upload
+       thread. 0 sends frames, checkpoints and heartbeats synchronously. Takes
+       effect on the next call to startStream(). */
+    void setUploadQueueSize(int size);
+
+    /* Number of threads gzipped frames are compressed with, see
+       Gzip::compress(). Checkpoints are always compressed on one thread
+       into a single member, so older cores can resume from them. */
+    void setGzipThreads(int threads);
+
+    /* Cache of target files shared across streams, or NULL to always
+       download everything. Not owned by the core. */
+    void setFileCache(FileCache *cache);
+
+    /* Ask the CC for targets of at most this many atoms, so small systems
+       can be packed onto one device. 0, the default, sends no hint. */
+    void setMaxAtoms(int max_atoms);
+
+    /* Spool queued frames and checkpoints to a directory of each stream
+       under spool_dir, retrying them for up to max_outage seconds while the
+       SCV is unreachable instead of stopping the stream. max_bytes is the
+       disk budget of a stream. Needs an upload queue; takes effect on the
+       next call to startStream(). */
+    void setUploadSpool(const std::string &spool_dir, size_t max_bytes,
+                        int max_outage = 900);
+
+    /* Once exiting returns true, eg. on SIGTERM, spooled uploads stop being
+       retried, so stopping the stream during an SCV outage does not wait
+       out max_outage. Takes effect on the next call to startStream(). */
+    void setExitCheck(bool (*exiting)());
+  
+    /* Ask the CC for a stream and download it from the SCV into assignment,
+       without engaging this core. Only uses the core key and logStream, so
+       it is safe to call while another thread drives a stream. */
+    void fetchAssignment(const std::string &cc_uri,
+                         const std::string &donor_token,
+                         const std::string &target_id,
+                         const std::string &proxy_string,
+                         Assignment &assignment) const;
   
     std::ostream &logStream;
 
@@ -52,13 +131,18 @@ protected:
                              const std::string &target_id = "",
                              const std::string &proxy_string = "");
 
-    /* Disengage the core from the stream and destroy the session */
+    /* Engage a stream from fetchAssignment(), taking over its contents */
+    void startStream(Assignment &assignment);
+
+    /* Disengage the core from the stream and hand its connection back to
+       the SessionCache */
     virtual void stopStream(std::string error_msg = "");
 
     /* Send frame files to the WS.  This method automatically base64
        encodes the files, and adds '.b64' to the suffix. If 'gzip' is true, the 
        files will first be gzipped, with a '.gz' suffix appended, and then b64
-       encoded.
+       encoded. SCVs that accept binary uploads get the files as they are,
+       without the base64 step.
     */
     void sendFrame(const std::map<std::string, std::string> &files,
                    int frame_count=1, bool gzip=false) const;
@@ -71,16 +155,51 @@ protected:
     void sendCheckpoint(const std::map<std::string, std::string> &files, double frames,
                         bool gzip=false) const;
 
-    /* Send a heartbeat */
-    void sendHeartbeat() const;
+    /* gzip levels, 1 (fastest) to 9 (smallest), of frames and checkpoints
+       sent with gzip. Both default to 6, zlib's default. */
+    void setGzipLevels(int frame_level, int checkpoint_level);
+
+    /* Send a heartbeat. status is an optional JSON object describing the
+       state of the core that the SCV records for the active stream. */
+    void sendHeartbeat(const picojson::object &status = picojson::object()) const;
+
+    /* Have the next frame, checkpoint or heartbeat carry status, as
+       sendHeartbeat() does, replacing any status not yet sent */
+    void setStatus(const picojson::object &status);
+
+    /* Seconds between heartbeats the SCV asked for, 0 if it did not */
+    int heartbeatInterval() const;
+
+    /* When the core last sent the SCV something that keeps the stream
+       alive: a frame, a checkpoint or a heartbeat. Queued uploads count
+       from when they were queued, one that fails stops the stream anyway. */
+    time_t lastContact() const;
 
-    /* get a specific option */
+    /* Block until all queued uploads have been sent. Throws the error of the
+       first failed upload, if any. */
+    void flushUploads() const;
+
+    /* Timings of the current stream. The core records "encode", "https" and
+       "blocked", the time callers wait on uploads; subclasses add the
+       phases of their own loop. */
+    Metrics &metrics() const;
+
+    /* get a specific option, throwing if the stream does not set it */
     template<typename T>
     T getOption(const std::string &key) const {
-        std::stringstream ss(options_);
-        picojson::value value; ss >> value;
-        picojson::value::object &object = value.get<picojson::object>();
-        return object[key].get<T>();
+        return options_.get<T>(key);
+    }
+
+    /* get a specific option, or default_value if the stream does not set it */
+    template<typename T>
+    T getOption(const std::string &key, const T &default_value) const {
+        return options_.get<T>(key, default_value);
+    }
+
+    /* get the JSON value of an option that may take several types, null if
+       the stream does not set it */
+    const picojson::value &getOptionValue(const std::string &key) const {
+        return options_.value(key);
     }
 
     std::map<std::string, std::string> files_;
@@ -89,14 +208,41 @@ protected:
 
 private:
     std::string core_token_;
-    std::string options_;
+    StreamOptions options_;
 
     Poco::Net::HTTPSClientSession* session_;
+    UploadQueue* upload_queue_;
+    int upload_queue_size_;
+    FileCache* file_cache_;
+    int max_atoms_;
+    std::string spool_dir_;
+    size_t spool_bytes_;
+    int spool_max_outage_;
+    bool (*exiting_)();
+    int frame_gzip_level_;
+    int checkpoint_gzip_level_;
+    int gzip_threads_;
+    bool binary_uploads_;
+    int heartbeat_interval_;
+    mutable time_t last_contact_;
+    // serialized status for the next upload, empty if there is none
+    mutable std::string status_;
+    mutable Metrics metrics_;
     const std::string core_key_;
+
+    /* Send an upload synchronously, or queue it if uploads are asynchronous.
+       The contents of upload are consumed. */
+    void dispatch(Upload &upload) const;
+
+    /* ,"status":{...} for the message of the next upload, or nothing.
+       Clears the status. */
+    std::string takeStatus() const;
+
     void assign(const std::string &cc_host,
                 const std::string &donor_token,
                 const std::string &target_id,
-                const std::string &proxy = "");
+                const std::string &proxy,
+                Assignment &assignment) const;
 
 };
 
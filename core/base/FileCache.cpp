@@ -0,0 +1,171 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/Timestamp.h>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "FileCache.h"
+
+using namespace std;
+
+// only digests name cached files, anything else is a partial write
+static bool is_md5(const string &name) {
+    if(name.size() != 32)
+        return false;
+    return name.find_first_not_of("0123456789abcdef") == string::npos;
+}
+
+FileCache::FileCache(const string &directory, int max_targets) :
+    directory_(directory),
+    max_targets_(max_targets) {
+    if(max_targets_ < 1)
+        throw std::runtime_error("FileCache: max_targets must be at least 1");
+    Poco::File(directory_).createDirectories();
+}
+
+void FileCache::addCacheableFile(const string &filename) {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    cacheable_.insert(filename);
+}
+
+bool FileCache::isCacheable(const string &filename) const {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    return cacheable_.find(filename) != cacheable_.end();
+}
+
+const string &FileCache::directory() const {
+    return directory_;
+}
+
+string FileCache::targetPath(const string &target_id) const {
+    // target_ids are uuid4s, anything else must not escape the directory
+    if(target_id.empty() || target_id.find_first_of("/\\.") != string::npos)
+        throw std::runtime_error("FileCache: bad target_id "+target_id);
+    return Poco::Path(Poco::Path(directory_).makeDirectory(), target_id).toString();
+}
+
+string FileCache::index() const {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    string result;
+    // targets may share identical files, which need only be listed once
+    set<string> listed;
+    vector<string> targets;
+    Poco::File(directory_).list(targets);
+    for(unsigned i=0; i < targets.size(); i++) {
+        Poco::File target(Poco::Path(Poco::Path(directory_).makeDirectory(), targets[i]).toString());
+        if(!target.isDirectory())
+            continue;
+        vector<string> files;
+        target.list(files);
+        for(unsigned j=0; j < files.size(); j++) {
+            if(!is_md5(files[j]) || !listed.insert(files[j]).second)
+                continue;
+            if(result.size() > 0)
+                result += ",";
+            result += files[j];
+        }
+    }
+    return result;
+}
+
+bool FileCache::get(const string &target_id, const string &md5,
+    string &data) const {
+    if(!is_md5(md5))
+        return false;
+    Poco::Mutex::ScopedLock lock(mutex_);
+    string target_path = targetPath(target_id);
+    string path = Poco::Path(Poco::Path(target_path).makeDirectory(), md5).toString();
+    ifstream file(path.c_str(), ios::binary);
+    if(!file) {
+        // index() lists every target, and targets may share identical
+        // files, so the SCV may point us at a copy kept for another one
+        vector<string> targets;
+        Poco::File(directory_).list(targets);
+        for(unsigned i=0; i < targets.size() && !file; i++) {
+            if(targets[i] == target_id)
+                continue;
+            Poco::Path other(Poco::Path(directory_).makeDirectory(), targets[i]);
+            path = Poco::Path(other.makeDirectory(), md5).toString();
+            file.clear();
+            file.open(path.c_str(), ios::binary);
+        }
+        if(!file)
+            return false;
+    }
+    ostringstream contents;
+    contents << file.rdbuf();
+    if(file.bad())
+        return false;
+    contents.str().swap(data);
+    // mark the target as recently used
+    if(Poco::File(target_path).exists())
+        Poco::File(target_path).setLastModified(Poco::Timestamp());
+    return true;
+}
+
+void FileCache::put(const string &target_id, const string &md5,
+    const string &data) {
+    if(!is_md5(md5))
+        throw std::runtime_error("FileCache: bad md5 "+md5);
+    Poco::Mutex::ScopedLock lock(mutex_);
+    string target_path = targetPath(target_id);
+    Poco::File(target_path).createDirectories();
+    Poco::Path dir = Poco::Path(target_path).makeDirectory();
+    string path = Poco::Path(dir, md5).toString();
+    string tmp_path = Poco::Path(dir, md5+".tmp").toString();
+    {
+        ofstream file(tmp_path.c_str(), ios::binary);
+        file.write(data.data(), data.size());
+        file.close();
+        if(!file) {
+            Poco::File(tmp_path).remove();
+            throw std::runtime_error("FileCache: could not write "+tmp_path);
+        }
+    }
+    // readers only ever see complete files
+    Poco::File(tmp_path).renameTo(path);
+    Poco::File(target_path).setLastModified(Poco::Timestamp());
+    evict(target_id);
+}
+
+void FileCache::evict(const string &keep) const {
+    vector<string> targets;
+    Poco::File(directory_).list(targets);
+    vector<Poco::File> dirs;
+    for(unsigned i=0; i < targets.size(); i++) {
+        Poco::File target(Poco::Path(Poco::Path(directory_).makeDirectory(), targets[i]).toString());
+        if(targets[i] != keep && target.isDirectory())
+            dirs.push_back(target);
+    }
+    // keep is always retained, the rest go oldest first
+    while(int(dirs.size())+1 > max_targets_) {
+        unsigned oldest = 0;
+        for(unsigned i=1; i < dirs.size(); i++) {
+            if(dirs[i].getLastModified() < dirs[oldest].getLastModified())
+                oldest = i;
+        }
+        try {
+            dirs[oldest].remove(true);
+        } catch(...) {
+            // another process sharing the cache may have removed it first
+        }
+        dirs.erase(dirs.begin()+oldest);
+    }
+}
@@ -0,0 +1,68 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_
+
+#include <Poco/Mutex.h>
+
+#include <set>
+#include <string>
+
+/* An on-disk cache of decoded stream files that are shared by every stream
+   of a target, such as system.xml and integrator.xml. Files are stored as
+
+       directory/target_id/md5
+
+   where md5 is the hexdigest of the encoded file as the SCV stores it, so
+   the SCV can tell which files the core already has. Only the most recently
+   used max_targets targets are kept. Safe to use from several threads, and
+   from several processes sharing one directory. */
+class FileCache {
+public:
+    FileCache(const std::string &directory, int max_targets = 8);
+
+    /* Cache files with this name once decoded, eg. "system.xml" */
+    void addCacheableFile(const std::string &filename);
+
+    bool isCacheable(const std::string &filename) const;
+
+    /* Comma separated MD5s of every cached file, each listed once whatever
+       the number of targets holding it, for the Cached-Files header of
+       /core/start */
+    std::string index() const;
+
+    /* Read a cached file into data, false if it is not in the cache. Files
+       are looked up by md5, preferring the copy kept for target_id, since
+       targets may share identical files. */
+    bool get(const std::string &target_id, const std::string &md5,
+             std::string &data) const;
+
+    /* Store a decoded file, evicting the least recently used targets */
+    void put(const std::string &target_id, const std::string &md5,
+             const std::string &data);
+
+    const std::string &directory() const;
+
+private:
+    std::string targetPath(const std::string &target_id) const;
+    void evict(const std::string &keep) const;
+
+    mutable Poco::Mutex mutex_;
+    std::string directory_;
+    int max_targets_;
+    std::set<std::string> cacheable_;
+};
+
+#endif
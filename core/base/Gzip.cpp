@@ -0,0 +1,168 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+// brings in zlib, whether Poco bundles it or not
+#include <Poco/DeflatingStream.h>
+#include <Poco/Runnable.h>
+#include <Poco/Thread.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "Gzip.h"
+
+using namespace std;
+
+// deflates one chunk into a complete gzip member
+class DeflateChunk : public Poco::Runnable {
+public:
+    DeflateChunk(const char *data, size_t size, int level) :
+        data_(data), size_(size), level_(level) {}
+
+    void run() {
+        try {
+            deflate_member();
+        } catch(const std::exception &e) {
+            error_ = e.what();
+        }
+    }
+
+    // throws if run() failed
+    const string &member() const {
+        if(error_.size() > 0)
+            throw std::runtime_error(error_);
+        return member_;
+    }
+
+private:
+    void deflate_member() {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        // 16 asks zlib for a gzip header and trailer instead of zlib's own
+        if(deflateInit2(&stream, level_, Z_DEFLATED, 16+MAX_WBITS, 8,
+                        Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::runtime_error("Gzip: bad compression level");
+        // the bound leaves room for a single Z_FINISH, plus the gzip wrapper
+        member_.resize(deflateBound(&stream, size_)+32);
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data_));
+        stream.avail_in = size_;
+        stream.next_out = reinterpret_cast<Bytef *>(&member_[0]);
+        stream.avail_out = member_.size();
+        int status = deflate(&stream, Z_FINISH);
+        size_t written = stream.total_out;
+        deflateEnd(&stream);
+        if(status != Z_STREAM_END)
+            throw std::runtime_error("Gzip: deflate failed");
+        member_.resize(written);
+    }
+
+    const char *data_;
+    size_t size_;
+    int level_;
+    string member_;
+    string error_;
+};
+
+void Gzip::compress(const string &data, int level, int threads, string &out) {
+    size_t chunks = 1;
+    if(threads > 1)
+        chunks = min(size_t(threads), max(size_t(1), data.size()/MIN_CHUNK_SIZE));
+    size_t chunk_size = (data.size()+chunks-1)/chunks;
+    vector<DeflateChunk *> work;
+    for(size_t i=0; i < chunks; i++) {
+        size_t start = min(i*chunk_size, data.size());
+        size_t size = min(chunk_size, data.size()-start);
+        work.push_back(new DeflateChunk(data.data()+start, size, level));
+    }
+    vector<Poco::Thread *> workers;
+    for(size_t i=1; i < work.size(); i++) {
+        workers.push_back(new Poco::Thread);
+        workers.back()->start(*work[i]);
+    }
+    // the first chunk is deflated by the calling thread
+    work[0]->run();
+    for(size_t i=0; i < workers.size(); i++) {
+        workers[i]->join();
+        delete workers[i];
+    }
+    string error;
+    for(size_t i=0; i < work.size(); i++) {
+        try {
+            if(error.empty())
+                out.append(work[i]->member());
+        } catch(const std::exception &e) {
+            error = e.what();
+        }
+        delete work[i];
+    }
+    if(error.size() > 0)
+        throw std::runtime_error(error);
+}
+
+void Gzip::decompress(const string &gzipped, string &out) {
+    Inflater inflater(out);
+    inflater.write(gzipped.data(), gzipped.size());
+    inflater.finish();
+}
+
+Gzip::Inflater::Inflater(string &out) :
+    out_(out),
+    stream_(new z_stream),
+    ended_(false) {
+    memset(stream_, 0, sizeof(*stream_));
+    if(inflateInit2(stream_, 16+MAX_WBITS) != Z_OK) {
+        delete stream_;
+        throw std::runtime_error("Gzip: inflateInit2 failed");
+    }
+}
+
+Gzip::Inflater::~Inflater() {
+    inflateEnd(stream_);
+    delete stream_;
+}
+
+void Gzip::Inflater::write(const char *data, size_t size) {
+    stream_->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    stream_->avail_in = size;
+    char buffer[65536];
+    do {
+        if(ended_) {
+            if(stream_->avail_in == 0)
+                break;
+            // the next member starts right after this one's trailer
+            inflateReset(stream_);
+            ended_ = false;
+        }
+        stream_->next_out = reinterpret_cast<Bytef *>(buffer);
+        stream_->avail_out = sizeof(buffer);
+        int status = inflate(stream_, Z_NO_FLUSH);
+        out_.append(buffer, sizeof(buffer)-stream_->avail_out);
+        if(status == Z_STREAM_END) {
+            ended_ = true;
+        } else if(status == Z_BUF_ERROR) {
+            // everything written so far has been inflated
+            break;
+        } else if(status != Z_OK) {
+            throw std::runtime_error("Gzip: corrupt or truncated data");
+        }
+    } while(stream_->avail_in > 0 || stream_->avail_out == 0);
+}
+
+void Gzip::Inflater::finish() {
+    if(!ended_)
+        throw std::runtime_error("Gzip: corrupt or truncated data");
+}
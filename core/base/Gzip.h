@@ -0,0 +1,68 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef GZIP_H_
+#define GZIP_H_
+
+#include <string>
+
+struct z_stream_s;
+
+/* Gzip compression for payloads, parallelized pigz style: the data is split
+   into chunks that are deflated independently on their own threads, and the
+   resulting gzip members are concatenated. A multi-member file is still a
+   single valid gzip file (RFC 1952), which Go's compress/gzip, Python's gzip
+   module and gunzip all read in full. Poco's InflatingInputStream stops
+   after the first member, so use decompress() to read them instead. */
+namespace Gzip {
+
+/* Chunks are never smaller than this, below it threads cost more than they
+   save and the compression ratio starts to suffer */
+static const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+/* Append data gzipped at level, 1 (fastest) to 9 (smallest), to out, using
+   up to threads threads */
+void compress(const std::string &data, int level, int threads, std::string &out);
+
+/* Append the decompressed contents of every member of gzipped to out */
+void decompress(const std::string &gzipped, std::string &out);
+
+/* decompress() for gzipped data that arrives in pieces */
+class Inflater {
+public:
+    /* Output is appended to out, which must outlive the inflater */
+    explicit Inflater(std::string &out);
+
+    ~Inflater();
+
+    /* Decompress the next size bytes of the gzip file */
+    void write(const char *data, size_t size);
+
+    /* Throw unless everything written so far ends with a complete member */
+    void finish();
+
+private:
+    Inflater(const Inflater &);
+    Inflater &operator=(const Inflater &);
+
+    std::string &out_;
+    z_stream_s *stream_;
+    // the last member ended, the next byte written starts a new one
+    bool ended_;
+};
+
+}
+
+#endif
@@ -0,0 +1,100 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// shared by every Metrics writing to the same stream
+static Poco::Mutex line_mutex;
+
+Metrics::Histogram::Histogram() :
+    count(0),
+    total(0),
+    max(0) {
+    for(int i=0; i < BINS; i++)
+        bins[i] = 0;
+}
+
+Metrics::Metrics() {
+
+}
+
+void Metrics::record(const string &phase, Poco::Clock::ClockDiff microseconds) {
+    // bin b holds samples in [2^b, 2^(b+1)) microseconds
+    int bin = 0;
+    while(bin < BINS-1 && (Poco::Clock::ClockDiff(2) << bin) <= microseconds)
+        bin++;
+    Poco::Mutex::ScopedLock lock(mutex_);
+    Histogram &histogram = phases_[phase];
+    histogram.count++;
+    histogram.total += microseconds;
+    if(microseconds > histogram.max)
+        histogram.max = microseconds;
+    histogram.bins[bin]++;
+}
+
+static double percentile_ms(const long long *bins, int n_bins,
+                            long long count, Poco::Clock::ClockDiff max,
+                            double fraction) {
+    // nearest rank, the sample at or above fraction of the count. No sample
+    // exceeds max, so neither does the upper bound of the bin it falls in.
+    long long rank = static_cast<long long>(ceil(fraction*count-1e-9));
+    long long seen = 0;
+    int i = 0;
+    while(i < n_bins-1 && seen+bins[i] < rank)
+        seen += bins[i++];
+    return double(std::min(2LL << i, static_cast<long long>(max)))/1e3;
+}
+
+picojson::object Metrics::summary() const {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    picojson::object phases;
+    for(map<string, Histogram>::const_iterator it = phases_.begin();
+        it != phases_.end(); it++) {
+        const Histogram &h = it->second;
+        picojson::object phase;
+        phase["count"] = picojson::value(double(h.count));
+        phase["total_s"] = picojson::value(double(h.total)/1e6);
+        phase["mean_ms"] = picojson::value(double(h.total)/1e3/h.count);
+        phase["p50_ms"] = picojson::value(percentile_ms(h.bins, BINS, h.count, h.max, 0.5));
+        phase["p90_ms"] = picojson::value(percentile_ms(h.bins, BINS, h.count, h.max, 0.9));
+        phase["p99_ms"] = picojson::value(percentile_ms(h.bins, BINS, h.count, h.max, 0.99));
+        phase["max_ms"] = picojson::value(double(h.max)/1e3);
+        phases[it->first] = picojson::value(phase);
+    }
+    return phases;
+}
+
+void Metrics::writeLine(ostream &out, picojson::object fields) const {
+    fields["phases"] = picojson::value(summary());
+    string line = picojson::value(fields).serialize();
+    Poco::Mutex::ScopedLock lock(line_mutex);
+    out << line << std::endl;
+}
+
+ScopedTimer::ScopedTimer(Metrics *metrics, const char *phase) :
+    metrics_(metrics),
+    phase_(phase) {
+
+}
+
+ScopedTimer::~ScopedTimer() {
+    if(metrics_ != NULL)
+        metrics_->record(phase_, start_.elapsed());
+}
@@ -0,0 +1,82 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <Poco/Clock.h>
+#include <Poco/Mutex.h>
+
+#include <map>
+#include <ostream>
+#include <string>
+
+#include "picojson.h"
+
+/**
+ * Timing histograms of the phases of a stream, eg. "step" or "https".
+ * Durations are binned in powers of two of microseconds, which is enough
+ * to tell a 2ms getState() from a 200ms one at a fixed cost per sample.
+ * Samples are recorded from the MD loop and the upload thread, so all
+ * methods lock.
+ */
+class Metrics {
+public:
+    Metrics();
+
+    /* Record one sample of phase */
+    void record(const std::string &phase, Poco::Clock::ClockDiff microseconds);
+
+    /* Per phase count, total_s, mean_ms, p50_ms, p90_ms, p99_ms and max_ms.
+       Percentiles are the upper bound of the bin they fall in, or max_ms if
+       that is smaller. */
+    picojson::object summary() const;
+
+    /* Write fields followed by "phases": summary() as a single JSON line.
+       Lines written by different threads do not interleave. */
+    void writeLine(std::ostream &out, picojson::object fields) const;
+
+private:
+    enum { BINS = 40 };
+
+    struct Histogram {
+        Histogram();
+        long long count;
+        Poco::Clock::ClockDiff total;
+        Poco::Clock::ClockDiff max;
+        long long bins[BINS];
+    };
+
+    mutable Poco::Mutex mutex_;
+    std::map<std::string, Histogram> phases_;
+};
+
+/* Records the time between construction and destruction as a sample of
+   phase. Does nothing if metrics is NULL. */
+class ScopedTimer {
+public:
+    ScopedTimer(Metrics *metrics, const char *phase);
+    ~ScopedTimer();
+
+private:
+    ScopedTimer(const ScopedTimer &);
+    ScopedTimer &operator=(const ScopedTimer &);
+
+    Metrics *metrics_;
+    const char *phase_;
+    Poco::Clock start_;
+};
+
+#endif
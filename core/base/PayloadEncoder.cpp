@@ -0,0 +1,164 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <Poco/Base64Encoder.h>
+
+#include <cstdio>
+#include <stdexcept>
+#include <ostream>
+
+#include "PayloadEncoder.h"
+#include "Gzip.h"
+#include "picojson.h"
+
+using namespace std;
+
+const char *const PayloadEncoder::BINARY_CONTENT_TYPE = "application/x-siegetank-parts";
+
+PayloadEncoder::Sink::Sink(string &body, md5_state_s &md5) :
+    body_(body), md5_(md5) {
+    setp(buffer_, buffer_+sizeof(buffer_));
+}
+
+void PayloadEncoder::Sink::drain() {
+    int n = static_cast<int>(pptr()-pbase());
+    if(n > 0) {
+        md5_append(&md5_, reinterpret_cast<const md5_byte_t *>(pbase()), n);
+        body_.append(pbase(), n);
+    }
+    setp(buffer_, buffer_+sizeof(buffer_));
+}
+
+int PayloadEncoder::Sink::overflow(int c) {
+    drain();
+    if(c != traits_type::eof()) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+streamsize PayloadEncoder::Sink::xsputn(const char *s, streamsize n) {
+    // large writes bypass the buffer entirely
+    if(n > epptr()-pptr()) {
+        drain();
+        md5_append(&md5_, reinterpret_cast<const md5_byte_t *>(s),
+                   static_cast<int>(n));
+        body_.append(s, static_cast<size_t>(n));
+        return n;
+    }
+    traits_type::copy(pptr(), s, static_cast<size_t>(n));
+    pbump(static_cast<int>(n));
+    return n;
+}
+
+int PayloadEncoder::Sink::sync() {
+    drain();
+    return 0;
+}
+
+PayloadEncoder::PayloadEncoder(size_t reserve) :
+    gzip_level_(6),
+    gzip_threads_(1),
+    sink_(body_, md5_) {
+    md5_init(&md5_);
+    body_.reserve(reserve);
+}
+
+void PayloadEncoder::setGzip(int level, int threads) {
+    gzip_level_ = level;
+    gzip_threads_ = threads;
+}
+
+void PayloadEncoder::append(const string &json) {
+    sink_.sputn(json.data(), json.size());
+}
+
+void PayloadEncoder::appendFile(const string &filename, const string &data,
+    bool gzip) {
+    string key(filename);
+    if(gzip)
+        key += ".gz";
+    key += ".b64";
+    // picojson takes care of quoting and escaping the filename
+    append(picojson::value(key).serialize());
+    append(":");
+    appendBase64(data, gzip);
+}
+
+void PayloadEncoder::appendBase64(const string &data, bool gzip) {
+    sink_.sputc('"');
+    {
+        ostream sink_stream(&sink_);
+        Poco::Base64Encoder b64encoder(sink_stream);
+        // no "\r\n" line breaks, they would need escaping inside JSON
+        b64encoder.rdbuf()->setLineLength(0);
+        if(gzip) {
+            string gzipped;
+            Gzip::compress(data, gzip_level_, gzip_threads_, gzipped);
+            b64encoder.write(gzipped.data(), gzipped.size());
+        } else {
+            b64encoder.write(data.data(), data.size());
+        }
+        b64encoder.close();
+    }
+    sink_.sputc('"');
+}
+
+void PayloadEncoder::appendBinary(const string &data) {
+    if(data.size() > 0xffffffffUL)
+        throw std::runtime_error("PayloadEncoder: part is too large");
+    unsigned long size = data.size();
+    char length[4];
+    for(int i=0; i < 4; i++)
+        length[i] = static_cast<char>((size >> (24-8*i)) & 0xff);
+    sink_.sputn(length, 4);
+    sink_.sputn(data.data(), data.size());
+}
+
+void PayloadEncoder::appendPart(const string &filename, const string &data,
+    bool gzip) {
+    if(gzip) {
+        appendBinary(filename+".gz");
+        string gzipped;
+        Gzip::compress(data, gzip_level_, gzip_threads_, gzipped);
+        appendBinary(gzipped);
+    } else {
+        appendBinary(filename);
+        appendBinary(data);
+    }
+}
+
+void PayloadEncoder::finish(string &body, string &md5) {
+    sink_.drain();
+    unsigned char digest[16] = "";
+    md5_finish(&md5_, digest);
+    char converted[16*2+1];
+    converted[32] = '\0';
+    for(int i=0; i < 16; i++) {
+        sprintf(&converted[i*2], "%02x", digest[i]);
+    }
+    md5 = converted;
+    body.swap(body_);
+}
+
+size_t PayloadEncoder::encodedSize(const string &filename, size_t data_size) {
+    // quotes, colon, comma and ".gz.b64" around the filename
+    return filename.size()+16+4*((data_size+2)/3);
+}
+
+size_t PayloadEncoder::partSize(const string &filename, size_t data_size) {
+    // two lengths and ".gz"
+    return filename.size()+11+data_size;
+}
@@ -0,0 +1,107 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef PAYLOAD_ENCODER_H_
+#define PAYLOAD_ENCODER_H_
+
+#include <streambuf>
+#include <string>
+
+#include "md5.h"
+
+/* Builds a JSON or binary request body in a single pass. Files are deflated, base64
+   encoded and written straight into the body as they are produced, and the
+   MD5 of the body is updated as bytes are appended, so no intermediate copy
+   of the payload is made. Typical use:
+
+       PayloadEncoder encoder(PayloadEncoder::encodedSize("state.xml",
+                                                          data.size())+16);
+       encoder.append("{\"files\":{");
+       encoder.appendFile("state.xml", data, true);
+       encoder.append("}}");
+       encoder.finish(upload.body, upload.md5);
+
+   Binary bodies, sent with BINARY_CONTENT_TYPE to SCVs that accept them,
+   are the JSON message without its files followed by the raw files:
+
+       encoder.appendBinary("{\"frames\":1}");
+       encoder.appendPart("frames.xtc", data, false);
+
+   An encoder is meant to build exactly one body. */
+class PayloadEncoder {
+public:
+    static const char *const BINARY_CONTENT_TYPE;
+
+    /* Reserve room for reserve bytes of output up front */
+    explicit PayloadEncoder(size_t reserve = 0);
+
+    /* Level, 1 to 9, and number of threads gzipped data is compressed
+       with from now on. Defaults to zlib's default level on one thread. */
+    void setGzip(int level, int threads = 1);
+
+    /* Append raw JSON text */
+    void append(const std::string &json);
+
+    /* Append "filename[.gz].b64":"<data>" with data optionally gzipped */
+    void appendFile(const std::string &filename, const std::string &data,
+                    bool gzip);
+
+    /* Append data as a quoted, base64 encoded JSON string */
+    void appendBase64(const std::string &data, bool gzip=false);
+
+    /* Append data as is, preceded by its length as a big endian uint32 */
+    void appendBinary(const std::string &data);
+
+    /* Append a file of a binary body: "filename[.gz]" and its optionally
+       gzipped data, each via appendBinary() */
+    void appendPart(const std::string &filename, const std::string &data,
+                    bool gzip);
+
+    /* Move the body into body and its hex MD5 digest into md5 */
+    void finish(std::string &body, std::string &md5);
+
+    /* Size of data once appended via appendFile() without gzip, used to
+       reserve space up front; gzipped data is usually much smaller */
+    static size_t encodedSize(const std::string &filename, size_t data_size);
+
+    /* Size of data once appended via appendPart() without gzip */
+    static size_t partSize(const std::string &filename, size_t data_size);
+
+private:
+    // Forwards everything written to it into body_ while hashing it
+    class Sink : public std::streambuf {
+    public:
+        Sink(std::string &body, md5_state_s &md5);
+        void drain();
+    protected:
+        int overflow(int c);
+        std::streamsize xsputn(const char *s, std::streamsize n);
+        int sync();
+    private:
+        std::string &body_;
+        md5_state_s &md5_;
+        char buffer_[4096];
+    };
+
+    PayloadEncoder(const PayloadEncoder &);
+    PayloadEncoder &operator=(const PayloadEncoder &);
+
+    std::string body_;
+    md5_state_s md5_;
+    int gzip_level_;
+    int gzip_threads_;
+    Sink sink_;
+};
+
+#endif
@@ -0,0 +1,65 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "PrefixedLog.h"
+
+using namespace std;
+
+// serializes writes from every PrefixedLog, whatever their target
+static Poco::Mutex log_mutex;
+
+PrefixedLog::LineBuf::LineBuf(ostream &target, const string &prefix) :
+    target_(target),
+    prefix_(prefix) {
+
+}
+
+void PrefixedLog::LineBuf::writeLine() {
+    Poco::Mutex::ScopedLock lock(log_mutex);
+    target_ << prefix_ << line_ << std::flush;
+    line_.clear();
+}
+
+void PrefixedLog::LineBuf::finish() {
+    // complete a dangling partial line so it is not lost
+    if(line_.size() > 0) {
+        line_ += '\n';
+        writeLine();
+    }
+}
+
+int PrefixedLog::LineBuf::overflow(int c) {
+    if(c == traits_type::eof())
+        return traits_type::not_eof(c);
+    line_ += traits_type::to_char_type(c);
+    if(c == '\n')
+        writeLine();
+    return c;
+}
+
+streamsize PrefixedLog::LineBuf::xsputn(const char *s, streamsize n) {
+    for(streamsize i=0; i < n; i++)
+        overflow(traits_type::to_int_type(s[i]));
+    return n;
+}
+
+PrefixedLog::PrefixedLog(ostream &target, const string &prefix) :
+    std::ostream(NULL),
+    buf_(target, prefix) {
+    rdbuf(&buf_);
+}
+
+PrefixedLog::~PrefixedLog() {
+    buf_.finish();
+}
@@ -0,0 +1,53 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef PREFIXED_LOG_H_
+#define PREFIXED_LOG_H_
+
+#include <Poco/Mutex.h>
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+/* An ostream for one of several threads sharing a log. Output is collected
+   a line at a time and written to the target with prefix in front, so lines
+   from different threads never interleave. Partial lines are held back until
+   they are completed, even across std::flush. */
+class PrefixedLog : public std::ostream {
+public:
+    PrefixedLog(std::ostream &target, const std::string &prefix);
+
+    /* Writes out a trailing partial line, if any */
+    ~PrefixedLog();
+
+private:
+    class LineBuf : public std::streambuf {
+    public:
+        LineBuf(std::ostream &target, const std::string &prefix);
+        void writeLine();
+        void finish();
+    protected:
+        int overflow(int c);
+        std::streamsize xsputn(const char *s, std::streamsize n);
+    private:
+        std::ostream &target_;
+        std::string prefix_;
+        std::string line_;
+    };
+
+    LineBuf buf_;
+};
+
+#endif
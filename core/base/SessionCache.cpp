@@ -0,0 +1,177 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <openssl/ssl.h>
+#include <openssl/bio.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+
+#include <sstream>
+#include <stdexcept>
+
+#include "SessionCache.h"
+
+using namespace std;
+
+// idle sessions kept per host, one for requests and one for the upload queue
+static const size_t MAX_IDLE_PER_HOST = 2;
+
+static void read_cert_into_ctx(istream &some_stream, SSL_CTX *ctx) {
+    // Add a stream of PEM formatted certificate strings to the trusted store
+    // of the ctx.
+    string line;
+    string buffer;
+    X509_STORE* store = SSL_CTX_get_cert_store(ctx);
+    while(getline(some_stream, line)) {
+        buffer.append(line);
+        buffer.append("\n");
+        if(line.find("END CERTIFICATE") != string::npos ) {
+            BIO *bio = BIO_new(BIO_s_mem());
+            BIO_puts(bio, buffer.c_str());
+            X509 *certificate = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+            BIO_free(bio);
+            if(certificate == NULL)
+                throw std::runtime_error("could not add certificate to trusted CAs");
+            X509_STORE_add_cert(store, certificate);
+            // the store holds its own reference
+            X509_free(certificate);
+            buffer.clear();
+        }
+    }
+}
+
+static void load_cert_bundle(SSL_CTX *ctx) {
+    // hacky as hell way to load certs:)
+    {
+        #include "certs/certs_bundle_0.pem"
+        stringstream ss(ssl_string_0);
+        read_cert_into_ctx(ss, ctx);
+    }
+    {
+        #include "certs/certs_bundle_1.pem"
+        stringstream ss(ssl_string_1);
+        read_cert_into_ctx(ss, ctx);
+    }
+    {
+        #include "certs/certs_bundle_2.pem"
+        stringstream ss(ssl_string_2);
+        read_cert_into_ctx(ss, ctx);
+    }
+    {
+        #include "certs/certs_bundle_3.pem"
+        stringstream ss(ssl_string_3);
+        read_cert_into_ctx(ss, ctx);
+    }
+    {
+        #include "certs/certs_bundle_4.pem"
+        stringstream ss(ssl_string_4);
+        read_cert_into_ctx(ss, ctx);
+    }
+    {
+        #include "certs/certs_bundle_5.pem"
+        stringstream ss(ssl_string_5);
+        read_cert_into_ctx(ss, ctx);
+    }
+    {
+        #include "certs/certs_bundle_6.pem"
+        ;
+        stringstream ss(ssl_string_6);
+        read_cert_into_ctx(ss, ctx);
+    }
+}
+
+SessionCache &SessionCache::instance() {
+    // leaked on purpose so no session outlives OpenSSL during static
+    // destruction; the first call is made before any threads are started
+    static SessionCache *cache = new SessionCache();
+    return *cache;
+}
+
+SessionCache::SessionCache() {
+
+}
+
+Poco::Net::Context::Ptr SessionCache::context(
+    Poco::Net::Context::VerificationMode mode) {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    map<int, Poco::Net::Context::Ptr>::iterator it = contexts_.find(mode);
+    if(it != contexts_.end())
+        return it->second;
+    Poco::Net::Context::Ptr context = new Poco::Net::Context(
+        Poco::Net::Context::CLIENT_USE, "", mode, 9, true);
+    context->enableSessionCache(true);
+    load_cert_bundle(context->sslContext());
+    contexts_[mode] = context;
+    return context;
+}
+
+Poco::Net::HTTPSClientSession *SessionCache::acquire(const string &host,
+    int port, Poco::Net::Context::VerificationMode mode, const string &proxy,
+    bool &reused) {
+    Key key;
+    stringstream ss;
+    ss << host << ":" << port;
+    key.host = ss.str();
+    ss.str("");
+    ss << mode << "|" << proxy << "|" << key.host;
+    key.pool = ss.str();
+    Poco::Net::Context::Ptr ctx = context(mode);
+
+    Poco::Mutex::ScopedLock lock(mutex_);
+    Poco::Net::HTTPSClientSession *session = NULL;
+    multimap<string, Poco::Net::HTTPSClientSession *>::iterator it =
+        idle_.find(key.pool);
+    if(it != idle_.end()) {
+        session = it->second;
+        idle_.erase(it);
+        reused = true;
+    } else {
+        map<string, Poco::Net::Session::Ptr>::iterator tls =
+            tls_sessions_.find(key.host);
+        if(tls != tls_sessions_.end()) {
+            session = new Poco::Net::HTTPSClientSession(host, port, ctx,
+                tls->second);
+        } else {
+            session = new Poco::Net::HTTPSClientSession(host, port, ctx);
+        }
+        session->setKeepAlive(true);
+        reused = false;
+    }
+    keys_[session] = key;
+    return session;
+}
+
+void SessionCache::release(Poco::Net::HTTPSClientSession *session,
+    bool reusable) {
+    if(session == NULL)
+        return;
+    Poco::Mutex::ScopedLock lock(mutex_);
+    map<Poco::Net::HTTPSClientSession *, Key>::iterator it =
+        keys_.find(session);
+    if(it == keys_.end()) {
+        delete session;
+        return;
+    }
+    Key key = it->second;
+    keys_.erase(it);
+    Poco::Net::Session::Ptr tls = session->sslSession();
+    if(!tls.isNull())
+        tls_sessions_[key.host] = tls;
+    if(reusable && session->connected() &&
+       idle_.count(key.pool) < MAX_IDLE_PER_HOST) {
+        idle_.insert(make_pair(key.pool, session));
+    } else {
+        delete session;
+    }
+}
@@ -0,0 +1,73 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef SESSION_CACHE_H_
+#define SESSION_CACHE_H_
+
+#include <Poco/Net/Context.h>
+#include <Poco/Net/HTTPSClientSession.h>
+#include <Poco/Net/Session.h>
+#include <Poco/Mutex.h>
+
+#include <map>
+#include <string>
+
+/* Process-wide TLS state shared by every Core. The SSL context, with the
+   embedded certificate bundle loaded into its store, is built once per
+   verification mode. Sessions handed back after a clean exchange are kept
+   alive and reused for the same host and proxy; otherwise the TLS session
+   of the last connection to a host is remembered so the next handshake
+   resumes it. All methods are thread safe. */
+class SessionCache {
+public:
+    /* The process-wide cache, created on first use and never destroyed */
+    static SessionCache &instance();
+
+    /* Client context for the given verification mode */
+    Poco::Net::Context::Ptr context(Poco::Net::Context::VerificationMode mode);
+
+    /* A keep-alive session to host:port using the context for mode, going
+       through proxy if it is not empty. reused is set if the session was
+       handed back earlier, in which case it is already set up for the proxy.
+       The caller owns the session until it is passed to release(). */
+    Poco::Net::HTTPSClientSession *acquire(const std::string &host, int port,
+        Poco::Net::Context::VerificationMode mode, const std::string &proxy,
+        bool &reused);
+
+    /* Hand back a session from acquire(). A reusable session must have no
+       request in progress and is kept for a later acquire(), otherwise it
+       is deleted. Either way its TLS session is kept for resumption. */
+    void release(Poco::Net::HTTPSClientSession *session, bool reusable);
+
+private:
+    SessionCache();
+    SessionCache(const SessionCache &);
+    SessionCache &operator=(const SessionCache &);
+
+    struct Key {
+        std::string pool;   // mode, proxy and host:port
+        std::string host;   // host:port
+    };
+
+    Poco::Mutex mutex_;
+    std::map<int, Poco::Net::Context::Ptr> contexts_;
+    // sessions handed out by acquire()
+    std::map<Poco::Net::HTTPSClientSession *, Key> keys_;
+    // idle keep-alive sessions by pool key
+    std::multimap<std::string, Poco::Net::HTTPSClientSession *> idle_;
+    // last TLS session negotiated with each host:port
+    std::map<std::string, Poco::Net::Session::Ptr> tls_sessions_;
+};
+
+#endif
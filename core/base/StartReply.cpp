@@ -0,0 +1,267 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <streambuf>
+
+#include "StartReply.h"
+#include "Gzip.h"
+#include "md5.h"
+
+using namespace std;
+
+static string hex_digest(md5_state_s &state) {
+    unsigned char digest[16] = "";
+    md5_finish(&state, digest);
+    char converted[16*2+1];
+    converted[32] = '\0';
+    for(int i=0; i < 16; i++) {
+        sprintf(&converted[i*2], "%02x", digest[i]);
+    }
+    return converted;
+}
+
+// Reads through to source, hashing every byte that is read
+class HashingReader : public std::streambuf {
+public:
+    HashingReader(std::streambuf *source) : source_(source) {
+        md5_init(&md5_);
+        setg(buffer_, buffer_, buffer_);
+    }
+
+    // reads whatever is left of the source, then returns the MD5 of it all
+    string finish() {
+        while(underflow() != traits_type::eof())
+            setg(buffer_, egptr(), egptr());
+        return hex_digest(md5_);
+    }
+
+protected:
+    int underflow() {
+        if(gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        streamsize n = source_->sgetn(buffer_, sizeof(buffer_));
+        if(n <= 0)
+            return traits_type::eof();
+        md5_append(&md5_, reinterpret_cast<const md5_byte_t *>(buffer_), static_cast<int>(n));
+        setg(buffer_, buffer_, buffer_+n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::streambuf *source_;
+    md5_state_s md5_;
+    char buffer_[16384];
+};
+
+// Decodes the characters of a file's JSON string as picojson unescapes
+// them, base64 decoding and inflating them if the file name says to
+class FileDecoder {
+public:
+    FileDecoder(const string &key, string &out, bool hash) :
+        out_(out),
+        base64_(key.find(".b64") != string::npos),
+        hash_(hash),
+        quad_(0),
+        quad_size_(0),
+        padding_(0),
+        encoded_size_(0),
+        decoded_size_(0) {
+        if(base64_ && key.find(".gz") != string::npos)
+            inflater_.reset(new Gzip::Inflater(out));
+        md5_init(&md5_);
+    }
+
+    // called by picojson::_parse_string() for every character
+    void push_back(int c) {
+        if(hash_) {
+            encoded_[encoded_size_++] = static_cast<char>(c);
+            if(encoded_size_ == sizeof(encoded_))
+                flushEncoded();
+        }
+        if(!base64_) {
+            out_.push_back(static_cast<char>(c));
+            return;
+        }
+        int value = sextet(c);
+        if(value < 0) {
+            if(c == '=')
+                padding_++;
+            else if(c != '\r' && c != '\n')
+                throw std::runtime_error("StartReply: bad base64 character");
+            return;
+        }
+        if(padding_ > 0)
+            throw std::runtime_error("StartReply: base64 continues after padding");
+        quad_ = (quad_ << 6) | value;
+        if(++quad_size_ == 4) {
+            emit(static_cast<char>(quad_ >> 16));
+            emit(static_cast<char>(quad_ >> 8));
+            emit(static_cast<char>(quad_));
+            quad_ = 0;
+            quad_size_ = 0;
+        }
+    }
+
+    // the string has ended, returns the MD5 of it if hashed
+    string finish() {
+        if(quad_size_ == 1)
+            throw std::runtime_error("StartReply: truncated base64");
+        // the bits that are left over from a padded quad
+        if(quad_size_ == 2) {
+            emit(static_cast<char>(quad_ >> 4));
+        } else if(quad_size_ == 3) {
+            emit(static_cast<char>(quad_ >> 10));
+            emit(static_cast<char>(quad_ >> 2));
+        }
+        flushDecoded();
+        if(inflater_.get() != NULL)
+            inflater_->finish();
+        if(!hash_)
+            return "";
+        flushEncoded();
+        return hex_digest(md5_);
+    }
+
+private:
+    static int sextet(int c) {
+        if(c >= 'A' && c <= 'Z') return c-'A';
+        if(c >= 'a' && c <= 'z') return c-'a'+26;
+        if(c >= '0' && c <= '9') return c-'0'+52;
+        if(c == '+') return 62;
+        if(c == '/') return 63;
+        return -1;
+    }
+
+    void emit(char byte) {
+        decoded_[decoded_size_++] = byte;
+        if(decoded_size_ == sizeof(decoded_))
+            flushDecoded();
+    }
+
+    void flushDecoded() {
+        if(inflater_.get() != NULL)
+            inflater_->write(decoded_, decoded_size_);
+        else
+            out_.append(decoded_, decoded_size_);
+        decoded_size_ = 0;
+    }
+
+    void flushEncoded() {
+        md5_append(&md5_, reinterpret_cast<const md5_byte_t *>(encoded_), static_cast<int>(encoded_size_));
+        encoded_size_ = 0;
+    }
+
+    string &out_;
+    bool base64_;
+    bool hash_;
+    std::auto_ptr<Gzip::Inflater> inflater_;
+    unsigned long quad_;
+    int quad_size_;
+    int padding_;
+    md5_state_s md5_;
+    char encoded_[4096];
+    size_t encoded_size_;
+    char decoded_[16384];
+    size_t decoded_size_;
+};
+
+// The value of a file, which must be a string
+class FileContext : public picojson::deny_parse_context {
+public:
+    FileContext(FileDecoder &decoder) : decoder_(decoder) {}
+
+    template <typename Iter> bool parse_string(picojson::input<Iter> &in) {
+        return picojson::_parse_string(decoder_, in);
+    }
+
+private:
+    FileDecoder &decoder_;
+};
+
+// The "files" object, decoding each file into files as it is parsed
+class FilesContext : public picojson::deny_parse_context {
+public:
+    FilesContext(const FileCache *cache,
+                 map<string, string> &files,
+                 map<string, string> &file_md5s) :
+        cache_(cache), files_(files), file_md5s_(file_md5s) {}
+
+    bool parse_object_start() { return true; }
+
+    template <typename Iter> bool parse_object_item(picojson::input<Iter> &in, const string &key) {
+        string filename(key);
+        if(filename.find(".b64") != string::npos) {
+            filename = filename.substr(0, filename.length()-4);
+            if(filename.find(".gz") != string::npos)
+                filename = filename.substr(0, filename.length()-3);
+        }
+        string &out = files_[filename];
+        out.clear();
+        bool hash = cache_ != NULL && cache_->isCacheable(filename);
+        FileDecoder decoder(key, out, hash);
+        FileContext ctx(decoder);
+        if(!picojson::_parse(ctx, in))
+            return false;
+        string md5 = decoder.finish();
+        if(hash)
+            file_md5s_[filename] = md5;
+        return true;
+    }
+
+private:
+    const FileCache *cache_;
+    map<string, string> &files_;
+    map<string, string> &file_md5s_;
+};
+
+// The reply, parsed as picojson would except for its "files"
+class ReplyContext : public picojson::default_parse_context {
+public:
+    ReplyContext(picojson::value *out, FilesContext &files) :
+        picojson::default_parse_context(out), files_(files) {}
+
+    template <typename Iter> bool parse_object_item(picojson::input<Iter> &in, const string &key) {
+        if(key == "files")
+            return picojson::_parse(files_, in);
+        return picojson::default_parse_context::parse_object_item(in, key);
+    }
+
+private:
+    FilesContext &files_;
+};
+
+void StartReply::read(istream &body,
+                      const FileCache *cache,
+                      picojson::value &reply,
+                      map<string, string> &files,
+                      map<string, string> &file_md5s,
+                      string &body_md5) {
+    HashingReader reader(body.rdbuf());
+    FilesContext files_ctx(cache, files, file_md5s);
+    ReplyContext ctx(&reply, files_ctx);
+    string err;
+    picojson::_parse(ctx, istreambuf_iterator<char>(&reader),
+                     istreambuf_iterator<char>(), &err);
+    // hash the trailing whitespace too, and leave the connection reusable
+    body_md5 = reader.finish();
+    if(!err.empty())
+        throw std::runtime_error("StartReply: picojson error "+err);
+    if(!reply.is<picojson::object>())
+        throw std::runtime_error("StartReply: no JSON object could be read");
+}
@@ -0,0 +1,46 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef START_REPLY_H_
+#define START_REPLY_H_
+
+#include <istream>
+#include <map>
+#include <string>
+
+#include "picojson.h"
+#include "FileCache.h"
+
+/* Reads the reply of /core/start as it comes off the wire. The largest part
+   of the reply, its files, is never held encoded: each file is base64
+   decoded and inflated as its characters are parsed, straight into the
+   string it ends up in, and the MD5 of the body is computed as it is read.
+   Everything else is parsed into a picojson tree as usual. */
+namespace StartReply {
+
+/* Read the reply from body into reply, without its "files", and the decoded
+   files into files, keyed by their names without .gz and .b64. file_md5s
+   gets the hex MD5 of each file as it was sent, for those cache holds;
+   cache may be NULL. body_md5 gets the hex MD5 of the whole body. */
+void read(std::istream &body,
+          const FileCache *cache,
+          picojson::value &reply,
+          std::map<std::string, std::string> &files,
+          std::map<std::string, std::string> &file_md5s,
+          std::string &body_md5);
+
+}
+
+#endif
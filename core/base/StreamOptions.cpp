@@ -0,0 +1,45 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include "StreamOptions.h"
+
+using namespace std;
+
+StreamOptions::StreamOptions() {
+
+}
+
+StreamOptions::StreamOptions(const picojson::value &options) {
+    if(options.is<picojson::object>())
+        options_ = options.get<picojson::object>();
+    else if(!options.is<picojson::null>())
+        throw std::runtime_error("stream options must be a JSON object");
+}
+
+void StreamOptions::swap(StreamOptions &other) {
+    options_.swap(other.options_);
+}
+
+bool StreamOptions::has(const string &key) const {
+    return !value(key).is<picojson::null>();
+}
+
+const picojson::value &StreamOptions::value(const string &key) const {
+    static const picojson::value null_value;
+    picojson::object::const_iterator it = options_.find(key);
+    if(it == options_.end())
+        return null_value;
+    return it->second;
+}
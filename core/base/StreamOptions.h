@@ -0,0 +1,80 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef STREAM_OPTIONS_H_
+#define STREAM_OPTIONS_H_
+
+#include <string>
+#include <stdexcept>
+
+#include "picojson.h"
+
+/**
+ * The options of a stream, parsed once when the stream is assigned so
+ * lookups are a map search rather than a JSON parse.
+ *
+ * Options are set by the target's owner, so lookups check types and throw
+ * std::runtime_error naming the option rather than asserting. Looking up an
+ * option never adds it.
+ *
+ */
+
+class StreamOptions {
+public:
+    /* No options */
+    StreamOptions();
+
+    /* The options of a stream as sent by the SCV. null means no options,
+       anything else but an object throws. */
+    explicit StreamOptions(const picojson::value &options);
+
+    void swap(StreamOptions &other);
+
+    bool has(const std::string &key) const;
+
+    /* JSON value of an option that may take several types, null if it is
+       not set */
+    const picojson::value &value(const std::string &key) const;
+
+    /* An option that must be set */
+    template<typename T>
+    T get(const std::string &key) const {
+        const picojson::value &option = value(key);
+        if(option.is<picojson::null>())
+            throw std::runtime_error("missing option "+key);
+        return checked<T>(key, option);
+    }
+
+    /* An option, or default_value if it is not set */
+    template<typename T>
+    T get(const std::string &key, const T &default_value) const {
+        const picojson::value &option = value(key);
+        if(option.is<picojson::null>())
+            return default_value;
+        return checked<T>(key, option);
+    }
+
+private:
+    template<typename T>
+    static T checked(const std::string &key, const picojson::value &option) {
+        if(!option.is<T>())
+            throw std::runtime_error("option "+key+" has the wrong type");
+        return option.get<T>();
+    }
+
+    picojson::object options_;
+};
+
+#endif
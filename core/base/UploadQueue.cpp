@@ -0,0 +1,231 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/Exception.h>
+#include <Poco/Clock.h>
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "UploadQueue.h"
+#include "UploadSpool.h"
+#include "SessionCache.h"
+#include "Metrics.h"
+
+using namespace std;
+
+Upload::Upload() : seq(0) {
+
+}
+
+void Upload::swap(Upload &other) {
+    method.swap(other.method);
+    uri.swap(other.uri);
+    body.swap(other.body);
+    md5.swap(other.md5);
+    content_type.swap(other.content_type);
+    name.swap(other.name);
+    std::swap(seq, other.seq);
+}
+
+void sendUpload(Poco::Net::HTTPSClientSession &session,
+                const string &token,
+                const Upload &upload,
+                Metrics *metrics) {
+    ScopedTimer timer(metrics, "https");
+    Poco::Net::HTTPRequest request(upload.method, upload.uri);
+    if(upload.md5.size() > 0)
+        request.set("Content-MD5", upload.md5);
+    if(upload.content_type.size() > 0)
+        request.setContentType(upload.content_type);
+    if(upload.seq > 0) {
+        stringstream seq;
+        seq << upload.seq;
+        request.set("Upload-Seq", seq.str());
+    }
+    request.set("Authorization", token);
+    request.setContentLength(upload.body.length());
+    session.sendRequest(request) << upload.body;
+    Poco::Net::HTTPResponse response;
+    istream &content_stream = session.receiveResponse(response);
+    // keep-alive connections must have the reply consumed before reuse
+    content_stream.ignore(std::numeric_limits<std::streamsize>::max());
+    if(response.getStatus() >= 500) {
+        throw TransientUploadError(upload.name+" bad status code");
+    } else if(response.getStatus() != 200) {
+        throw std::runtime_error(upload.name+" bad status code");
+    }
+}
+
+UploadQueue::UploadQueue(Poco::Net::HTTPSClientSession *session,
+                         const string &token,
+                         int max_pending,
+                         Metrics *metrics,
+                         UploadSpool *spool,
+                         int max_outage,
+                         bool (*exiting)()) :
+    session_(session),
+    token_(token),
+    max_pending_(max_pending),
+    metrics_(metrics),
+    spool_(spool),
+    max_outage_(max_outage),
+    exiting_(exiting),
+    next_seq_(1),
+    sending_(false),
+    stopping_(false) {
+    if(max_pending_ < 1) {
+        delete spool_;
+        throw std::runtime_error("UploadQueue: max_pending must be at least 1");
+    }
+    thread_.start(*this);
+}
+
+UploadQueue::~UploadQueue() {
+    {
+        Poco::Mutex::ScopedLock lock(mutex_);
+        stopping_ = true;
+        pending_.clear();
+        changed_.broadcast();
+    }
+    thread_.join();
+    delete spool_;
+    // a failed upload may have left a half finished exchange behind
+    SessionCache::instance().release(session_, error_.empty());
+}
+
+void UploadQueue::checkError() const {
+    if(error_.size() > 0)
+        throw std::runtime_error(error_);
+}
+
+void UploadQueue::push(Upload &upload) {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    if(spool_ != NULL) {
+        // the upload in flight keeps its entry until it is sent
+        while(error_.empty() && !spool_->fits(upload.body.size())) {
+            changed_.wait(mutex_);
+        }
+    } else {
+        // the upload in flight counts towards the limit
+        while(error_.empty() && int(pending_.size())+sending_ >= max_pending_) {
+            changed_.wait(mutex_);
+        }
+    }
+    checkError();
+    upload.seq = next_seq_++;
+    if(spool_ != NULL) {
+        spool_->write(upload.seq, upload.body);
+        upload.body.clear();
+    }
+    pending_.push_back(Upload());
+    pending_.back().swap(upload);
+    changed_.broadcast();
+}
+
+void UploadQueue::flush() {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    while(error_.empty() && (pending_.size() > 0 || sending_)) {
+        changed_.wait(mutex_);
+    }
+    checkError();
+}
+
+void UploadQueue::run() {
+    while(true) {
+        Upload upload;
+        {
+            Poco::Mutex::ScopedLock lock(mutex_);
+            while(!stopping_ && pending_.empty()) {
+                changed_.wait(mutex_);
+            }
+            if(pending_.empty())
+                return;
+            upload.swap(pending_.front());
+            pending_.pop_front();
+            sending_ = true;
+        }
+        string error = send(upload);
+        Poco::Mutex::ScopedLock lock(mutex_);
+        sending_ = false;
+        if(spool_ != NULL)
+            spool_->remove(upload.seq);
+        if(error.size() > 0) {
+            // nothing queued after a failed upload is sent
+            error_ = error;
+            pending_.clear();
+            changed_.broadcast();
+            return;
+        }
+        changed_.broadcast();
+    }
+}
+
+string UploadQueue::send(Upload &upload) {
+    Poco::Clock outage_start;
+    int delay = 1;
+    while(true) {
+        string error;
+        try {
+            if(spool_ != NULL && upload.body.empty())
+                spool_->read(upload.seq, upload.body);
+            sendUpload(*session_, token_, upload, metrics_);
+            return "";
+        } catch(const TransientUploadError &e) {
+            error = e.what();
+        } catch(const Poco::Exception &e) {
+            error = upload.name+" "+e.displayText();
+        } catch(const std::exception &e) {
+            error = e.what();
+            return error.empty() ? upload.name+" failed" : error;
+        } catch(...) {
+            return upload.name+" failed";
+        }
+        if(spool_ == NULL)
+            return error;
+        if(outage_start.elapsed()/1000000 >= max_outage_) {
+            stringstream message;
+            message << error << ", gave up after " << max_outage_ << " seconds";
+            return message.str();
+        }
+        {
+            Poco::Mutex::ScopedLock lock(mutex_);
+            if(!backOff(delay))
+                return error+", abandoned";
+        }
+        delay = min(delay*2, 60);
+        // the failed exchange may have left the connection unusable
+        session_->reset();
+    }
+}
+
+bool UploadQueue::backOff(int seconds) {
+    ScopedTimer timer(metrics_, "outage");
+    Poco::Clock start;
+    // pushes wake the worker too, so wait out the remainder. Nothing signals
+    // an exit, so it is polled every second.
+    while(!stopping_ && (exiting_ == NULL || !exiting_())) {
+        Poco::Clock::ClockDiff remaining = seconds*1000000LL-start.elapsed();
+        if(remaining <= 0)
+            return true;
+        Poco::Clock::ClockDiff slice = min(remaining/1000+1,
+                                           Poco::Clock::ClockDiff(1000));
+        changed_.tryWait(mutex_, static_cast<long>(slice));
+    }
+    return false;
+}
@@ -0,0 +1,146 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef UPLOAD_QUEUE_H_
+#define UPLOAD_QUEUE_H_
+
+#include <Poco/Net/HTTPSClientSession.h>
+#include <Poco/Runnable.h>
+#include <Poco/Thread.h>
+#include <Poco/Mutex.h>
+#include <Poco/Condition.h>
+
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+class Metrics;
+class UploadSpool;
+
+/* A fully encoded request to the SCV. name is used to prefix error messages,
+   eg. "Core::sendFrame". md5 is sent as the Content-MD5 header if non-empty,
+   and seq as the Upload-Seq header if positive, so the SCV can recognize an
+   upload it already applied when it is sent again. */
+struct Upload {
+    Upload();
+
+    void swap(Upload &other);
+
+    std::string method;
+    std::string uri;
+    std::string body;
+    std::string md5;
+    // the SCV reads bodies without one as JSON
+    std::string content_type;
+    std::string name;
+    int seq;
+};
+
+/* Thrown by sendUpload() when the SCV fails with a 5xx status. Unlike 4xx
+   replies, which reject the upload, these may go away when it is retried. */
+class TransientUploadError : public std::runtime_error {
+public:
+    explicit TransientUploadError(const std::string &what) :
+        std::runtime_error(what) {}
+};
+
+/* Send an upload over session and throw if the SCV does not reply with 200.
+   The round trip is recorded as "https" in metrics, if given. */
+void sendUpload(Poco::Net::HTTPSClientSession &session,
+                const std::string &token,
+                const Upload &upload,
+                Metrics *metrics = NULL);
+
+/**
+ * An UploadQueue sends uploads to the SCV from a background thread over its
+ * own session, so the MD loop only pays for encoding the payload.
+ *
+ * The queue is bounded and push() blocks while it is full. Uploads are sent
+ * in the order they were pushed; anything still queued when the queue is
+ * destroyed without a flush() is dropped. If an upload fails, the worker
+ * stops and the error is rethrown by the next push() or flush(), so the
+ * caller can stop the stream with the error as it would have for a
+ * synchronous upload.
+ *
+ * A queue given an UploadSpool instead keeps the bodies of pending uploads
+ * on disk, numbers uploads so the SCV can drop ones it already applied, and
+ * rides out SCV outages: network errors and 5xx replies are retried with
+ * exponential back off, up to max_outage seconds per upload, before the
+ * upload fails. push() then blocks on the spool's disk budget rather than
+ * on max_pending.
+ *
+ */
+
+class UploadQueue : public Poco::Runnable {
+public:
+    /* The queue takes ownership of session, which must come from
+       SessionCache::acquire() and is released back to it on destruction.
+       Round trips are recorded in metrics, if given, which must outlive the
+       queue. The queue takes ownership of spool, if given. Once exiting,
+       if given, returns true, an outage is no longer ridden out: the upload
+       being retried fails and everything queued after it is dropped. */
+    UploadQueue(Poco::Net::HTTPSClientSession *session,
+                const std::string &token,
+                int max_pending,
+                Metrics *metrics = NULL,
+                UploadSpool *spool = NULL,
+                int max_outage = 900,
+                bool (*exiting)() = NULL);
+
+    ~UploadQueue();
+
+    /* Queue an upload, blocking while max_pending uploads are outstanding,
+       or while the spool is full. The contents of upload are swapped into
+       the queue to avoid a copy. */
+    void push(Upload &upload);
+
+    /* Block until every queued upload has been sent */
+    void flush();
+
+    /* Worker thread loop */
+    void run();
+
+private:
+    /* Throw the stored error, if any. Mutex must be held. */
+    void checkError() const;
+
+    /* Send upload, retrying transient failures if there is a spool. Returns
+       the error that failed it, or an empty string. */
+    std::string send(Upload &upload);
+
+    /* Wait up to seconds or until the queue is stopping or the core is
+       exiting. Mutex must be held. Returns false if either happened. */
+    bool backOff(int seconds);
+
+    Poco::Net::HTTPSClientSession *session_;
+    const std::string token_;
+    const int max_pending_;
+    Metrics *metrics_;
+    UploadSpool *spool_;
+    const int max_outage_;
+    bool (*exiting_)();
+
+    // with a spool, pending uploads only hold their metadata in memory
+    std::deque<Upload> pending_;
+    int next_seq_;
+    bool sending_;
+    bool stopping_;
+    std::string error_;
+
+    mutable Poco::Mutex mutex_;
+    Poco::Condition changed_;
+    Poco::Thread thread_;
+};
+
+#endif
@@ -0,0 +1,97 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "UploadSpool.h"
+
+using namespace std;
+
+UploadSpool::UploadSpool(const string &directory, size_t max_bytes) :
+    directory_(Poco::Path(directory).makeDirectory().toString()),
+    max_bytes_(max_bytes),
+    bytes_(0) {
+    // left behind by an earlier spool of the same stream that was not destroyed
+    Poco::File directory_file(directory_);
+    if(directory_file.exists())
+        directory_file.remove(true);
+    directory_file.createDirectories();
+}
+
+UploadSpool::~UploadSpool() {
+    try {
+        Poco::File(directory_).remove(true);
+    } catch(...) {
+        // a stale directory is cleared by the next spool using it
+    }
+}
+
+string UploadSpool::path(int seq) const {
+    stringstream name;
+    name << seq << ".upload";
+    // directory_ ends with a separator
+    return directory_+name.str();
+}
+
+bool UploadSpool::fits(size_t size) const {
+    return sizes_.empty() || bytes_+size <= max_bytes_;
+}
+
+void UploadSpool::write(int seq, const string &body) {
+    remove(seq);
+    const string filename = path(seq);
+    ofstream file(filename.c_str(), ios::binary | ios::trunc);
+    file.write(body.data(), body.size());
+    file.close();
+    if(!file) {
+        std::remove(filename.c_str());
+        throw std::runtime_error("UploadSpool: cannot write "+filename);
+    }
+    sizes_[seq] = body.size();
+    bytes_ += body.size();
+}
+
+void UploadSpool::read(int seq, string &body) const {
+    const string filename = path(seq);
+    ifstream file(filename.c_str(), ios::binary);
+    if(!file)
+        throw std::runtime_error("UploadSpool: cannot read "+filename);
+    file.seekg(0, ios::end);
+    body.resize(file.tellg());
+    file.seekg(0, ios::beg);
+    if(body.size() > 0)
+        file.read(&body[0], body.size());
+    if(!file)
+        throw std::runtime_error("UploadSpool: cannot read "+filename);
+}
+
+void UploadSpool::remove(int seq) {
+    map<int, size_t>::iterator it = sizes_.find(seq);
+    if(it == sizes_.end())
+        return;
+    std::remove(path(seq).c_str());
+    bytes_ -= it->second;
+    sizes_.erase(it);
+}
+
+size_t UploadSpool::bytes() const {
+    return bytes_;
+}
@@ -0,0 +1,71 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef UPLOAD_SPOOL_H_
+#define UPLOAD_SPOOL_H_
+
+#include <map>
+#include <string>
+
+/**
+ * An UploadSpool keeps the bodies of queued uploads on disk, so a stream can
+ * keep producing frames and checkpoints while the SCV is unreachable
+ * without holding them in memory.
+ *
+ * Entries are keyed by the upload's sequence number and stored one file per
+ * entry in a directory owned by the spool, which is emptied when the spool
+ * is created and removed when it is destroyed. The spool only accounts for
+ * its budget, it is up to the caller to wait for room. Not thread safe.
+ *
+ */
+
+class UploadSpool {
+public:
+    /* max_bytes is the disk budget of the entries in directory */
+    UploadSpool(const std::string &directory, size_t max_bytes);
+
+    ~UploadSpool();
+
+    /* Whether an entry of size bytes fits in the budget. An empty spool
+       always takes the entry, so an upload larger than the budget cannot
+       block forever. */
+    bool fits(size_t size) const;
+
+    /* Store body as entry seq, throwing if it cannot be written */
+    void write(int seq, const std::string &body);
+
+    /* Read entry seq into body. Only touches the entry's file, so it may be
+       called without a lock while other entries are written or removed. */
+    void read(int seq, std::string &body) const;
+
+    /* Delete entry seq, if it exists */
+    void remove(int seq);
+
+    /* Bytes taken by the entries on disk */
+    size_t bytes() const;
+
+private:
+    UploadSpool(const UploadSpool &);
+    UploadSpool &operator=(const UploadSpool &);
+
+    std::string path(int seq) const;
+
+    const std::string directory_;
+    const size_t max_bytes_;
+    std::map<int, size_t> sizes_;
+    size_t bytes_;
+};
+
+#endif
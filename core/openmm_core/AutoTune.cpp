@@ -0,0 +1,157 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include "AutoTune.h"
+#include "StateTests.h"
+#include "picojson.h"
+
+#include <OpenMM.h>
+#include <Poco/Clock.h>
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+// each candidate is timed for at least this long, after its warm up steps
+static const double BENCHMARK_SECONDS = 3;
+static const int WARMUP_STEPS = 50;
+static const int BATCH_STEPS = 50;
+
+// A rock salt lattice of 4096 Lennard-Jones ions with PME, which exercises
+// the same kernels as a solvated protein at a size every device can run.
+static OpenMM::System *make_system(vector<OpenMM::Vec3> &positions) {
+    const int per_side = 16;
+    const double spacing = 0.35;
+    const double side = per_side*spacing;
+    OpenMM::System *system = new OpenMM::System;
+    OpenMM::NonbondedForce *nonbonded = new OpenMM::NonbondedForce;
+    nonbonded->setNonbondedMethod(OpenMM::NonbondedForce::PME);
+    nonbonded->setCutoffDistance(1.0);
+    for(int i=0; i < per_side; i++) {
+        for(int j=0; j < per_side; j++) {
+            for(int k=0; k < per_side; k++) {
+                system->addParticle(39.9);
+                nonbonded->addParticle((i+j+k) % 2 ? 0.3 : -0.3, 0.34, 0.996);
+                positions.push_back(OpenMM::Vec3(spacing*i, spacing*j, spacing*k));
+            }
+        }
+    }
+    system->addForce(nonbonded);
+    system->setDefaultPeriodicBoxVectors(OpenMM::Vec3(side, 0, 0),
+        OpenMM::Vec3(0, side, 0), OpenMM::Vec3(0, 0, side));
+    return system;
+}
+
+// steps per second of the candidate, or 0 if it fails or its results are
+// not accurate enough
+static double benchmark(const string &platform, const AutoTune::Candidate &candidate,
+                        OpenMM::System &system, const vector<OpenMM::Vec3> &positions,
+                        OpenMM::Context &reference, ostream &log) {
+    log << "autotune: " << candidate.name << "... " << flush;
+    try {
+        OpenMM::LangevinIntegrator integrator(300, 1, 0.002);
+        integrator.setRandomNumberSeed(2014);
+        OpenMM::Context context(system, integrator,
+            OpenMM::Platform::getPlatformByName(platform), candidate.properties);
+        context.setPositions(positions);
+        context.setVelocitiesToTemperature(300, 2014);
+        integrator.step(WARMUP_STEPS);
+        int steps = 0;
+        Poco::Clock start;
+        do {
+            integrator.step(BATCH_STEPS);
+            steps += BATCH_STEPS;
+            // steps are queued, so wait on a state before reading the clock
+            context.getState(OpenMM::State::Energy);
+        } while(start.elapsed()/1e6 < BENCHMARK_SECONDS);
+        double steps_per_second = steps/(start.elapsed()/1e6);
+        OpenMM::State state = context.getState(OpenMM::State::Positions |
+            OpenMM::State::Velocities | OpenMM::State::Parameters |
+            OpenMM::State::Energy | OpenMM::State::Forces);
+        reference.setState(state);
+        OpenMM::State reference_state = reference.getState(OpenMM::State::Energy | OpenMM::State::Forces);
+        StateTests::checkState(state, &reference_state);
+        log << steps_per_second << " steps/s" << endl;
+        return steps_per_second;
+    } catch(const std::exception &e) {
+        log << "failed: " << e.what() << endl;
+        return 0;
+    }
+}
+
+AutoTune::Candidate AutoTune::fastest(const string &platform,
+                                      const vector<Candidate> &candidates,
+                                      ostream &log) {
+    vector<OpenMM::Vec3> positions;
+    OpenMM::System *system = make_system(positions);
+    OpenMM::VerletIntegrator reference_integrator(0.002);
+    OpenMM::Context reference(*system, reference_integrator,
+        OpenMM::Platform::getPlatformByName("Reference"));
+    double best = 0;
+    unsigned choice = 0;
+    for(unsigned i=0; i < candidates.size(); i++) {
+        double steps_per_second = benchmark(platform, candidates[i], *system, positions, reference, log);
+        if(steps_per_second > best) {
+            best = steps_per_second;
+            choice = i;
+        }
+    }
+    delete system;
+    if(best == 0)
+        throw std::runtime_error("autotune: no configuration passed the benchmark");
+    return candidates[choice];
+}
+
+// identifies the hardware and software a choice was made for
+static string cache_key(const string &platform, const vector<AutoTune::Candidate> &candidates) {
+    stringstream key;
+    key << CORE_VERSION << ";" << OpenMM::Platform::getOpenMMVersion() << ";" << platform;
+    for(unsigned i=0; i < candidates.size(); i++)
+        key << ";" << candidates[i].name;
+    return key.str();
+}
+
+AutoTune::Candidate AutoTune::select(const string &platform,
+                                     const vector<Candidate> &candidates,
+                                     const string &cache_file,
+                                     ostream &log) {
+    string key = cache_key(platform, candidates);
+    ifstream cached(cache_file.c_str());
+    picojson::value cache;
+    if(cached && picojson::parse(cache, cached).empty() && cache.is<picojson::object>() &&
+       cache.get("key").is<string>() && cache.get("key").get<string>() == key) {
+        const string &name = cache.get("choice").to_str();
+        for(unsigned i=0; i < candidates.size(); i++) {
+            if(candidates[i].name == name) {
+                log << "autotune: using " << name << " from " << cache_file << endl;
+                return candidates[i];
+            }
+        }
+    }
+    cached.close();
+    Candidate choice = fastest(platform, candidates, log);
+    log << "autotune: chose " << choice.name << endl;
+    picojson::object entry;
+    entry["key"] = picojson::value(key);
+    entry["choice"] = picojson::value(choice.name);
+    ofstream out(cache_file.c_str());
+    out << picojson::value(entry).serialize() << endl;
+    if(!out)
+        log << "autotune: cannot write " << cache_file << ", tuning again next time" << endl;
+    return choice;
+}
@@ -0,0 +1,51 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef AUTO_TUNE_H_
+#define AUTO_TUNE_H_
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* Picks the device and precision a core runs on by timing a short
+   standard simulation in each configuration, for --autotune. */
+namespace AutoTune {
+
+/* A configuration to try, named for the log and the cache */
+struct Candidate {
+    std::string name;
+    std::map<std::string, std::string> properties;
+};
+
+/* Time the standard system with the platform in each candidate and return
+   the fastest whose forces and energies agree with the Reference platform
+   to within the StateTests tolerances. Throws if none does. */
+Candidate fastest(const std::string &platform,
+                  const std::vector<Candidate> &candidates,
+                  std::ostream &log);
+
+/* fastest(), remembering the choice in cache_file. The choice is reused
+   as long as the core version, OpenMM version, platform and candidates
+   are unchanged, so only the first launch on a machine pays for it. */
+Candidate select(const std::string &platform,
+                 const std::vector<Candidate> &candidates,
+                 const std::string &cache_file,
+                 std::ostream &log);
+
+}
+
+#endif
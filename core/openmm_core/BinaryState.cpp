@@ -0,0 +1,225 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "BinaryState.h"
+#include "md5.h"
+
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <cstdint>
+#else
+#include <stdint.h>
+#endif
+
+using namespace std;
+
+static const char MAGIC[4] = {'S', 'T', 'B', 'S'};
+static const char DELTA_MAGIC[4] = {'S', 'T', 'B', 'D'};
+static const uint32_t VERSION = 1;
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+template<typename T>
+static void put(string &out, const T &value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+static void put_vec3s(string &out, const vector<OpenMM::Vec3> &vecs) {
+    for(unsigned i=0; i < vecs.size(); i++) {
+        put(out, vecs[i][0]);
+        put(out, vecs[i][1]);
+        put(out, vecs[i][2]);
+    }
+}
+
+template<typename T>
+static T get(const string &in, size_t &offset) {
+    if(offset+sizeof(T) > in.size())
+        throw std::runtime_error("BinaryState: truncated state");
+    T value;
+    memcpy(&value, &in[offset], sizeof(T));
+    offset += sizeof(T);
+    return value;
+}
+
+static OpenMM::Vec3 get_vec3(const string &in, size_t &offset) {
+    double x = get<double>(in, offset);
+    double y = get<double>(in, offset);
+    double z = get<double>(in, offset);
+    return OpenMM::Vec3(x, y, z);
+}
+
+static void put_parameters(string &out, const map<string, double> &parameters) {
+    put(out, static_cast<uint32_t>(parameters.size()));
+    for(map<string, double>::const_iterator it = parameters.begin();
+        it != parameters.end(); it++) {
+        put(out, static_cast<uint32_t>(it->first.size()));
+        out.append(it->first);
+        put(out, it->second);
+    }
+}
+
+static void md5_digest(const string &data, md5_byte_t digest[16]) {
+    md5_state_s state;
+    md5_init(&state);
+    md5_append(&state, reinterpret_cast<const md5_byte_t *>(data.data()),
+               static_cast<int>(data.size()));
+    md5_finish(&state, digest);
+}
+
+// checks the header of a full state or a delta, returning its atom count
+static uint32_t read_header(const string &data, const char magic[4], size_t &offset) {
+    if(data.size() < 4 || memcmp(&data[0], magic, 4) != 0)
+        throw std::runtime_error("BinaryState: not a binary state");
+    offset = 4;
+    if(get<uint32_t>(data, offset) != VERSION)
+        throw std::runtime_error("BinaryState: unsupported version");
+    if(get<uint32_t>(data, offset) != BYTE_ORDER_MARK)
+        throw std::runtime_error("BinaryState: unsupported byte order");
+    return get<uint32_t>(data, offset);
+}
+
+string BinaryState::serialize(const OpenMM::State &state) {
+    const vector<OpenMM::Vec3> &positions = state.getPositions();
+    const vector<OpenMM::Vec3> &velocities = state.getVelocities();
+    const map<string, double> &parameters = state.getParameters();
+    OpenMM::Vec3 a, b, c;
+    state.getPeriodicBoxVectors(a, b, c);
+
+    string out;
+    out.reserve(64+2*3*sizeof(double)*positions.size()+64*parameters.size());
+    out.append(MAGIC, 4);
+    put(out, VERSION);
+    put(out, BYTE_ORDER_MARK);
+    put(out, static_cast<uint32_t>(positions.size()));
+    put(out, state.getTime());
+    for(int i=0; i < 3; i++) put(out, a[i]);
+    for(int i=0; i < 3; i++) put(out, b[i]);
+    for(int i=0; i < 3; i++) put(out, c[i]);
+    put_vec3s(out, positions);
+    put_vec3s(out, velocities);
+    put_parameters(out, parameters);
+    return out;
+}
+
+void BinaryState::deserialize(const string &data, OpenMM::Context &context) {
+    size_t offset;
+    uint32_t n_atoms = read_header(data, MAGIC, offset);
+    double time = get<double>(data, offset);
+    OpenMM::Vec3 a = get_vec3(data, offset);
+    OpenMM::Vec3 b = get_vec3(data, offset);
+    OpenMM::Vec3 c = get_vec3(data, offset);
+    vector<OpenMM::Vec3> positions(n_atoms);
+    for(uint32_t i=0; i < n_atoms; i++)
+        positions[i] = get_vec3(data, offset);
+    vector<OpenMM::Vec3> velocities(n_atoms);
+    for(uint32_t i=0; i < n_atoms; i++)
+        velocities[i] = get_vec3(data, offset);
+    uint32_t n_params = get<uint32_t>(data, offset);
+    map<string, double> parameters;
+    for(uint32_t i=0; i < n_params; i++) {
+        uint32_t length = get<uint32_t>(data, offset);
+        if(offset+length > data.size())
+            throw std::runtime_error("BinaryState: truncated state");
+        string name(data, offset, length);
+        offset += length;
+        parameters[name] = get<double>(data, offset);
+    }
+    if(offset != data.size())
+        throw std::runtime_error("BinaryState: trailing data");
+    // same order as Context::setState()
+    context.setTime(time);
+    context.setPeriodicBoxVectors(a, b, c);
+    context.setPositions(positions);
+    context.setVelocities(velocities);
+    for(map<string, double>::const_iterator it = parameters.begin();
+        it != parameters.end(); it++) {
+        context.setParameter(it->first, it->second);
+    }
+}
+
+string BinaryState::serializeDelta(const OpenMM::State &state, const string &base) {
+    size_t base_offset;
+    uint32_t n_atoms = read_header(base, MAGIC, base_offset);
+    const vector<OpenMM::Vec3> &positions = state.getPositions();
+    const vector<OpenMM::Vec3> &velocities = state.getVelocities();
+    if(positions.size() != n_atoms)
+        throw std::runtime_error("BinaryState: delta against a different system");
+    // skip the base's time and box
+    base_offset += 10*sizeof(double);
+    if(base.size() < base_offset+6*sizeof(double)*n_atoms)
+        throw std::runtime_error("BinaryState: truncated state");
+    OpenMM::Vec3 a, b, c;
+    state.getPeriodicBoxVectors(a, b, c);
+    md5_byte_t base_md5[16];
+    md5_digest(base, base_md5);
+
+    string out;
+    out.reserve(128+2*3*sizeof(float)*n_atoms+64*state.getParameters().size());
+    out.append(DELTA_MAGIC, 4);
+    put(out, VERSION);
+    put(out, BYTE_ORDER_MARK);
+    put(out, n_atoms);
+    out.append(reinterpret_cast<const char *>(base_md5), 16);
+    put(out, state.getTime());
+    for(int i=0; i < 3; i++) put(out, a[i]);
+    for(int i=0; i < 3; i++) put(out, b[i]);
+    for(int i=0; i < 3; i++) put(out, c[i]);
+    for(int k=0; k < 2; k++) {
+        const vector<OpenMM::Vec3> &vecs = k == 0 ? positions : velocities;
+        for(uint32_t i=0; i < n_atoms; i++) {
+            for(int j=0; j < 3; j++) {
+                float delta = static_cast<float>(vecs[i][j]-get<double>(base, base_offset));
+                put(out, delta);
+            }
+        }
+    }
+    put_parameters(out, state.getParameters());
+    return out;
+}
+
+string BinaryState::applyDelta(const string &base, const string &delta) {
+    size_t base_offset, offset;
+    uint32_t n_atoms = read_header(base, MAGIC, base_offset);
+    if(read_header(delta, DELTA_MAGIC, offset) != n_atoms)
+        throw std::runtime_error("BinaryState: delta against a different system");
+    if(offset+16 > delta.size())
+        throw std::runtime_error("BinaryState: truncated state");
+    md5_byte_t base_md5[16];
+    md5_digest(base, base_md5);
+    if(memcmp(base_md5, &delta[offset], 16) != 0)
+        throw std::runtime_error("BinaryState: delta was made against another state");
+    offset += 16;
+    // the base's time and box are replaced by the delta's
+    base_offset += 10*sizeof(double);
+
+    string out;
+    out.reserve(base.size());
+    out.append(MAGIC, 4);
+    put(out, VERSION);
+    put(out, BYTE_ORDER_MARK);
+    put(out, n_atoms);
+    for(int i=0; i < 10; i++)
+        put(out, get<double>(delta, offset));
+    for(uint32_t i=0; i < 2*3*n_atoms; i++) {
+        double value = get<double>(base, base_offset)+get<float>(delta, offset);
+        put(out, value);
+    }
+    // parameters are stored in full, in the same layout
+    out.append(delta, offset, string::npos);
+    return out;
+}
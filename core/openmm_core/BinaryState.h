@@ -0,0 +1,58 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef BINARY_STATE_H_
+#define BINARY_STATE_H_
+
+#include <OpenMM.h>
+#include <string>
+
+// Compact checkpoints holding only what is needed to resume a simulation:
+// time, periodic box vectors, positions, velocities and context parameters,
+// all in double precision. Forces and energies are recomputed on load.
+//
+// Layout (native byte order, checked on load):
+//   char[4] "STBS", uint32 version, uint32 byte order mark, uint32 n_atoms,
+//   double time, double box[9], double positions[3*n_atoms],
+//   double velocities[3*n_atoms], uint32 n_params,
+//   n_params * (uint32 name_length, char name[name_length], double value)
+//
+// Deltas hold a state relative to a serialized base state, for incremental
+// checkpoints. Positions and velocities are stored as float differences
+// from the base, which is half the size and compresses far better; the
+// rounding is well below what a mixed precision platform keeps anyway.
+//
+//   char[4] "STBD", uint32 version, uint32 byte order mark, uint32 n_atoms,
+//   uint8 base_md5[16], double time, double box[9],
+//   float position_deltas[3*n_atoms], float velocity_deltas[3*n_atoms],
+//   uint32 n_params, params as above
+namespace BinaryState {
+
+/* Serialize a state with positions, velocities and parameters */
+std::string serialize(const OpenMM::State &state);
+
+/* Load a serialized state into context */
+void deserialize(const std::string &data, OpenMM::Context &context);
+
+/* Serialize a state with positions, velocities and parameters as a delta
+   against base, a serialized state of the same system */
+std::string serializeDelta(const OpenMM::State &state, const std::string &base);
+
+/* The serialized state a delta describes, throwing if delta was not made
+   against base */
+std::string applyDelta(const std::string &base, const std::string &delta);
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include "CoreWorker.h"
+#include "OpenMMCore.h"
+#include "StreamPrefetcher.h"
+#include "ExitSignal.h"
+
+#include <algorithm>
+#include <memory>
+
+using namespace std;
+
+WorkerSettings::WorkerSettings() :
+    checkpoint_frequency(7200),
+    progress_interval(60),
+    upload_queue_size(4),
+    gzip_threads(1),
+    max_atoms(0),
+    prefetch(false),
+    file_cache(NULL),
+    metrics_log(NULL),
+    spool_bytes(0) {
+
+}
+
+CoreWorker::CoreWorker(const WorkerSettings &settings,
+                       const map<string, string> &properties,
+                       ostream &log) :
+    settings_(settings),
+    properties_(properties),
+    log_(log),
+    prefetcher_(NULL),
+    core_(NULL) {
+    if(settings_.prefetch) {
+        prefetcher_ = new StreamPrefetcher(settings_.core_key,
+            settings_.cc_uri, settings_.donor_token, settings_.target_id,
+            settings_.proxy_string, log_);
+        prefetcher_->setFileCache(settings_.file_cache);
+        prefetcher_->setMaxAtoms(settings_.max_atoms);
+    }
+}
+
+CoreWorker::~CoreWorker() {
+    delete prefetcher_;
+}
+
+float CoreWorker::nsPerDay() const {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    if(core_ == NULL)
+        return 0;
+    return core_->lastNsPerDay();
+}
+
+void CoreWorker::run() {
+    int delay_in_sec = 1;
+    while(!ExitSignal::shouldExit()) {
+        try {
+            OpenMMCore core(settings_.core_key, properties_, log_);
+#ifdef FAH_CORE
+            core.wu_dir = settings_.wu_dir;
+#endif
+            log_ << "setting checkpoint interval to " << settings_.checkpoint_frequency << " seconds" << endl;
+            core.setCheckpointSendInterval(settings_.checkpoint_frequency);
+            core.setProgressUpdateInterval(settings_.progress_interval);
+            core.setUploadQueueSize(settings_.upload_queue_size);
+            core.setGzipThreads(settings_.gzip_threads);
+            core.setPrefetcher(prefetcher_);
+            core.setFileCache(settings_.file_cache);
+            core.setMaxAtoms(settings_.max_atoms);
+            core.setMetricsLog(settings_.metrics_log);
+            if(settings_.spool_dir.size() > 0)
+                core.setUploadSpool(settings_.spool_dir, settings_.spool_bytes);
+            std::auto_ptr<PreparedStream> prepared;
+            if(prefetcher_ != NULL && prefetcher_->pending())
+                prepared.reset(prefetcher_->take());
+            if(prepared.get() != NULL) {
+                // already assigned, there is nothing to back off from
+                core.startStream(*prepared);
+                prepared.reset();
+            } else {
+                log_ << "sleeping for " << delay_in_sec << " seconds" << endl;
+                if(ExitSignal::wait(delay_in_sec)) {
+                    return;
+                }
+                delay_in_sec = min(delay_in_sec * 5, 300);
+                core.startStream(settings_.cc_uri, settings_.donor_token,
+                                 settings_.target_id, settings_.proxy_string);
+            }
+            delay_in_sec = 1;
+            {
+                Poco::Mutex::ScopedLock lock(mutex_);
+                core_ = &core;
+            }
+            try {
+                core.main();
+            } catch(...) {
+                Poco::Mutex::ScopedLock lock(mutex_);
+                core_ = NULL;
+                throw;
+            }
+            Poco::Mutex::ScopedLock lock(mutex_);
+            core_ = NULL;
+        } catch(const exception &e) {
+            log_ << e.what() << endl;
+        }
+    }
+}
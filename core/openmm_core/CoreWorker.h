@@ -0,0 +1,93 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef CORE_WORKER_H_
+#define CORE_WORKER_H_
+
+#include <Poco/Mutex.h>
+#include <Poco/Runnable.h>
+
+#include <map>
+#include <ostream>
+#include <string>
+
+class FileCache;
+class OpenMMCore;
+class StreamPrefetcher;
+
+/* Settings shared by every worker of a core process */
+struct WorkerSettings {
+    WorkerSettings();
+
+    std::string core_key;
+    std::string cc_uri;
+    std::string donor_token;
+    std::string target_id;
+    std::string proxy_string;
+    int checkpoint_frequency;
+    int progress_interval;
+    int upload_queue_size;
+    // threads each gzipped upload is compressed with
+    int gzip_threads;
+    // atom count hint for the CC, 0 for none
+    int max_atoms;
+    bool prefetch;
+    // shared by all workers, may be NULL
+    FileCache *file_cache;
+    // JSON lines of stream timings, shared by all workers, may be NULL
+    std::ostream *metrics_log;
+    // directory uploads are spooled to during SCV outages, empty for none
+    std::string spool_dir;
+    // disk budget of this worker's spool
+    size_t spool_bytes;
+#ifdef FAH_CORE
+    std::string wu_dir;
+#endif
+};
+
+/**
+ * Runs streams on one device, one after another, backing off when no stream
+ * can be started, until ExitSignal::shouldExit(). A core process runs one
+ * worker per stream slot, several of which may share a device, each on its
+ * own thread, with its own OpenMM contexts and its own log.
+ */
+class CoreWorker : public Poco::Runnable {
+public:
+    /* properties are the OpenMM context properties selecting the device */
+    CoreWorker(const WorkerSettings &settings,
+               const std::map<std::string, std::string> &properties,
+               std::ostream &log);
+
+    ~CoreWorker();
+
+    void run();
+
+    /* ns/day of the stream currently running, 0 if there is none */
+    float nsPerDay() const;
+
+private:
+    CoreWorker(const CoreWorker &);
+    CoreWorker &operator=(const CoreWorker &);
+
+    WorkerSettings settings_;
+    std::map<std::string, std::string> properties_;
+    std::ostream &log_;
+    StreamPrefetcher *prefetcher_;
+    mutable Poco::Mutex mutex_;
+    // guarded by mutex_, only set while the core is alive
+    OpenMMCore *core_;
+};
+
+#endif
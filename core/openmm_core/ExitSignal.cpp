@@ -1,8 +1,25 @@
 #include "ExitSignal.h"
+#include <Poco/Event.h>
+#include <Poco/Runnable.h>
+#include <Poco/Thread.h>
 #include <errno.h>
 #include <time.h>
+#include <cstdlib>
 
-static sig_atomic_t global_exit = false;
+static volatile sig_atomic_t global_exit = false;
+
+// set by the watcher once any reason to exit is seen, so that shouldExit()
+// is a plain read
+static volatile sig_atomic_t exiting = false;
+static bool watching = false;
+
+// wakes threads in wait() once exiting is set, and stays set
+static Poco::Event exit_event(false);
+
+// signals are seen within WATCH_INTERVAL_MS, the exit time and the lifeline
+// are checked every LIFELINE_TICKS intervals
+static const long WATCH_INTERVAL_MS = 100;
+static const int LIFELINE_TICKS = 10;
 
 static time_t exit_time = 0;
 
@@ -79,18 +96,69 @@ void ExitSignal::setExitTime(int t_in_seconds) {
 	exit_time = t_in_seconds + time(NULL);
 }
 
+static bool check_exit() {
+#ifdef FAH_CORE
+	return pid_is_dead() || has_expired() || global_exit;
+#else
+	return has_expired() || global_exit;
+#endif
+}
+
+class Watcher : public Poco::Runnable {
+public:
+	void run() {
+		for(int tick=0; ; tick++) {
+			if(global_exit || (tick % LIFELINE_TICKS == 0 && check_exit())) {
+				exiting = true;
+				exit_event.set();
+				return;
+			}
+			if(stop_.tryWait(WATCH_INTERVAL_MS))
+				return;
+		}
+	}
+	Poco::Event stop_;
+};
+
+static Watcher watcher;
+static Poco::Thread watcher_thread;
+
+static void stop_watcher() {
+	watcher.stop_.set();
+	watcher_thread.join();
+}
+
 void ExitSignal::init() {
 #ifdef _WIN32
     signal(SIGBREAK, exit_signal_handler);
 #endif
     signal(SIGINT, exit_signal_handler);
     signal(SIGTERM, exit_signal_handler);
+	if(!watching) {
+		watching = true;
+		watcher_thread.start(watcher);
+		atexit(stop_watcher);
+	}
 }
 
 bool ExitSignal::shouldExit() {
-#ifdef FAH_CORE
-	return pid_is_dead() || has_expired() || global_exit;
-#else
-	return has_expired() || global_exit;
-#endif
+	if(watching)
+		return exiting;
+	return check_exit();
+}
+
+bool ExitSignal::wait(double seconds) {
+	long milliseconds = static_cast<long>(seconds*1000);
+	if(watching) {
+		if(milliseconds > 0)
+			exit_event.tryWait(milliseconds);
+		return shouldExit();
+	}
+	// without the watcher nothing wakes us up, so wake up to check
+	while(milliseconds > 0 && !shouldExit()) {
+		long step = milliseconds < WATCH_INTERVAL_MS ? milliseconds : WATCH_INTERVAL_MS;
+		Poco::Thread::sleep(step);
+		milliseconds -= step;
+	}
+	return shouldExit();
 }
\ No newline at end of file
@@ -18,12 +18,18 @@ namespace ExitSignal {
 #endif
 #endif
 
-/* Initialize */
+/* Initialize, and start the thread that watches the exit time and the
+   lifeline */
 void init();
 
-/* If the core should exit or not */
+/* If the core should exit or not. Only reads a flag once init() has been
+   called, so it is cheap enough to call every step */
 bool shouldExit();
 
+/* Sleep for up to seconds, waking up early if the core should exit.
+   Returns shouldExit() */
+bool wait(double seconds);
+
 /* Number of seconds the core should run for */
 void setExitTime(int t_in_seconds);
 
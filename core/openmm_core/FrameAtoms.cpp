@@ -0,0 +1,90 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "FrameAtoms.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+static bool bonded(const FrameAtoms::Bonds &bonds, int a, int b) {
+    return bonds.count(make_pair(min(a, b), max(a, b))) > 0;
+}
+
+bool FrameAtoms::isWater(const vector<int> &molecule,
+                         const vector<double> &masses,
+                         const Bonds &bonds) {
+    if(molecule.size() < 3 || molecule.size() > 5)
+        return false;
+    vector<int> atoms;
+    double total_mass = 0;
+    for(size_t i=0; i < molecule.size(); i++) {
+        double mass = masses[molecule[i]];
+        if(mass > 0) {
+            atoms.push_back(molecule[i]);
+            total_mass += mass;
+        }
+    }
+    if(atoms.size() != 3)
+        return false;
+    // H2O weighs 18.0, D2O 20.0; rigid models also constrain H-H, so only
+    // the bonds of the central atom are checked
+    if(total_mass < 17.0 || total_mass > 21.0)
+        return false;
+    for(int i=0; i < 3; i++) {
+        if(bonded(bonds, atoms[i], atoms[(i+1)%3]) &&
+           bonded(bonds, atoms[i], atoms[(i+2)%3]))
+            return true;
+    }
+    return false;
+}
+
+vector<int> FrameAtoms::select(const picojson::value &selection,
+                               const vector<double> &masses,
+                               const vector<vector<int> > &molecules,
+                               const Bonds &bonds) {
+    vector<int> atoms;
+    const int n_atoms = masses.size();
+    if(selection.is<picojson::null>() ||
+       (selection.is<string>() && selection.get<string>() == "all")) {
+        return atoms;
+    } else if(selection.is<string>() && selection.get<string>() == "solute") {
+        // everything but water and monatomic ions
+        for(size_t i=0; i < molecules.size(); i++) {
+            if(molecules[i].size() > 1 && !isWater(molecules[i], masses, bonds))
+                atoms.insert(atoms.end(), molecules[i].begin(), molecules[i].end());
+        }
+        if(atoms.empty())
+            throw std::runtime_error("frame_atoms is solute, but the system has no solute");
+    } else if(selection.is<picojson::array>()) {
+        const picojson::array &indices = selection.get<picojson::array>();
+        for(size_t i=0; i < indices.size(); i++) {
+            if(!indices[i].is<double>())
+                throw std::runtime_error("frame_atoms indices must be numbers");
+            double index = indices[i].get<double>();
+            if(index < 0 || index >= n_atoms || index != static_cast<int>(index))
+                throw std::runtime_error("frame_atoms has an invalid atom index");
+            atoms.push_back(static_cast<int>(index));
+        }
+        if(atoms.empty())
+            throw std::runtime_error("frame_atoms selects no atoms");
+    } else {
+        throw std::runtime_error("frame_atoms must be \"all\", \"solute\" or a list of atom indices");
+    }
+    sort(atoms.begin(), atoms.end());
+    atoms.erase(unique(atoms.begin(), atoms.end()), atoms.end());
+    return atoms;
+}
@@ -0,0 +1,51 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef FRAME_ATOMS_H_
+#define FRAME_ATOMS_H_
+
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "picojson.h"
+
+// Selection of the atoms written to frames. Only needs the masses and
+// connectivity of the system, so it does not depend on OpenMM.
+namespace FrameAtoms {
+
+/* Bonds and constraints between atoms, each pair stored lowest index first */
+typedef std::set<std::pair<int, int> > Bonds;
+
+/* Whether molecule is a water: three atoms with mass, one bonded to the other
+   two, plus at most two massless virtual sites. Atoms are told apart by
+   topology and the molecule's total mass, which hydrogen mass repartitioning
+   leaves unchanged, rather than by the mass of each atom. */
+bool isWater(const std::vector<int> &molecule,
+             const std::vector<double> &masses,
+             const Bonds &bonds);
+
+/* The sorted, unique atoms selected by the frame_atoms option, which is null
+   or "all" (every atom, returned as an empty list), "solute" (every molecule
+   but water and monatomic ions) or a list of atom indices. Throws
+   std::runtime_error on anything else, on invalid indices and on empty
+   selections. */
+std::vector<int> select(const picojson::value &selection,
+                        const std::vector<double> &masses,
+                        const std::vector<std::vector<int> > &molecules,
+                        const Bonds &bonds);
+
+}
+
+#endif
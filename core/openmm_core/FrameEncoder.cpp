@@ -0,0 +1,125 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+#include "FrameEncoder.h"
+
+using namespace std;
+
+FrameEncoder::FrameEncoder() :
+    step_(0),
+    time_(0),
+    precision_(1000),
+    writer_(output_),
+    bytes_(0),
+    pending_(false),
+    stopping_(false) {
+    thread_.start(*this);
+}
+
+FrameEncoder::~FrameEncoder() {
+    {
+        Poco::Mutex::ScopedLock lock(mutex_);
+        stopping_ = true;
+        changed_.broadcast();
+    }
+    thread_.join();
+}
+
+void FrameEncoder::waitIdle() {
+    while(error_.empty() && pending_) {
+        changed_.wait(mutex_);
+    }
+    if(error_.size() > 0)
+        throw std::runtime_error(error_);
+}
+
+void FrameEncoder::setPrecision(float precision) {
+    if(precision <= 0)
+        throw std::runtime_error("XTC precision must be positive");
+    Poco::Mutex::ScopedLock lock(mutex_);
+    waitIdle();
+    precision_ = precision;
+}
+
+vector<float> &FrameEncoder::positions() {
+    return filling_;
+}
+
+void FrameEncoder::submit(int step, float time, const float box[9]) {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    waitIdle();
+    filling_.swap(encoding_);
+    step_ = step;
+    time_ = time;
+    for(int i=0; i < 9; i++)
+        box_[i] = box[i];
+    pending_ = true;
+    changed_.broadcast();
+}
+
+size_t FrameEncoder::bytes() const {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    return bytes_;
+}
+
+void FrameEncoder::take(string &frames) {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    waitIdle();
+    frames = output_.str();
+    output_.str("");
+    output_.clear();
+    bytes_ = 0;
+}
+
+void FrameEncoder::run() {
+    while(true) {
+        {
+            Poco::Mutex::ScopedLock lock(mutex_);
+            while(!stopping_ && !pending_) {
+                changed_.wait(mutex_);
+            }
+            if(stopping_)
+                return;
+            writer_.setPrecision(precision_);
+        }
+        // only this thread touches the frame and the output while pending_
+        string error;
+        try {
+            // false for NaNs and infinities alike
+            bool bad = false;
+            for(size_t i=0; i < encoding_.size(); i++)
+                bad |= !(fabs(encoding_[i]) <= FLT_MAX);
+            if(bad)
+                throw std::runtime_error("Frame has a NaN or infinite coordinate");
+            writer_.append(step_, time_, box_, &encoding_[0], encoding_.size()/3);
+        } catch(const std::exception &e) {
+            error = e.what();
+        }
+        Poco::Mutex::ScopedLock lock(mutex_);
+        if(error.size() > 0) {
+            error_ = error;
+        } else {
+            bytes_ = output_.tellp();
+        }
+        pending_ = false;
+        changed_.broadcast();
+        if(error.size() > 0)
+            return;
+    }
+}
@@ -0,0 +1,94 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef FRAME_ENCODER_H_
+#define FRAME_ENCODER_H_
+
+#include <Poco/Runnable.h>
+#include <Poco/Thread.h>
+#include <Poco/Mutex.h>
+#include <Poco/Condition.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "XTCWriter.h"
+
+/**
+ * A FrameEncoder checks and XTC encodes frames on a background thread, so
+ * the MD loop only pays for copying a frame's coordinates out of the state
+ * before it goes back to stepping.
+ *
+ * Frames are double buffered: the caller fills positions() while the
+ * previous frame is being encoded, and submit() swaps the two, blocking
+ * only if the previous frame is not done yet. Encoded frames accumulate
+ * until take(). A failed frame, eg. one with a NaN coordinate, stops the
+ * encoder and its error is rethrown by the next submit() or take(), so
+ * nothing after it is ever uploaded.
+ *
+ */
+
+class FrameEncoder : public Poco::Runnable {
+public:
+    FrameEncoder();
+
+    /* Drops any frame not yet encoded */
+    ~FrameEncoder();
+
+    /* Precision of the frames submitted from now on */
+    void setPrecision(float precision);
+
+    /* Buffer for the xyz coordinates of the next frame, in nm */
+    std::vector<float> &positions();
+
+    /* Queue the frame in positions() with the given box vectors. positions()
+       is a different, stale buffer afterwards. */
+    void submit(int step, float time, const float box[9]);
+
+    /* Bytes of the frames encoded so far, not counting one in progress */
+    size_t bytes() const;
+
+    /* Wait until every submitted frame is encoded, then move them into
+       frames */
+    void take(std::string &frames);
+
+    /* Worker thread loop */
+    void run();
+
+private:
+    /* Wait until no frame is pending. Mutex must be held. */
+    void waitIdle();
+
+    std::vector<float> filling_;
+    std::vector<float> encoding_;
+    int step_;
+    float time_;
+    float box_[9];
+    float precision_;
+
+    std::ostringstream output_;
+    XTCWriter writer_;
+    size_t bytes_;
+    bool pending_;
+    bool stopping_;
+    std::string error_;
+
+    mutable Poco::Mutex mutex_;
+    Poco::Condition changed_;
+    Poco::Thread thread_;
+};
+
+#endif
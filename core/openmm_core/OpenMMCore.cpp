@@ -17,12 +17,18 @@
 #include <ctime>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
 #include <OpenMM.h>
+#include <Poco/Clock.h>
 
 #include "XTCWriter.h"
 #include "OpenMMCore.h"
 #include "StateTests.h"
 #include "ExitSignal.h"
+#include "StepScheduler.h"
+#include "BinaryState.h"
+#include "FrameAtoms.h"
+#include "ProcessMemory.h"
 
 #ifdef _WIN32
 	#include <cstdint>
@@ -57,13 +63,30 @@ void OpenMMCore::registerComponents() {
 #endif
 }
 
+string OpenMMCore::platformName() {
+    return PLATFORM_NAME;
+}
+
 OpenMMCore::OpenMMCore(string core_key, map<string, string> properties, std::ostream &logStream) :
     Core(core_key, logStream),
     checkpoint_send_interval_(6000),
     heartbeat_interval_(60),
     progress_update_interval_(60),
+    metrics_log_(NULL),
     current_step_(0),
     last_checkpoint_step_(0),
+    buffered_frames_(0),
+    frame_buffer_start_(0),
+    max_buffered_frames_(1),
+    max_buffered_bytes_(0),
+    max_buffered_seconds_(0),
+    gzip_frames_(false),
+    validator_(&metrics()),
+    checkpoint_format_("xml"),
+    checkpoint_deltas_(0),
+    deltas_sent_(0),
+    prefetcher_(NULL),
+    last_ns_per_day_(0),
     ref_context_(NULL),
     core_context_(NULL),
     ref_intg_(NULL),
@@ -71,10 +94,12 @@ OpenMMCore::OpenMMCore(string core_key, map<string, string> properties, std::ost
     shared_system_(NULL),
     initial_state_(NULL),
     properties_(properties) {
+    setExitCheck(ExitSignal::shouldExit);
 }
 
 OpenMMCore::~OpenMMCore() {
     logStream << "cleaning up." << endl;
+    validator_.setReferenceContext(NULL);
     delete ref_context_;
     delete core_context_;
     delete ref_intg_;
@@ -83,6 +108,10 @@ OpenMMCore::~OpenMMCore() {
     delete initial_state_;
 }
 
+void OpenMMCore::setPrefetcher(StreamPrefetcher *prefetcher) {
+    prefetcher_ = prefetcher;
+}
+
 void OpenMMCore::setProgressUpdateInterval(int interval) {
     progress_update_interval_ = interval;
 }
@@ -245,44 +274,75 @@ void OpenMMCore::startStream(const string &cc_uri,
                              const string &donor_token,
                              const string &target_id,
                              const string &proxy_string) {
-    start_time_ = time(NULL);
-    Core::startStream(cc_uri, donor_token, target_id, proxy_string);
+    PreparedStream prepared;
+    fetchAssignment(cc_uri, donor_token, target_id, proxy_string,
+                    prepared.assignment);
+    prepared.prepare(logStream);
+    startStream(prepared);
+}
+
+void OpenMMCore::startStream(PreparedStream &prepared) {
+    Core::startStream(prepared.assignment);
     steps_per_frame_ = static_cast<int>(getOption<double>("steps_per_frame")+0.5);
-    logStream << "deserializing system... " << flush;
-    if(files_.find("system.xml") != files_.end()) {
-        istringstream system_stream(files_["system.xml"]);
-        shared_system_ = OpenMM::XmlSerializer::deserialize<OpenMM::System>(system_stream);
-    } else {
-        throw std::runtime_error("Cannot find system.xml");
-    }
-    logStream << "state... " << flush;
-    if(files_.find("state.xml") != files_.end()) {
-        istringstream state_stream(files_["state.xml"]);
-        initial_state_ = OpenMM::XmlSerializer::deserialize<OpenMM::State>(state_stream);
-    } else {
-        throw std::runtime_error("Cannot find state.xml");
-    }
-    logStream << "integrator..." << endl;
-    if(files_.find("integrator.xml") != files_.end()) {
-        istringstream core_integrator_stream(files_["integrator.xml"]);
-        core_intg_ = OpenMM::XmlSerializer::deserialize<OpenMM::Integrator>(core_integrator_stream);
-        istringstream ref_integrator_stream(files_["integrator.xml"]); 
-        ref_intg_ = OpenMM::XmlSerializer::deserialize<OpenMM::Integrator>(ref_integrator_stream);
-    } else {
-        throw std::runtime_error("Cannot find integrator.xml");
-    }
+    max_buffered_frames_ = static_cast<int>(getOption<double>("frames_per_upload", 1));
+    max_buffered_bytes_ = static_cast<int>(getOption<double>("max_upload_bytes", 0));
+    max_buffered_seconds_ = static_cast<int>(getOption<double>("max_upload_age", 0));
+    if(max_buffered_frames_ < 1)
+        throw std::runtime_error("frames_per_upload must be at least 1");
+    if(heartbeatInterval() > 0)
+        heartbeat_interval_ = heartbeatInterval();
+    validation_ = ValidationPolicy(getOption<string>("validation", "full"));
+    logStream << "validating frames against the reference platform: " << validation_.describe() << endl;
+    checkpoint_format_ = getOption<string>("checkpoint_format", "xml");
+    if(checkpoint_format_ != "xml" && checkpoint_format_ != "binary")
+        throw std::runtime_error("Unknown checkpoint_format "+checkpoint_format_);
+    checkpoint_deltas_ = static_cast<int>(getOption<double>("checkpoint_deltas", 0));
+    if(checkpoint_deltas_ < 0)
+        throw std::runtime_error("checkpoint_deltas must not be negative");
+    if(checkpoint_deltas_ > 0 && checkpoint_format_ != "binary")
+        throw std::runtime_error("checkpoint_deltas needs checkpoint_format binary");
+    // every session starts with a full checkpoint for deltas to build on
+    delta_base_.clear();
+    deltas_sent_ = 0;
+    frame_encoder_.setPrecision(getOption<double>("xtc_precision", 1000));
+    // 0 sends frames uncompressed, XTC is already compact
+    int frame_gzip_level = static_cast<int>(getOption<double>("frame_gzip_level", 0));
+    gzip_frames_ = frame_gzip_level > 0;
+    setGzipLevels(gzip_frames_ ? frame_gzip_level : 6,
+                  static_cast<int>(getOption<double>("checkpoint_gzip_level", 6)));
+    shared_system_ = prepared.system;
+    prepared.system = NULL;
+    core_intg_ = prepared.core_integrator;
+    prepared.core_integrator = NULL;
+    ref_intg_ = prepared.ref_integrator;
+    prepared.ref_integrator = NULL;
+    initial_state_ = prepared.state;
+    prepared.state = NULL;
+    bool binary_state = initial_state_ == NULL;
     int random_seed = time(NULL);
     logStream << "preparing the system for simulation..." << endl;
     setupSystem(shared_system_, random_seed);
     logStream << "creating contexts: reference... " << flush;
     ref_context_ = new OpenMM::Context(*shared_system_, *ref_intg_,
         OpenMM::Platform::getPlatformByName("Reference"));
+    validator_.setReferenceContext(ref_context_);
     logStream << "core... " << endl;
     core_context_ = new OpenMM::Context(*shared_system_, *core_intg_,
         OpenMM::Platform::getPlatformByName(PLATFORM_NAME), properties_);
+    selectFrameAtoms();
     logStream << "setting initial states..." << endl;
-    ref_context_->setState(*initial_state_);
-    core_context_->setState(*initial_state_);
+    if(binary_state) {
+        if(files_.find("state.delta") != files_.end()) {
+            files_["state.bin"] = BinaryState::applyDelta(files_["state.bin"], files_["state.delta"]);
+            files_.erase("state.delta");
+        }
+        BinaryState::deserialize(files_["state.bin"], *ref_context_);
+        BinaryState::deserialize(files_["state.bin"], *core_context_);
+        files_.erase("state.bin");
+    } else {
+        ref_context_->setState(*initial_state_);
+        core_context_->setState(*initial_state_);
+    }
     logStream << "checking states for discrepancies in initial state... " << flush;
     logStream << "reference... " << endl;
     checkState(core_context_->getState((
@@ -291,8 +351,43 @@ void OpenMMCore::startStream(const string &cc_uri,
         OpenMM::State::Parameters | 
         OpenMM::State::Energy | 
         OpenMM::State::Forces)));
+    validator_.join();
     delete(initial_state_);
     initial_state_ = NULL;
+    // the contexts hold everything the inputs described
+    ProcessMemory::trim();
+    logStream << "resident memory: " << ProcessMemory::resident()/1000000
+              << " MB, peak " << ProcessMemory::peakResident()/1000000 << " MB" << endl;
+}
+
+void OpenMMCore::selectFrameAtoms() {
+    const int n_atoms = shared_system_->getNumParticles();
+    vector<double> masses(n_atoms);
+    for(int i=0; i < n_atoms; i++)
+        masses[i] = shared_system_->getParticleMass(i);
+    FrameAtoms::Bonds bonds;
+    for(int i=0; i < shared_system_->getNumConstraints(); i++) {
+        int a, b;
+        double distance;
+        shared_system_->getConstraintParameters(i, a, b, distance);
+        bonds.insert(make_pair(min(a, b), max(a, b)));
+    }
+    for(int i=0; i < shared_system_->getNumForces(); i++) {
+        const OpenMM::HarmonicBondForce *force =
+            dynamic_cast<const OpenMM::HarmonicBondForce *>(&shared_system_->getForce(i));
+        if(force == NULL)
+            continue;
+        for(int j=0; j < force->getNumBonds(); j++) {
+            int a, b;
+            double length, k;
+            force->getBondParameters(j, a, b, length, k);
+            bonds.insert(make_pair(min(a, b), max(a, b)));
+        }
+    }
+    frame_atoms_ = FrameAtoms::select(getOptionValue("frame_atoms"), masses,
+                                      ref_context_->getMolecules(), bonds);
+    if(!frame_atoms_.empty())
+        logStream << "writing " << frame_atoms_.size() << " of " << n_atoms << " atoms to frames" << endl;
 }
 
 void OpenMMCore::flushCheckpoint() {
@@ -303,10 +398,31 @@ void OpenMMCore::flushCheckpoint() {
         OpenMM::State::Energy | 
         OpenMM::State::Forces);
     checkState(state);
-    ostringstream checkpoint;
-    OpenMM::XmlSerializer::serialize<OpenMM::State>(&state, "State", checkpoint);
+    // frames are only kept by the SCV once a checkpoint follows them, so
+    // nothing is committed before every state up to here has passed
+    {
+        ScopedTimer timer(&metrics(), "validation_wait");
+        validator_.join();
+    }
+    // the checkpoint must correspond to the last frame the SCV has received
+    flushFrames();
     map<string, string> checkpoint_files;
-    checkpoint_files["state.xml"] = checkpoint.str();
+    if(checkpoint_format_ == "binary") {
+        if(delta_base_.empty() || deltas_sent_ >= checkpoint_deltas_) {
+            checkpoint_files["state.bin"] = BinaryState::serialize(state);
+            if(checkpoint_deltas_ > 0)
+                delta_base_ = checkpoint_files["state.bin"];
+            deltas_sent_ = 0;
+        } else {
+            // the SCV keeps the state.bin of the last full checkpoint with it
+            checkpoint_files["state.delta"] = BinaryState::serializeDelta(state, delta_base_);
+            deltas_sent_++;
+        }
+    } else {
+        ostringstream checkpoint;
+        OpenMM::XmlSerializer::serialize<OpenMM::State>(&state, "State", checkpoint);
+        checkpoint_files["state.xml"] = checkpoint.str();
+    }
     stringstream partial_steps;
     partial_steps << (current_step_ % steps_per_frame_);
     logStream << "partially completed " << partial_steps.str() << " steps..." << endl;
@@ -316,58 +432,114 @@ void OpenMMCore::flushCheckpoint() {
     last_checkpoint_step_ = current_step_;
 }
 
-void OpenMMCore::checkState(const OpenMM::State &core_state) const {
-    ref_context_->setState(core_state);
-    OpenMM::State reference_state = ref_context_->getState(OpenMM::State::Energy | OpenMM::State::Forces);
-    StateTests::checkForNans(core_state);
-    StateTests::checkForDiscrepancies(core_state);
-    StateTests::compareForcesAndEnergies(reference_state, core_state);
+void OpenMMCore::checkState(const OpenMM::State &core_state, bool reference) {
+    if(reference) {
+        // the validator repeats the cheap tests along with the comparison
+        {
+            ScopedTimer timer(&metrics(), "validation_wait");
+            validator_.submit(core_state);
+        }
+        double seconds = validator_.takeSeconds();
+        if(seconds > 0)
+            validation_.recordValidation(seconds);
+    } else {
+        ScopedTimer timer(&metrics(), "check_state");
+        StateTests::checkState(core_state);
+    }
 }
 
 void OpenMMCore::checkFrameWrite() {
     // nothing is written on the first step;
     if(current_step_ > 0 && current_step_ % steps_per_frame_ == 0) {
-        OpenMM::State state = core_context_->getState(
-            OpenMM::State::Positions | 
-            OpenMM::State::Velocities | 
-            OpenMM::State::Parameters | 
-            OpenMM::State::Energy | 
-            OpenMM::State::Forces);
-        checkState(state);
-        state.getTime();
+        // a frame only needs the positions, and the box that comes with
+        // them, unless it is checked against the reference platform. The
+        // encoder checks the coordinates of the others for NaNs.
+        bool validate = validation_.shouldValidate();
+        int state_types = OpenMM::State::Positions;
+        if(validate) {
+            state_types |= OpenMM::State::Velocities |
+                OpenMM::State::Parameters |
+                OpenMM::State::Energy |
+                OpenMM::State::Forces;
+        }
+        Poco::Clock get_state_start;
+        OpenMM::State state = core_context_->getState(state_types);
+        metrics().record("get_state", get_state_start.elapsed());
+        if(validate)
+            checkState(state);
         OpenMM::Vec3 a,b,c;
         state.getPeriodicBoxVectors(a,b,c);
-        vector<vector<float> > box(3, vector<float>(3, 0));
-        box[0][0] = a[0]; box[0][1] = a[1]; box[0][2] = a[2];
-        box[1][0] = b[0]; box[1][1] = b[1]; box[1][2] = b[2];
-        box[2][0] = c[0]; box[2][1] = c[1]; box[2][2] = c[2];
-        vector<OpenMM::Vec3> state_positions = state.getPositions();
-        vector<vector<float> > positions(state_positions.size(),
-                                         vector<float>(3,0));
-        for(int i=0; i<state_positions.size(); i++) {
+        float box[9] = {float(a[0]), float(a[1]), float(a[2]),
+                        float(b[0]), float(b[1]), float(b[2]),
+                        float(c[0]), float(c[1]), float(c[2])};
+        const vector<OpenMM::Vec3> &state_positions = state.getPositions();
+        int n_frame_atoms = frame_atoms_.empty() ? state_positions.size() : frame_atoms_.size();
+        vector<float> &frame_positions = frame_encoder_.positions();
+        frame_positions.resize(3*n_frame_atoms);
+        for(int i=0; i<n_frame_atoms; i++) {
+            const OpenMM::Vec3 &position = state_positions[frame_atoms_.empty() ? i : frame_atoms_[i]];
             for(int j=0; j<3; j++) {
-                positions[i][j] = state_positions[i][j];
+                frame_positions[3*i+j] = position[j];
             }
         }
-        // write frame
-        ostringstream frame_stream;
-        XTCWriter xtcwriter(frame_stream);
-        xtcwriter.append(current_step_, state.getTime(), box, positions);
-        map<string, string> frame_files;
-        frame_files["frames.xtc"] = frame_stream.str();
-        sendFrame(frame_files);
+        // encoded while the next frame's steps run; this only waits if the
+        // previous frame is still being encoded
+        if(buffered_frames_ == 0)
+            frame_buffer_start_ = time(NULL);
+        {
+            ScopedTimer timer(&metrics(), "xtc");
+            frame_encoder_.submit(current_step_, state.getTime(), box);
+        }
+        buffered_frames_++;
+        // frame_encoder_.bytes() lags by the frame being encoded
+        if(buffered_frames_ >= max_buffered_frames_ ||
+           (max_buffered_bytes_ > 0 && frame_encoder_.bytes() >= size_t(max_buffered_bytes_))) {
+            flushFrames();
+        }
+    }
+}
+
+void OpenMMCore::flushFrames() {
+    if(buffered_frames_ == 0)
+        return;
+    map<string, string> frame_files;
+    {
+        ScopedTimer timer(&metrics(), "xtc");
+        frame_encoder_.take(frame_files["frames.xtc"]);
     }
+    sendFrame(frame_files, buffered_frames_, gzip_frames_);
+    buffered_frames_ = 0;
 }
 
 int OpenMMCore::timePerFrame(long long steps_completed) const {
-    int time_diff = time(NULL)-start_time_;
+    double time_diff = md_start_.elapsed()/1e6;
     if(steps_completed == 0)
         return 0;
     return int(double(steps_per_frame_)*(time_diff)/steps_completed);
 }
 
+void OpenMMCore::setMetricsLog(std::ostream *out) {
+    metrics_log_ = out;
+}
+
+float OpenMMCore::lastNsPerDay() const {
+    Poco::Mutex::ScopedLock lock(progress_mutex_);
+    return last_ns_per_day_;
+}
+
+picojson::object OpenMMCore::progress() const {
+    picojson::object status;
+    status["step"] = picojson::value(double(current_step_));
+    status["ns_per_day"] = picojson::value(lastNsPerDay());
+    status["validation"] = picojson::value(validation_.describe());
+    status["frames_validated"] = picojson::value(double(validation_.framesValidated()));
+    status["frames_seen"] = picojson::value(double(validation_.framesSeen()));
+    status["timings"] = picojson::value(metrics().summary());
+    return status;
+}
+
 float OpenMMCore::nsPerDay(long long steps_completed) const {
-    int time_diff = time(NULL)-start_time_;
+    double time_diff = md_start_.elapsed()/1e6;
     if(time_diff == 0)
         return 0;
     // time_step is in picoseconds
@@ -378,8 +550,9 @@ float OpenMMCore::nsPerDay(long long steps_completed) const {
 void OpenMMCore::main() {
     logStream << "entering main md loop..." << endl;
     try {
-        double next_checkpoint = time(NULL) + checkpoint_send_interval_;
-        double next_heartbeat = time(NULL) + heartbeat_interval_;
+        // deltas are cheap enough to send checkpoint_deltas+1 times as often
+        double checkpoint_interval = double(checkpoint_send_interval_)/(checkpoint_deltas_+1);
+        double next_checkpoint = time(NULL) + checkpoint_interval;
         double next_status = time(NULL)+10;
 
         if(files_.find("partial_steps") != files_.end()) {
@@ -389,9 +562,16 @@ void OpenMMCore::main() {
         }
 
         long long starting_step = current_step_;
+        md_start_.update();
         logStream << "resuming from step " << current_step_ << endl;
         status_header(logStream);
 
+        StepScheduler scheduler;
+        scheduler.addStepInterval(steps_per_frame_);
+#ifdef FAH_CORE
+        scheduler.addStepInterval(150);
+#endif
+
         while(true) {
 #ifdef FAH_CORE
             if(current_step_ % 150 == 0) {
@@ -413,33 +593,65 @@ void OpenMMCore::main() {
             }
 #endif
             if(time(NULL) > next_status) {
+                float ns_per_day = nsPerDay(current_step_-starting_step);
+                {
+                    Poco::Mutex::ScopedLock lock(progress_mutex_);
+                    last_ns_per_day_ = ns_per_day;
+                }
                 update_status(timePerFrame(current_step_-starting_step),
-                              nsPerDay(current_step_-starting_step),
+                              ns_per_day,
                               double(current_step_)/double(steps_per_frame_),
                               current_step_,
                               logStream);
+                if(metrics_log_ != NULL) {
+                    picojson::object fields;
+                    fields["time"] = picojson::value(double(time(NULL)));
+                    fields["stream_id"] = picojson::value(stream_id_);
+                    fields["step"] = picojson::value(double(current_step_));
+                    fields["ns_per_day"] = picojson::value(ns_per_day);
+                    fields["rss_mb"] = picojson::value(ProcessMemory::resident()/1e6);
+                    fields["peak_rss_mb"] = picojson::value(ProcessMemory::peakResident()/1e6);
+                    metrics().writeLine(*metrics_log_, fields);
+                }
+                // rides along with the next upload
+                setStatus(progress());
                 next_status = time(NULL) + progress_update_interval_;
             }
             if(ExitSignal::shouldExit()) {
                 break;
             }
             checkFrameWrite();
-            if(time(NULL) > next_heartbeat) { 
-                sendHeartbeat();
-                next_heartbeat = time(NULL) + heartbeat_interval_;
+            if(buffered_frames_ > 0 && max_buffered_seconds_ > 0 &&
+               time(NULL) >= frame_buffer_start_ + max_buffered_seconds_) {
+                flushFrames();
+            }
+            // only needed when no frame or checkpoint went out for a while
+            if(time(NULL) > lastContact() + heartbeat_interval_) {
+                sendHeartbeat(progress());
             }
             if(time(NULL) > next_checkpoint) {
                flushCheckpoint();
-               next_checkpoint = time(NULL) + checkpoint_send_interval_;
+               next_checkpoint = time(NULL) + checkpoint_interval;
             }
-            core_context_->getIntegrator().step(1);
-            current_step_++;
+            // events above fire once time(NULL) has moved past the deadline
+            double next_heartbeat = lastContact() + heartbeat_interval_;
+            double next_deadline = min(next_status, min(next_heartbeat, next_checkpoint));
+            int steps = scheduler.nextBatch(current_step_, next_deadline+1-time(NULL));
+            Poco::Clock batch_start;
+            core_context_->getIntegrator().step(steps);
+            Poco::Clock::ClockDiff batch_time = batch_start.elapsed();
+            scheduler.recordBatch(steps, batch_time/1e6);
+            metrics().record("step", batch_time);
+            current_step_ += steps;
         }
         logStream << "flushing final checkpoint..." << endl;
         flushCheckpoint();
         logStream << "stopping gracefully..." << endl;
         Core::stopStream();
     } catch(exception &e) {
+        // the next stream is fetched while this one is being torn down
+        if(prefetcher_ != NULL && !ExitSignal::shouldExit())
+            prefetcher_->start();
         logStream << "stopping with error: " << flush;
         Core::stopStream(e.what());
         logStream << e.what() << endl;
@@ -16,11 +16,18 @@
 #define OPENMM_CORE_HH_
 
 #include "Core.h"
+#include "ValidationPolicy.h"
+#include "StreamPrefetcher.h"
+#include "FrameEncoder.h"
+#include "StateValidator.h"
 #include <OpenMM.h>
+#include <Poco/Clock.h>
+#include <Poco/Mutex.h>
 #include <sstream>
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
 
 class OpenMMCore : public Core {
 public:
@@ -36,14 +43,32 @@ public:
                              const std::string &target_id = "",
                              const std::string &proxy_string = "");
 
+    /* Start a stream that was fetched and deserialized ahead of time */
+    void startStream(PreparedStream &prepared);
+
     void setProgressUpdateInterval(int interval);
 
+    /* When set, the next stream is prefetched as soon as this one stops
+       with an error. The prefetcher must outlive the call to main(). */
+    void setPrefetcher(StreamPrefetcher *prefetcher);
+
     /* set the checkpoint interval */
     void setCheckpointSendInterval(int interval);
 
+    /* Every progress update also writes the timings of the stream as a
+       JSON line to out, if not NULL. out must outlive the call to main(). */
+    void setMetricsLog(std::ostream *out);
+
+    /* ns/day reported by the last progress update, 0 before the first one.
+       Safe to call from other threads while main() runs */
+    float lastNsPerDay() const;
+
     /* initialize all the platforms and serialization proxies */
     static void registerComponents();
 
+    /* name of the OpenMM platform streams are run on */
+    static std::string platformName();
+
 #ifdef FAH_CORE    
     std::string wu_dir;
 #endif
@@ -59,28 +84,66 @@ protected:
     /* get nanoseconds per day of the current simulation */
     float nsPerDay(long long steps_completed) const;
 
-    /* verify the openmm state */
-    void checkState(const OpenMM::State &core_state) const;
+    /* verify the openmm state. The cheap sanity tests always run, the
+       comparison against the Reference platform only if reference is true.
+       The comparison runs in the background, a failure is thrown by a later
+       call or by flushCheckpoint(), which waits for it. */
+    void checkState(const OpenMM::State &core_state, bool reference = true);
 
-    /* set the heartbeat interval */
+    /* set the heartbeat interval, used when the SCV does not set one.
+       Frames and checkpoints count as heartbeats. */
     void setHeartbeatInterval(int interval);
 
     /* flush the stored checkpoint */
     void flushCheckpoint();
 
+    /* send all buffered frames in a single request */
+    void flushFrames();
+
 private:
     void setupSystem(OpenMM::System *system, int randomSeed) const;
 
+    /* pick the atoms written to frames from the frame_atoms option */
+    void selectFrameAtoms();
+
     void cleanUp();
 
+    /* progress and validation of the stream, reported to the SCV */
+    picojson::object progress() const;
+
     std::map<std::string, std::string> properties_;
     int steps_per_frame_;
     int checkpoint_send_interval_;
     int heartbeat_interval_;
     int progress_update_interval_;
-    int start_time_;
+    // started when the MD loop is entered, so setup is not counted
+    Poco::Clock md_start_;
+    std::ostream *metrics_log_;
     long long current_step_;
     long long last_checkpoint_step_;
+    // frames are buffered until any one of the limits below is reached
+    FrameEncoder frame_encoder_;
+    // atoms written to frames in index order, empty for all of them
+    std::vector<int> frame_atoms_;
+    int buffered_frames_;
+    int frame_buffer_start_;
+    int max_buffered_frames_;
+    int max_buffered_bytes_;
+    int max_buffered_seconds_;
+    bool gzip_frames_;
+    ValidationPolicy validation_;
+    // checks states against ref_context_ while the core steps on
+    StateValidator validator_;
+    // "xml" for XmlSerializer'd States, "binary" for BinaryState
+    std::string checkpoint_format_;
+    // binary checkpoints sent as deltas between two full ones
+    int checkpoint_deltas_;
+    int deltas_sent_;
+    // the last full checkpoint sent, empty if there is none this session
+    std::string delta_base_;
+    StreamPrefetcher* prefetcher_;
+    mutable Poco::Mutex progress_mutex_;
+    float last_ns_per_day_;
     //std::string last_checkpoint_;
     OpenMM::Context* ref_context_;
     OpenMM::Context* core_context_;
@@ -0,0 +1,87 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include "ProcessMemory.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+#if defined(__linux__)
+// a "VmRSS:    1234 kB" line of /proc/self/status, in bytes
+static size_t proc_status(const string &field) {
+    ifstream status("/proc/self/status");
+    string line;
+    while(getline(status, line)) {
+        if(line.compare(0, field.size(), field) == 0) {
+            istringstream value(line.substr(field.size()));
+            size_t kilobytes = 0;
+            value >> kilobytes;
+            return kilobytes*1024;
+        }
+    }
+    return 0;
+}
+#endif
+
+size_t ProcessMemory::resident() {
+#if defined(__linux__)
+    return proc_status("VmRSS:");
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+size_t ProcessMemory::peakResident() {
+#if defined(__linux__)
+    return proc_status("VmHWM:");
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    // OS X reports ru_maxrss in bytes
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss;
+    return 0;
+#endif
+}
+
+void ProcessMemory::trim() {
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
@@ -0,0 +1,37 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef PROCESS_MEMORY_H_
+#define PROCESS_MEMORY_H_
+
+#include <cstddef>
+
+/* Memory use of the core process, for the log and the metrics. */
+namespace ProcessMemory {
+
+/* Resident set size in bytes, 0 if the platform does not report it */
+size_t resident();
+
+/* Largest resident set size so far in bytes, 0 if the platform does not
+   report it */
+size_t peakResident();
+
+/* Hand memory freed on the heap back to the OS, where the allocator
+   otherwise keeps it */
+void trim();
+
+}
+
+#endif
@@ -166,4 +166,68 @@ void StateTests::compareForces(const State& first, const State& b, double tolera
 void StateTests::compareForcesAndEnergies(const State& a, const State& b, double forceTolerance, double energyTolerance) {
     compareForces(a,b);
     compareEnergies(a,b);
-}
\ No newline at end of file
+}
+
+// Flags NaNs (x != x) and out of range values with branch free arithmetic,
+// so the loop can be vectorized; fabs(NaN) > limit is false. Vec3 only holds a
+// double[3], so each array is walked as 3*n contiguous components.
+static const double *components(const vector<Vec3> &vecs) {
+    return reinterpret_cast<const double *>(&vecs[0]);
+}
+
+template<bool WithReference>
+static bool fused_pass(const double *positions, const double *velocities,
+                       const double *forces, const double *reference,
+                       int n, int &zeroVelocityCount, double &sse) {
+    int bad = 0;
+    int zeros = 0;
+    double sum = 0;
+    for(int k=0; k<n; k++) {
+        double p = positions[k];
+        double v = velocities[k];
+        double f = forces[k];
+        bad |= (p != p) | (v != v) | (f != f) | (fabs(v) > 17.47) | (fabs(f) > 50000);
+        zeros += (v == 0);
+        if(WithReference) {
+            double e = reference[k] - f;
+            sum += e*e;
+        }
+    }
+    zeroVelocityCount = zeros;
+    sse = sum;
+    return bad != 0;
+}
+
+void StateTests::checkState(const State& state, const State* reference, double forceTolerance, double energyTolerance) {
+    const vector<Vec3> &positions = state.getPositions();
+    const vector<Vec3> &velocities = state.getVelocities();
+    const vector<Vec3> &forces = state.getForces();
+    const vector<Vec3> *referenceForces = reference ? &reference->getForces() : NULL;
+    int nAtoms = positions.size();
+    int zeroVelocityCount = 0;
+    double sse = 0;
+    bool bad = false;
+    if(nAtoms > 0) {
+        if(reference) {
+            bad = fused_pass<true>(components(positions), components(velocities),
+                components(forces), components(*referenceForces), 3*nAtoms,
+                zeroVelocityCount, sse);
+        } else {
+            bad = fused_pass<false>(components(positions), components(velocities),
+                components(forces), NULL, 3*nAtoms, zeroVelocityCount, sse);
+        }
+    }
+    if(bad || zeroVelocityCount > (3*nAtoms/2)) {
+        checkForNans(state);
+        checkForDiscrepancies(state);
+    }
+    if(reference) {
+        double mse = sqrt(sse/nAtoms);
+        if(mse > forceTolerance) {
+            stringstream ss;
+            ss << "Force RMSE error of " << mse << " with threshold of " << forceTolerance << endl;
+            throw(std::runtime_error( ss.str()));
+        }
+        compareEnergies(*reference, state, energyTolerance);
+    }
+}
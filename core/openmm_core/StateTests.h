@@ -16,6 +16,7 @@
 #define STATE_TESTS_H_
 
 #include <OpenMM.h>
+#include <cstddef>
 
 // Single Precision Tolerances
 static double const DEFAULT_FORCE_TOL_KJ_PER_MOL_PER_NM = 5;
@@ -37,6 +38,14 @@ void compareForces(const OpenMM::State& a, const OpenMM::State& b, double tolera
 void compareForcesAndEnergies(const OpenMM::State& a, const OpenMM::State &b, 
     double forceTolerance = DEFAULT_FORCE_TOL_KJ_PER_MOL_PER_NM, double energyTolerance = DEFAULT_ENERGY_TOL_KJ_PER_MOL);
 
+// All of the above in a single pass over positions, velocities and forces.
+// Equivalent to checkForNans(state), checkForDiscrepancies(state) and, if a
+// reference is given, compareForcesAndEnergies(*reference, state), and
+// throws the same errors. The separate tests only run to find out what
+// went wrong once the fused pass has seen a problem.
+void checkState(const OpenMM::State& state, const OpenMM::State* reference = NULL,
+    double forceTolerance = DEFAULT_FORCE_TOL_KJ_PER_MOL_PER_NM, double energyTolerance = DEFAULT_ENERGY_TOL_KJ_PER_MOL);
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,122 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include <stdexcept>
+
+#include "StateValidator.h"
+#include "StateTests.h"
+
+using namespace std;
+
+StateValidator::StateValidator(Metrics *metrics) :
+    metrics_(metrics),
+    context_(NULL),
+    pending_(NULL),
+    seconds_(0),
+    stopping_(false) {
+    thread_.start(*this);
+}
+
+StateValidator::~StateValidator() {
+    {
+        Poco::Mutex::ScopedLock lock(mutex_);
+        stopping_ = true;
+        changed_.broadcast();
+    }
+    thread_.join();
+    delete pending_;
+}
+
+void StateValidator::waitIdle() {
+    while(error_.empty() && pending_ != NULL) {
+        changed_.wait(mutex_);
+    }
+    if(error_.size() > 0)
+        throw std::runtime_error(error_);
+}
+
+void StateValidator::setReferenceContext(OpenMM::Context *context) {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    while(pending_ != NULL) {
+        changed_.wait(mutex_);
+    }
+    error_.clear();
+    seconds_ = 0;
+    context_ = context;
+}
+
+void StateValidator::submit(const OpenMM::State &state) {
+    if(context_ == NULL)
+        throw std::runtime_error("StateValidator has no reference context");
+    // copied before taking the lock, the worker may still be busy
+    OpenMM::State *snapshot = new OpenMM::State(state);
+    Poco::Mutex::ScopedLock lock(mutex_);
+    try {
+        waitIdle();
+    } catch(...) {
+        delete snapshot;
+        throw;
+    }
+    pending_ = snapshot;
+    changed_.broadcast();
+}
+
+void StateValidator::join() {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    waitIdle();
+}
+
+double StateValidator::takeSeconds() {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    double seconds = seconds_;
+    seconds_ = 0;
+    return seconds;
+}
+
+void StateValidator::run() {
+    while(true) {
+        OpenMM::Context *context;
+        {
+            Poco::Mutex::ScopedLock lock(mutex_);
+            while(!stopping_ && pending_ == NULL) {
+                changed_.wait(mutex_);
+            }
+            if(stopping_)
+                return;
+            context = context_;
+        }
+        // only this thread touches the context and the state while pending_
+        string error;
+        Poco::Clock start;
+        try {
+            context->setState(*pending_);
+            OpenMM::State reference = context->getState(OpenMM::State::Energy | OpenMM::State::Forces);
+            if(metrics_ != NULL)
+                metrics_->record("reference", start.elapsed());
+            ScopedTimer timer(metrics_, "check_state");
+            StateTests::checkState(*pending_, &reference);
+        } catch(const std::exception &e) {
+            error = e.what();
+        }
+        double seconds = start.elapsed()/1e6;
+        Poco::Mutex::ScopedLock lock(mutex_);
+        if(error.size() > 0)
+            error_ = error;
+        delete pending_;
+        pending_ = NULL;
+        seconds_ += seconds;
+        changed_.broadcast();
+    }
+}
@@ -0,0 +1,86 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef STATE_VALIDATOR_H_
+#define STATE_VALIDATOR_H_
+
+#include <Poco/Runnable.h>
+#include <Poco/Thread.h>
+#include <Poco/Mutex.h>
+#include <Poco/Condition.h>
+#include <OpenMM.h>
+
+#include <string>
+
+#include "Metrics.h"
+
+/**
+ * A StateValidator compares states against a reference context on a
+ * background thread, so the MD loop does not wait for the Reference
+ * platform to evaluate every validated frame.
+ *
+ * Each submitted state is a snapshot, the caller is free to step on as
+ * soon as submit() returns. One state is checked at a time: submit() blocks
+ * while the previous one is still being evaluated. A failed check stops the
+ * validator and its error is rethrown by the next submit() or join(). Call
+ * join() before anything that must only be sent if every state so far
+ * passed, eg. a checkpoint.
+ *
+ */
+
+class StateValidator : public Poco::Runnable {
+public:
+    /* Samples of "reference" and "check_state" are recorded to metrics, if
+       not NULL */
+    explicit StateValidator(Metrics *metrics = NULL);
+
+    /* Drops any state not yet checked */
+    ~StateValidator();
+
+    /* Context later states are evaluated on, not owned. Waits for the state
+       being checked, if any, and clears any error so a new stream starts
+       afresh. */
+    void setReferenceContext(OpenMM::Context *context);
+
+    /* Queue a copy of state, which must have positions, velocities,
+       parameters, energy and forces, for comparison */
+    void submit(const OpenMM::State &state);
+
+    /* Wait until every submitted state is checked */
+    void join();
+
+    /* Seconds spent on the checks finished since the last call */
+    double takeSeconds();
+
+    /* Worker thread loop */
+    void run();
+
+private:
+    /* Wait until no state is pending. Mutex must be held. */
+    void waitIdle();
+
+    Metrics *metrics_;
+    OpenMM::Context *context_;
+    OpenMM::State *pending_;
+    double seconds_;
+    bool stopping_;
+    std::string error_;
+
+    Poco::Mutex mutex_;
+    Poco::Condition changed_;
+    Poco::Thread thread_;
+};
+
+#endif
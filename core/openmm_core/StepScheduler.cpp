@@ -0,0 +1,68 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "StepScheduler.h"
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+using namespace std;
+
+// number of steps taken per batch until the time per step has been measured
+static const int CALIBRATION_STEPS = 10;
+
+// weight given to the most recent batch in the time per step estimate
+static const double SMOOTHING = 0.3;
+
+StepScheduler::StepScheduler(double max_batch_seconds) :
+    max_batch_seconds_(max_batch_seconds),
+    seconds_per_step_(0) {
+}
+
+void StepScheduler::addStepInterval(int interval) {
+    if(interval <= 0)
+        throw std::runtime_error("StepScheduler: step interval must be positive");
+    step_intervals_.push_back(interval);
+}
+
+int StepScheduler::nextBatch(long long current_step,
+                             double seconds_until_deadline) const {
+    long long steps = INT_MAX;
+    for(size_t i=0; i < step_intervals_.size(); i++) {
+        long long interval = step_intervals_[i];
+        steps = min(steps, interval - current_step % interval);
+    }
+    if(seconds_per_step_ > 0) {
+        double seconds = min(seconds_until_deadline, max_batch_seconds_);
+        steps = min(steps, static_cast<long long>(seconds/seconds_per_step_));
+    } else {
+        steps = min(steps, static_cast<long long>(CALIBRATION_STEPS));
+    }
+    return static_cast<int>(max(steps, 1LL));
+}
+
+void StepScheduler::recordBatch(int steps, double elapsed_seconds) {
+    if(steps <= 0 || elapsed_seconds <= 0)
+        return;
+    double measured = elapsed_seconds/steps;
+    if(seconds_per_step_ == 0)
+        seconds_per_step_ = measured;
+    else
+        seconds_per_step_ = SMOOTHING*measured + (1-SMOOTHING)*seconds_per_step_;
+}
+
+double StepScheduler::secondsPerStep() const {
+    return seconds_per_step_;
+}
@@ -0,0 +1,56 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef STEP_SCHEDULER_H_
+#define STEP_SCHEDULER_H_
+
+#include <vector>
+
+/**
+ * A StepScheduler decides how many integrator steps can be issued in a single
+ * call to Integrator::step() without skipping over anything the MD loop has
+ * to do in between.
+ *
+ * Step-based events (frame boundaries) are hit exactly. Wall-clock events
+ * (heartbeats, checkpoints, status updates) are hit approximately using a
+ * running estimate of the time per step. Batches are also capped in wall time
+ * so that exit signals are still checked frequently.
+ *
+ */
+
+class StepScheduler {
+public:
+    StepScheduler(double max_batch_seconds = 1.0);
+
+    /* Add an event that fires every interval steps */
+    void addStepInterval(int interval);
+
+    /* Number of steps to take from current_step so that no step-based event
+       is crossed and the next wall-clock event, due in seconds_until_deadline,
+       is not overrun. Always at least 1. */
+    int nextBatch(long long current_step, double seconds_until_deadline) const;
+
+    /* Update the time per step estimate with a completed batch */
+    void recordBatch(int steps, double elapsed_seconds);
+
+    /* Current estimate of the wall time per step, 0 if not yet known */
+    double secondsPerStep() const;
+
+private:
+    std::vector<int> step_intervals_;
+    double max_batch_seconds_;
+    double seconds_per_step_;
+};
+
+#endif
@@ -0,0 +1,157 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include <sstream>
+#include <stdexcept>
+
+#include "StreamPrefetcher.h"
+
+using namespace std;
+
+PreparedStream::PreparedStream() :
+    system(NULL),
+    core_integrator(NULL),
+    ref_integrator(NULL),
+    state(NULL) {
+
+}
+
+PreparedStream::~PreparedStream() {
+    delete system;
+    delete core_integrator;
+    delete ref_integrator;
+    delete state;
+}
+
+void PreparedStream::prepare(ostream &log) {
+    map<string, string> &files = assignment.files;
+    log << "deserializing system... " << flush;
+    if(files.find("system.xml") != files.end()) {
+        istringstream system_stream(files["system.xml"]);
+        system = OpenMM::XmlSerializer::deserialize<OpenMM::System>(system_stream);
+    } else {
+        throw std::runtime_error("Cannot find system.xml");
+    }
+    log << "state... " << flush;
+    // state.bin only ever comes from a checkpoint, so when present it is
+    // always newer than the seed state.xml sent alongside it.
+    if(files.find("state.bin") != files.end()) {
+        log << "(binary) " << flush;
+    } else if(files.find("state.delta") != files.end()) {
+        throw std::runtime_error("Cannot find the state.bin of state.delta");
+    } else if(files.find("state.xml") != files.end()) {
+        istringstream state_stream(files["state.xml"]);
+        state = OpenMM::XmlSerializer::deserialize<OpenMM::State>(state_stream);
+    } else {
+        throw std::runtime_error("Cannot find state.xml");
+    }
+    log << "integrator..." << endl;
+    if(files.find("integrator.xml") != files.end()) {
+        istringstream core_integrator_stream(files["integrator.xml"]);
+        core_integrator = OpenMM::XmlSerializer::deserialize<OpenMM::Integrator>(core_integrator_stream);
+        istringstream ref_integrator_stream(files["integrator.xml"]);
+        ref_integrator = OpenMM::XmlSerializer::deserialize<OpenMM::Integrator>(ref_integrator_stream);
+    } else {
+        throw std::runtime_error("Cannot find integrator.xml");
+    }
+    // only state.bin and state.delta are read again, once the contexts exist
+    files.erase("system.xml");
+    files.erase("state.xml");
+    files.erase("integrator.xml");
+}
+
+StreamPrefetcher::StreamPrefetcher(const string &core_key,
+                                   const string &cc_uri,
+                                   const string &donor_token,
+                                   const string &target_id,
+                                   const string &proxy_string,
+                                   ostream &log) :
+    log_(log),
+    fetcher_(core_key, buffer_),
+    cc_uri_(cc_uri),
+    donor_token_(donor_token),
+    target_id_(target_id),
+    proxy_string_(proxy_string),
+    pending_(false),
+    prepared_(NULL) {
+
+}
+
+StreamPrefetcher::~StreamPrefetcher() {
+    if(pending_)
+        thread_.join();
+    flushLog();
+    delete prepared_;
+}
+
+void StreamPrefetcher::setFileCache(FileCache *cache) {
+    fetcher_.setFileCache(cache);
+}
+
+void StreamPrefetcher::setMaxAtoms(int max_atoms) {
+    fetcher_.setMaxAtoms(max_atoms);
+}
+
+void StreamPrefetcher::start() {
+    if(pending_)
+        return;
+    log_ << "prefetching the next stream..." << endl;
+    error_.clear();
+    pending_ = true;
+    thread_.start(*this);
+}
+
+bool StreamPrefetcher::pending() const {
+    return pending_;
+}
+
+PreparedStream *StreamPrefetcher::take() {
+    if(!pending_)
+        return NULL;
+    thread_.join();
+    pending_ = false;
+    flushLog();
+    if(error_.size() > 0) {
+        log_ << "prefetch failed: " << error_ << endl;
+        return NULL;
+    }
+    PreparedStream *prepared = prepared_;
+    prepared_ = NULL;
+    return prepared;
+}
+
+void StreamPrefetcher::flushLog() {
+    istringstream lines(buffer_.str());
+    string line;
+    while(getline(lines, line))
+        log_ << "prefetch: " << line << endl;
+    buffer_.str("");
+    buffer_.clear();
+}
+
+void StreamPrefetcher::run() {
+    PreparedStream *prepared = new PreparedStream();
+    try {
+        fetcher_.fetchAssignment(cc_uri_, donor_token_, target_id_,
+                                 proxy_string_, prepared->assignment);
+        prepared->prepare(fetcher_.logStream);
+        prepared_ = prepared;
+    } catch(const std::exception &e) {
+        delete prepared;
+        error_ = e.what();
+    } catch(...) {
+        delete prepared;
+        error_ = "unknown error";
+    }
+}
@@ -0,0 +1,119 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef STREAM_PREFETCHER_H_
+#define STREAM_PREFETCHER_H_
+
+#include <Poco/Runnable.h>
+#include <Poco/Thread.h>
+#include <OpenMM.h>
+
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "Core.h"
+
+/* An Assignment whose system, integrators and state have been deserialized,
+   so starting it only needs the OpenMM contexts to be created. */
+struct PreparedStream {
+    PreparedStream();
+
+    /* Deletes whatever startStream() did not take over */
+    ~PreparedStream();
+
+    /* Deserialize system.xml, integrator.xml and state.xml from the files
+       of the assignment, and drop them from its files. state is left NULL
+       if the stream resumes from a binary state.bin */
+    void prepare(std::ostream &log);
+
+    Assignment assignment;
+    OpenMM::System *system;
+    OpenMM::Integrator *core_integrator;
+    OpenMM::Integrator *ref_integrator;
+    OpenMM::State *state;
+
+private:
+    PreparedStream(const PreparedStream &);
+    PreparedStream &operator=(const PreparedStream &);
+};
+
+/**
+ * Fetches and prepares the next stream on a background thread while the
+ * current one is being torn down, so the device only sits idle for as long
+ * as it takes to create the new contexts.
+ *
+ * A prefetched stream has already been started on the SCV, so it should be
+ * taken and run promptly; if the process exits instead, the SCV expires it.
+ *
+ * The prefetch thread logs into a buffer of its own, which the calling
+ * thread copies into log on take(), so log is only ever written by the
+ * thread that owns the prefetcher.
+ */
+class StreamPrefetcher : public Poco::Runnable {
+public:
+    StreamPrefetcher(const std::string &core_key,
+                     const std::string &cc_uri,
+                     const std::string &donor_token,
+                     const std::string &target_id,
+                     const std::string &proxy_string,
+                     std::ostream &log);
+
+    /* Waits for a prefetch that is still running */
+    ~StreamPrefetcher();
+
+    /* Cache used when fetching, see Core::setFileCache() */
+    void setFileCache(FileCache *cache);
+
+    /* Atom count hint sent to the CC, see Core::setMaxAtoms() */
+    void setMaxAtoms(int max_atoms);
+
+    /* Begin fetching the next stream, unless a prefetch is already pending */
+    void start();
+
+    /* Whether start() was called since the last take() */
+    bool pending() const;
+
+    /* Wait for the prefetch to finish, copy what it logged into log and
+       return the prepared stream, which the caller now owns. Returns NULL,
+       after logging the error, if it failed. */
+    PreparedStream *take();
+
+    /* Work done on the prefetch thread */
+    void run();
+
+private:
+    StreamPrefetcher(const StreamPrefetcher &);
+    StreamPrefetcher &operator=(const StreamPrefetcher &);
+
+    /* Move the buffered prefetch output into log_. The prefetch thread must
+       not be running. */
+    void flushLog();
+
+    std::ostream &log_;
+    // written by the prefetch thread, declared before fetcher_ which logs to it
+    std::ostringstream buffer_;
+    // only ever used for fetchAssignment(), never engaged in a stream
+    Core fetcher_;
+    std::string cc_uri_;
+    std::string donor_token_;
+    std::string target_id_;
+    std::string proxy_string_;
+    Poco::Thread thread_;
+    bool pending_;
+    PreparedStream *prepared_;
+    std::string error_;
+};
+
+#endif
@@ -0,0 +1,110 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#include "ValidationPolicy.h"
+
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+static double parse_parameter(const string &policy, const string &value) {
+    stringstream ss(value);
+    double parameter;
+    ss >> parameter;
+    if(ss.fail() || !ss.eof())
+        throw std::runtime_error("Bad validation policy: "+policy);
+    return parameter;
+}
+
+ValidationPolicy::ValidationPolicy(const string &policy) :
+    mode_(FULL),
+    parameter_(0),
+    frames_seen_(0),
+    frames_validated_(0),
+    validation_seconds_(0),
+    last_validation_seconds_(0),
+    random_state_(static_cast<unsigned int>(time(NULL)) | 1) {
+    size_t colon = policy.find(':');
+    string name = policy.substr(0, colon);
+    if(name == "full" && colon == string::npos) {
+        mode_ = FULL;
+        return;
+    }
+    if(colon == string::npos)
+        throw std::runtime_error("Bad validation policy: "+policy);
+    parameter_ = parse_parameter(policy, policy.substr(colon+1));
+    if(name == "every") {
+        mode_ = EVERY_N;
+        if(parameter_ < 1 || parameter_ != static_cast<long long>(parameter_))
+            throw std::runtime_error("Bad validation policy: "+policy);
+    } else if(name == "budget") {
+        mode_ = BUDGET;
+        if(parameter_ <= 0 || parameter_ > 1)
+            throw std::runtime_error("Bad validation policy: "+policy);
+    } else if(name == "random") {
+        mode_ = RANDOM;
+        if(parameter_ <= 0 || parameter_ > 1)
+            throw std::runtime_error("Bad validation policy: "+policy);
+    } else {
+        throw std::runtime_error("Bad validation policy: "+policy);
+    }
+}
+
+bool ValidationPolicy::shouldValidate() {
+    bool validate = true;
+    if(mode_ == EVERY_N) {
+        validate = frames_seen_ % static_cast<long long>(parameter_) == 0;
+    } else if(mode_ == BUDGET) {
+        // validate if doing so now would keep us within the budget, the
+        // cost of the next evaluation is assumed to equal the last one.
+        double elapsed = start_.elapsed()/1e6;
+        validate = validation_seconds_+last_validation_seconds_ <= parameter_*elapsed;
+    } else if(mode_ == RANDOM) {
+        // xorshift32, good enough for sampling and independent of rand()
+        random_state_ ^= random_state_ << 13;
+        random_state_ ^= random_state_ >> 17;
+        random_state_ ^= random_state_ << 5;
+        validate = random_state_ < parameter_*4294967295.0;
+    }
+    frames_seen_++;
+    if(validate)
+        frames_validated_++;
+    return validate;
+}
+
+void ValidationPolicy::recordValidation(double seconds) {
+    validation_seconds_ += seconds;
+    last_validation_seconds_ = seconds;
+}
+
+string ValidationPolicy::describe() const {
+    stringstream ss;
+    switch(mode_) {
+        case FULL: ss << "full"; break;
+        case EVERY_N: ss << "every:" << parameter_; break;
+        case BUDGET: ss << "budget:" << parameter_; break;
+        case RANDOM: ss << "random:" << parameter_; break;
+    }
+    return ss.str();
+}
+
+long long ValidationPolicy::framesSeen() const {
+    return frames_seen_;
+}
+
+long long ValidationPolicy::framesValidated() const {
+    return frames_validated_;
+}
@@ -0,0 +1,65 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+#ifndef VALIDATION_POLICY_H_
+#define VALIDATION_POLICY_H_
+
+#include <Poco/Clock.h>
+#include <string>
+
+/**
+ * A ValidationPolicy decides which frames are checked against the Reference
+ * platform. Frames that are not selected still go through the cheap NaN and
+ * discrepancy tests. Policies are written as:
+ *
+ *   "full"         every frame
+ *   "every:N"      every Nth frame, starting with the first
+ *   "budget:F"     as often as possible while spending at most a fraction F
+ *                  of wall time on reference evaluation, eg. "budget:0.02"
+ *   "random:P"     each frame independently with probability P
+ *
+ */
+
+class ValidationPolicy {
+public:
+    enum Mode { FULL, EVERY_N, BUDGET, RANDOM };
+
+    /* Parse a policy string, throws if it is malformed */
+    explicit ValidationPolicy(const std::string &policy = "full");
+
+    /* Whether the next frame should be checked against the reference */
+    bool shouldValidate();
+
+    /* Account for a reference evaluation that took the given time */
+    void recordValidation(double seconds);
+
+    /* Canonical form of the policy, eg. "every:10" */
+    std::string describe() const;
+
+    /* Number of frames considered and validated so far */
+    long long framesSeen() const;
+    long long framesValidated() const;
+
+private:
+    Mode mode_;
+    double parameter_;
+    long long frames_seen_;
+    long long frames_validated_;
+    double validation_seconds_;
+    double last_validation_seconds_;
+    unsigned int random_state_;
+    Poco::Clock start_;
+};
+
+#endif
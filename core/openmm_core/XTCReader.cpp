@@ -0,0 +1,434 @@
+/* -*- mode: c; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- 
+ *
+ * $Id$
+ *
+ * Copyright (c) 2009-2014, Erik Lindahl & David van der Spoel
+ * All rights reserved.
+ * 
+ * C++ API by Yutong Zhao <proteneer@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "XTCReader.h"
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <cstdint>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#endif
+
+using std::string;
+using std::vector;
+
+#define MAGIC 1995
+
+// magic, natoms, step, time, box and the natoms repeated by the coordinates
+#define HEADER_BYTES (4*(4+9+1))
+// precision, minint, maxint and smallidx, followed by the byte count
+#define COMPRESSED_HEADER_BYTES (4*(1+3+3+1))
+
+static const int magicints[] = 
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 10, 12, 16, 20, 25, 32, 40, 50, 64,
+    80, 101, 128, 161, 203, 256, 322, 406, 512, 645, 812, 1024, 1290,
+    1625, 2048, 2580, 3250, 4096, 5060, 6501, 8192, 10321, 13003, 
+    16384, 20642, 26007, 32768, 41285, 52015, 65536,82570, 104031, 
+    131072, 165140, 208063, 262144, 330280, 416127, 524287, 660561, 
+    832255, 1048576, 1321122, 1664510, 2097152, 2642245, 3329021, 
+    4194304, 5284491, 6658042, 8388607, 10568983, 13316085, 16777216 
+};
+
+#define FIRSTIDX 9
+#define LASTIDX (sizeof(magicints) / sizeof(*magicints))
+
+static int sizeofint(int size) {
+	unsigned int num = 1;
+	int num_of_bits = 0;
+	while ((unsigned int) size >= num && num_of_bits < 32) {
+		num_of_bits++;
+		num <<= 1;
+	}
+	return num_of_bits;
+}
+
+static int sizeofints(int num_of_ints, unsigned int sizes[]) {
+	int i;
+	unsigned int num, num_of_bytes, num_of_bits, bytes[32], bytecnt, tmp;
+	num_of_bytes = 1;
+	bytes[0] = 1;
+	num_of_bits = 0;
+	for (i=0; i < num_of_ints; i++) {	
+		tmp = 0;
+		for (bytecnt = 0; bytecnt < num_of_bytes; bytecnt++) {
+			tmp = bytes[bytecnt] * sizes[i] + tmp;
+			bytes[bytecnt] = tmp & 0xff;
+			tmp >>= 8;
+		}
+		while (tmp != 0) {
+			bytes[bytecnt++] = tmp & 0xff;
+			tmp >>= 8;
+		}
+		num_of_bytes = bytecnt;
+	}
+	num = 1;
+	num_of_bytes--;
+	while (bytes[num_of_bytes] >= num) {
+		num_of_bits++;
+		num *= 2;
+	}
+	return num_of_bits + num_of_bytes * 8;
+}
+
+/* XDR is big endian; shifts give the right byte order on any host */
+static int32_t xdr_getlong(const unsigned char *in) {
+	uint32_t u = (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) |
+		(uint32_t(in[2]) << 8) | uint32_t(in[3]);
+	return static_cast<int32_t>(u);
+}
+
+static float xdr_getfloat(const unsigned char *in) {
+	int32_t bits = xdr_getlong(in);
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+/* The compressed coordinates as a stream of bits, read most significant
+ * first. Whole bytes are shifted into a 32 bit window, the counterpart of
+ * the writer's encodebits(), and reads past the end of the block throw
+ * rather than run off the mapping.
+ */
+class BitReader {
+public:
+	BitReader(const unsigned char *data, size_t size) :
+		data_(data), size_(size), cnt_(0), lastbits_(0), lastbyte_(0) {}
+
+	unsigned int bits(int num_of_bits) {
+		unsigned int mask = num_of_bits < 32 ? (1u << num_of_bits) - 1 : 0xffffffffu;
+		unsigned int num = 0;
+		while (num_of_bits >= 8) {
+			lastbyte_ = (lastbyte_ << 8) | next();
+			num |= (lastbyte_ >> lastbits_) << (num_of_bits - 8);
+			num_of_bits -= 8;
+		}
+		if (num_of_bits > 0) {
+			if (lastbits_ < static_cast<unsigned int>(num_of_bits)) {
+				lastbits_ += 8;
+				lastbyte_ = (lastbyte_ << 8) | next();
+			}
+			lastbits_ -= num_of_bits;
+			num |= (lastbyte_ >> lastbits_) & ((1u << num_of_bits) - 1);
+		}
+		return num & mask;
+	}
+
+	/* the inverse of the writer's encodeints() */
+	void ints(int num_of_bits, const unsigned int sizes[3], int nums[3]) {
+		unsigned int bytes[32];
+		int num_of_bytes = 0;
+		bytes[1] = bytes[2] = bytes[3] = 0;
+		while (num_of_bits > 8) {
+			bytes[num_of_bytes++] = bits(8);
+			num_of_bits -= 8;
+		}
+		if (num_of_bits > 0) {
+			bytes[num_of_bytes++] = bits(num_of_bits);
+		}
+		for (int i = 2; i > 0; i--) {
+			unsigned int num = 0;
+			for (int j = num_of_bytes-1; j >= 0; j--) {
+				num = (num << 8) | bytes[j];
+				unsigned int p = num / sizes[i];
+				bytes[j] = p;
+				num = num - p * sizes[i];
+			}
+			nums[i] = num;
+		}
+		nums[0] = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
+	}
+
+private:
+	unsigned int next() {
+		if (cnt_ >= size_)
+			throw std::runtime_error("Corrupt XTC frame: coordinates overrun");
+		return data_[cnt_++];
+	}
+
+	const unsigned char *data_;
+	size_t size_;
+	size_t cnt_;
+	unsigned int lastbits_;
+	unsigned int lastbyte_;
+};
+
+static void decompress_coord_float(const unsigned char *in, size_t avail,
+								   int natoms, float *positions) {
+	int minint[3], maxint[3];
+	unsigned int sizeint[3], sizesmall[3], bitsizeint[3];
+	unsigned int bitsize;
+	float precision = xdr_getfloat(in);
+	for (int j = 0; j < 3; j++) {
+		minint[j] = xdr_getlong(in + 4 + 4*j);
+		maxint[j] = xdr_getlong(in + 16 + 4*j);
+		sizeint[j] = maxint[j] - minint[j] + 1;
+	}
+	/* check if one of the sizes is to big to be multiplied */
+	if ((sizeint[0] | sizeint[1] | sizeint[2]) > 0xffffff) {
+		for (int j = 0; j < 3; j++)
+			bitsizeint[j] = sizeofint(sizeint[j]);
+		bitsize = 0; /* flag the use of large sizes */
+	} else {
+		bitsize = sizeofints(3, sizeint);
+	}
+	int smallidx = xdr_getlong(in + 28);
+	if (smallidx < FIRSTIDX || smallidx >= (int) LASTIDX || precision <= 0)
+		throw std::runtime_error("Corrupt XTC frame header");
+	int tmp = smallidx - 1;
+	tmp = (FIRSTIDX > tmp) ? FIRSTIDX : tmp;
+	int smaller = magicints[tmp] / 2;
+	int smallnum = magicints[smallidx] / 2;
+	sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+
+	size_t nbytes = static_cast<uint32_t>(xdr_getlong(in + 32));
+	if (nbytes > avail - COMPRESSED_HEADER_BYTES - 4)
+		throw std::runtime_error("Corrupt XTC frame: bad byte count");
+	BitReader reader(in + COMPRESSED_HEADER_BYTES + 4, nbytes);
+
+	float inv_precision = 1.0f / precision;
+	float *lfp = positions;
+	int thiscoord[3], prevcoord[3];
+	int run = 0;
+	int i = 0;
+	while (i < natoms) {
+		if (bitsize == 0) {
+			for (int j = 0; j < 3; j++)
+				thiscoord[j] = reader.bits(bitsizeint[j]);
+		} else {
+			reader.ints(bitsize, sizeint, thiscoord);
+		}
+		i++;
+		for (int j = 0; j < 3; j++) {
+			thiscoord[j] += minint[j];
+			prevcoord[j] = thiscoord[j];
+		}
+		int is_smaller = 0;
+		if (reader.bits(1) == 1) {
+			run = reader.bits(5);
+			is_smaller = run % 3;
+			run -= is_smaller;
+			is_smaller--;
+		}
+		if (i + run/3 > natoms)
+			throw std::runtime_error("Corrupt XTC frame: too many coordinates");
+		if (run > 0) {
+			for (int k = 0; k < run; k += 3) {
+				reader.ints(smallidx, sizesmall, thiscoord);
+				i++;
+				for (int j = 0; j < 3; j++)
+					thiscoord[j] += prevcoord[j] - smallnum;
+				if (k == 0) {
+					/* interchange first with second atom for better
+					 * compression of water molecules
+					 */
+					for (int j = 0; j < 3; j++) {
+						tmp = thiscoord[j]; thiscoord[j] = prevcoord[j]; prevcoord[j] = tmp;
+						*lfp++ = prevcoord[j] * inv_precision;
+					}
+				} else {
+					for (int j = 0; j < 3; j++)
+						prevcoord[j] = thiscoord[j];
+				}
+				for (int j = 0; j < 3; j++)
+					*lfp++ = thiscoord[j] * inv_precision;
+			}
+		} else {
+			for (int j = 0; j < 3; j++)
+				*lfp++ = thiscoord[j] * inv_precision;
+		}
+		smallidx += is_smaller;
+		if (smallidx < FIRSTIDX || smallidx >= (int) LASTIDX)
+			throw std::runtime_error("Corrupt XTC frame: bad run length");
+		if (is_smaller < 0) {
+			smallnum = smaller;
+			smaller = smallidx > FIRSTIDX ? magicints[smallidx - 1] / 2 : 0;
+		} else if (is_smaller > 0) {
+			smaller = smallnum;
+			smallnum = magicints[smallidx] / 2;
+		}
+		sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+	}
+}
+
+XTCReader::XTCReader(const string &path) :
+	data_(NULL),
+	size_(0),
+	map_(NULL) {
+#ifdef _WIN32
+	mapping_ = NULL;
+	file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_ == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Cannot open "+path);
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_, &size)) {
+		CloseHandle(file_);
+		throw std::runtime_error("Cannot stat "+path);
+	}
+	size_ = static_cast<size_t>(size.QuadPart);
+	if (size_ > 0) {
+		mapping_ = CreateFileMapping(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping_ != NULL)
+			map_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+		if (map_ == NULL) {
+			if (mapping_ != NULL)
+				CloseHandle(mapping_);
+			CloseHandle(file_);
+			throw std::runtime_error("Cannot map "+path);
+		}
+	}
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open "+path);
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		throw std::runtime_error("Cannot stat "+path);
+	}
+	size_ = info.st_size;
+	if (size_ > 0) {
+		map_ = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map_ == MAP_FAILED) {
+			map_ = NULL;
+			close(fd);
+			throw std::runtime_error("Cannot map "+path);
+		}
+		// frames are mostly visited in order
+		madvise(map_, size_, MADV_SEQUENTIAL);
+	}
+	// the mapping keeps the file alive
+	close(fd);
+#endif
+	data_ = static_cast<const unsigned char *>(map_);
+	try {
+		index();
+	} catch (...) {
+		unmap();
+		throw;
+	}
+}
+
+XTCReader::XTCReader(const char *data, size_t size) :
+	data_(reinterpret_cast<const unsigned char *>(data)),
+	size_(size),
+	map_(NULL) {
+#ifdef _WIN32
+	file_ = INVALID_HANDLE_VALUE;
+	mapping_ = NULL;
+#endif
+	index();
+}
+
+XTCReader::~XTCReader() {
+	unmap();
+}
+
+void XTCReader::unmap() {
+#ifdef _WIN32
+	if (map_ != NULL)
+		UnmapViewOfFile(map_);
+	if (mapping_ != NULL)
+		CloseHandle(mapping_);
+	if (file_ != INVALID_HANDLE_VALUE)
+		CloseHandle(file_);
+	map_ = NULL;
+	mapping_ = NULL;
+	file_ = INVALID_HANDLE_VALUE;
+#else
+	if (map_ != NULL)
+		munmap(map_, size_);
+	map_ = NULL;
+#endif
+}
+
+void XTCReader::index() {
+	size_t offset = 0;
+	while (offset < size_) {
+		const unsigned char *in = data_ + offset;
+		size_t avail = size_ - offset;
+		if (avail < HEADER_BYTES)
+			throw std::runtime_error("Truncated XTC frame header");
+		if (xdr_getlong(in) != MAGIC)
+			throw std::runtime_error("Bad XTC magic number");
+		XTCFrame frame;
+		frame.natoms = xdr_getlong(in+4);
+		frame.step = xdr_getlong(in+8);
+		frame.time = xdr_getfloat(in+12);
+		frame.offset = offset;
+		if (frame.natoms <= 0 || xdr_getlong(in+HEADER_BYTES-4) != frame.natoms)
+			throw std::runtime_error("Bad XTC atom count");
+		if (frame.natoms <= 9) {
+			/* up to 9 atoms are stored uncompressed */
+			frame.bytes = HEADER_BYTES + 12*size_t(frame.natoms);
+		} else {
+			if (avail < HEADER_BYTES + COMPRESSED_HEADER_BYTES + 4)
+				throw std::runtime_error("Truncated XTC frame header");
+			size_t nbytes = static_cast<uint32_t>(xdr_getlong(in+HEADER_BYTES+COMPRESSED_HEADER_BYTES));
+			/* the opaque coordinates are padded to whole XDR units */
+			frame.bytes = HEADER_BYTES + COMPRESSED_HEADER_BYTES + 4 + (nbytes+3)/4*4;
+		}
+		if (frame.bytes > avail)
+			throw std::runtime_error("Truncated XTC frame");
+		frames_.push_back(frame);
+		offset += frame.bytes;
+	}
+}
+
+const vector<XTCFrame> &XTCReader::frames() const {
+	return frames_;
+}
+
+void XTCReader::read(size_t i, float box[9], vector<float> &positions) const {
+	if (i >= frames_.size())
+		throw std::runtime_error("XTC frame index out of range");
+	const XTCFrame &frame = frames_[i];
+	const unsigned char *in = data_ + frame.offset;
+	for (int j = 0; j < 9; j++)
+		box[j] = xdr_getfloat(in + 16 + 4*j);
+	positions.resize(3*size_t(frame.natoms));
+	in += HEADER_BYTES;
+	if (frame.natoms <= 9) {
+		for (int j = 0; j < 3*frame.natoms; j++)
+			positions[j] = xdr_getfloat(in + 4*j);
+	} else {
+		decompress_coord_float(in, frame.bytes - HEADER_BYTES, frame.natoms, &positions[0]);
+	}
+}
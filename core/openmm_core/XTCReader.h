@@ -0,0 +1,97 @@
+/* -*- mode: c; tab-width: 4; indent-tabs-mode: t; c-basic-offset: 4 -*- 
+ *
+ * $Id$
+ *
+ * Copyright (c) 2009-2014, Erik Lindahl & David van der Spoel
+ * All rights reserved.
+ * 
+ * C++ API by Yutong Zhao <proteneer@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef XTC_READER_H_
+#define XTC_READER_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Where a frame is in an XTC trajectory, read from its header alone
+struct XTCFrame {
+	int step;
+	float time;
+	int natoms;
+	size_t offset;
+	size_t bytes;
+};
+
+// Reads trajectories written by XTCWriter, or any other XTC writer. The
+// frames are indexed up front from their headers, skipping the compressed
+// coordinates, so checking frame counts and steps never decodes anything.
+// Frames are decoded straight from the mapped file or buffer on demand, in
+// any order. read() does not modify the reader, so several threads may
+// decode frames of one reader at once.
+class XTCReader {
+
+public:
+
+	// Memory maps the file at path. Throws if it cannot be read or is not a
+	// complete XTC trajectory.
+	explicit XTCReader(const std::string &path);
+
+	// Reads a trajectory held in memory, eg. an uploaded frames.xtc. data
+	// is not copied and must outlive the reader.
+	XTCReader(const char *data, size_t size);
+
+	~XTCReader();
+
+	// Every frame of the trajectory in file order
+	const std::vector<XTCFrame> &frames() const;
+
+	// Decode frame i into the three box vectors one after another and
+	// natoms xyz triples, in nm. Reusing positions between calls avoids
+	// per-frame allocations.
+	void read(size_t i, float box[9], std::vector<float> &positions) const;
+
+private:
+
+	XTCReader(const XTCReader &);
+	XTCReader &operator=(const XTCReader &);
+
+	void index();
+
+	void unmap();
+
+	const unsigned char *data_;
+	size_t size_;
+	// the mapping of a file, NULL for a buffer
+	void *map_;
+#ifdef _WIN32
+	void *file_;
+	void *mapping_;
+#endif
+	std::vector<XTCFrame> frames_;
+
+};
+
+#endif
@@ -35,9 +35,12 @@
 #include <stdexcept>
 #include <cstdio>
 #include <climits>
+#include <cstring>
 
 #ifdef _WIN32
 #include <cstdint>
+#else
+#include <stdint.h>
 #endif
 
 using std::ostream;
@@ -81,74 +84,30 @@ static int sizeofints(int num_of_ints, unsigned int sizes[]) {
     return num_of_bits + num_of_bytes * 8;
 }
 
-static int32_t xdr_swapbytes(int32_t x) {
-	int32_t y,i;
-	char *px=(char *)&x;
-	char *py=(char *)&y;
-	for(i=0;i<4;i++)
-		py[i]=px[3-i];
-	return y;
+/* XDR is big endian; shifts give the right byte order on any host */
+static void xdr_putlong(vector<char> &out, int32_t x) {
+	uint32_t u = static_cast<uint32_t>(x);
+	char bytes[4];
+	bytes[0] = static_cast<char>(u >> 24);
+	bytes[1] = static_cast<char>(u >> 16);
+	bytes[2] = static_cast<char>(u >> 8);
+	bytes[3] = static_cast<char>(u);
+	out.insert(out.end(), bytes, bytes+4);
 }
 
-static int32_t xdr_htonl(int32_t x) {
-	int s=0x1234;
-	if( *((char *)&s)==(char)0x34) {
-		/* smallendian,swap bytes */
-		return xdr_swapbytes(x);
-	} else {
-		/* bigendian, do nothing */
-		return x;
-	}
-}
-
-static int xdr_putbytes(ostream &stream, char *addr, unsigned int len) {
-	stream.write(addr,int(len));
-	return 1;
+static int xdrfile_write_int(const int *ptr, int ndata, vector<char> &out) {
+	for(int i=0; i < ndata; i++)
+		xdr_putlong(out, static_cast<int32_t>(ptr[i]));
+	return ndata;
 }
 
-static int xdr_putlong(ostream &stream, int32_t *lp) {
-	int32_t mycopy = xdr_htonl (*lp);
-	lp = &mycopy;
-	stream.write(reinterpret_cast<char *>(lp),4);
-	return 1;
-}
-
-struct XDRSTREAM {
-	ostream  &stream;
-    int *    buf1;     /**< Buffer for internal use                   */
-    int      buf1size; /**< Current allocated length of buf1          */    
-    int *    buf2;     /**< Buffer for internal use                   */
-    int      buf2size; /**< Current allocated length of buf2          */ 
-};
-
-static int xdr_int(ostream &stream, int *ip) {
-	int32_t i32;
-	i32 = (int32_t) *ip;
-	return xdr_putlong (stream, &i32);
-}
-
-static int xdr_float(ostream &stream, float *fp) {
-	if (sizeof(float) == sizeof(int32_t))
-		return (xdr_putlong(stream, (int32_t *)fp));
-	else if (sizeof(float) == sizeof(int)) {
-		int32_t tmp = *(int *)fp;
-		return (xdr_putlong(stream, &tmp));
+static int xdrfile_write_float(const float *ptr, int ndata, vector<char> &out) {
+	for(int i=0; i < ndata; i++) {
+		int32_t bits;
+		memcpy(&bits, ptr+i, sizeof(bits));
+		xdr_putlong(out, bits);
 	}
-}
-
-static int xdrfile_write_int(int *ptr, int ndata, ostream &stream) {
-	int i=0;
-  	while(i<ndata && xdr_int(stream,ptr+i))
-		i++;
-	return i;
-}
-
-static int xdrfile_write_float(float *ptr, int ndata, ostream &stream) {
-	int i=0;
-	/* read write is encoded in the XDR struct */  
-	while(i<ndata && xdr_float(stream,ptr+i))
-		i++;
-	return i;
+	return ndata;
 }
 
 static void encodebits(int buf[], int num_of_bits, int num) {
@@ -252,7 +211,6 @@ static void encodeints(int buf[], int num_of_ints, int num_of_bits,
 }
 
 #define BYTES_PER_XDR_UNIT 4 
-static char xdr_zero[BYTES_PER_XDR_UNIT] = {0, 0, 0, 0};
 
 static const int magicints[] = 
 {
@@ -269,45 +227,26 @@ static const int magicints[] =
 /* note that magicints[FIRSTIDX-1] == 0 */
 #define LASTIDX (sizeof(magicints) / sizeof(*magicints))
 
-static int xdr_opaque(ostream &stream, char *cp, unsigned int cnt) {
-	unsigned int rndup;
-	static char crud[BYTES_PER_XDR_UNIT];
-
-	/*
-	 * if no data we are done
-	 */
-	if (cnt == 0)
-		return 1;
-
-	rndup = cnt % BYTES_PER_XDR_UNIT;
+static int xdrfile_write_opaque(const char *ptr, int cnt, vector<char> &out) {
+	out.insert(out.end(), ptr, ptr+cnt);
+	int rndup = cnt % BYTES_PER_XDR_UNIT;
 	if (rndup > 0)
-		rndup = BYTES_PER_XDR_UNIT - rndup;
-	if (!xdr_putbytes (stream, cp, cnt))
-		return 0;
-	if (rndup == 0)
-		return 1;
-	return xdr_putbytes (stream, xdr_zero, rndup);
-
+		out.insert(out.end(), BYTES_PER_XDR_UNIT - rndup, 0);
+	return cnt;
 }
 
-static int xdrfile_write_opaque(char *ptr, int cnt, ostream &stream) {
-	if(xdr_opaque(stream,ptr,cnt))
-		return cnt;
-	else
-		return 0;
-}
-
-static int xdrfile_compress_coord_float(float   *ptr,
+static int xdrfile_compress_coord_float(const float *ptr,
 							 int      size,
 							 float    precision,
-							 ostream &stream) {
+							 vector<char> &stream,
+							 vector<int> &xbuf1,
+							 vector<int> &xbuf2) {
 	int minint[3], maxint[3], mindiff, *lip, diff;
-	int lint1, lint2, lint3, oldlint1, oldlint2, oldlint3, smallidx;
+	int smallidx;
 	int minidx, maxidx;
 	unsigned sizeint[3], sizesmall[3], bitsizeint[3], size3, *luip;
 	int k, *buf1, *buf2;
 	int smallnum, smaller, larger, i, j, is_small, is_smaller, run, prevrun;
-	float *lfp, lf;
 	int tmp, tmpsum, *thiscoord,  prevcoord[3];
 	unsigned int tmpcoord[30];
 	int errval=1;
@@ -319,23 +258,13 @@ static int xdrfile_compress_coord_float(float   *ptr,
     bitsizeint[1] = 0;
     bitsizeint[2] = 0;
 
-	vector<int> xbuf1(size3,0);
-	vector<int> xbuf2(size3*1.2,0);
+	// scratch space is only ever grown, so a writer reused across frames
+	// stops allocating once it has seen the largest frame
+	if(xbuf1.size() < size3)
+		xbuf1.resize(size3);
+	if(xbuf2.size() < size_t(size3*1.2))
+		xbuf2.resize(size3*1.2);
 
-/*
-	if(size3>xfp->buf1size) {
-		if((xfp->buf1=(int *)malloc(sizeof(int)*size3))==NULL) {
-			fprintf(stderr,"Cannot allocate memory for compressing coordinates.\n");
-			return -1;
-		}
-		xfp->buf1size=size3;
-		xfp->buf2size=size3*1.2;
-		if((xfp->buf2=(int *)malloc(sizeof(int)*xfp->buf2size))==NULL) {
-			fprintf(stderr,"Cannot allocate memory for compressing coordinates.\n");
-			return -1;
-		}	
-	}
-	*/
 	if(xdrfile_write_int(&size,1,stream)==0)
 		return -1; /* return if we could not write size */
 	/* Dont bother with compression for three atoms or less */
@@ -348,75 +277,50 @@ static int xdrfile_compress_coord_float(float   *ptr,
 	if (precision <= 0)
 		precision = 1000;
 	xdrfile_write_float(&precision,1,stream);
-	/* avoid repeated pointer dereferencing. */
-	/*
-	buf1=xfp->buf1; 
-	buf2=xfp->buf2;
-	*/
 	buf1=&xbuf1[0];
 	buf2=&xbuf2[0];
 	/* buf2[0-2] are special and do not contain actual data */
 	buf2[0] = buf2[1] = buf2[2] = 0;
+	prevrun = -1;
+	/* find nearest integer. This is a flat loop without dependencies between
+	 * iterations so that it can be vectorized. Adding 0.5f in single
+	 * precision rounds exactly like widening to double, adding 0.5 and
+	 * narrowing back, so the output matches the reference xdrfile encoder.
+	 */
+	const float limit = INT_MAX-2;
+	int overflow = 0;
+	for (unsigned int n = 0; n < size3; n++)
+	{
+		float scaled = ptr[n] * precision;
+		float lf = ptr[n] >= 0.0f ? scaled + 0.5f : scaled - 0.5f;
+		overflow |= fabs(lf) > limit;
+		buf1[n] = (int) lf;
+	}
+	if (overflow)
+	{
+		/* scaling would cause overflow */
+		fprintf(stderr,"Internal overflow compressing coordinates.\n");
+		errval=0;
+	}
 	minint[0] = minint[1] = minint[2] = INT_MAX;
 	maxint[0] = maxint[1] = maxint[2] = INT_MIN;
-	prevrun = -1;
-	lfp = ptr;
-	lip = buf1;
-	mindiff = INT_MAX;
-	oldlint1 = oldlint2 = oldlint3 = 0;
-	while(lfp < ptr + size3 )
-    {
-		/* find nearest integer */
-		if (*lfp >= 0.0)
-			lf = *lfp * precision + 0.5;
-		else
-			lf = *lfp * precision - 0.5;
-		if (fabs(lf) > INT_MAX-2) 
-        {
-			/* scaling would cause overflow */
-			fprintf(stderr,"Internal overflow compressing coordinates.\n");
-			errval=0;
-		}
-		lint1 = lf;
-		if (lint1 < minint[0]) minint[0] = lint1;
-		if (lint1 > maxint[0]) maxint[0] = lint1;
-		*lip++ = lint1;
-		lfp++;
-		if (*lfp >= 0.0)
-			lf = *lfp * precision + 0.5;
-		else
-			lf = *lfp * precision - 0.5;
-		if (fabs(lf) > INT_MAX-2)
-        {
-			/* scaling would cause overflow */
-			fprintf(stderr,"Internal overflow compressing coordinates.\n");
-			errval=0;
-		}
-		lint2 = lf;
-		if (lint2 < minint[1]) minint[1] = lint2;
-		if (lint2 > maxint[1]) maxint[1] = lint2;
-		*lip++ = lint2;
-		lfp++;
-		if (*lfp >= 0.0)
-			lf = *lfp * precision + 0.5;
-		else
-			lf = *lfp * precision - 0.5;
-		if (fabs(lf) > INT_MAX-2) 
-        {
-			errval=0;      
+	for (i = 0; i < size; i++)
+	{
+		lip = buf1 + 3*i;
+		for (j = 0; j < 3; j++)
+		{
+			if (lip[j] < minint[j]) minint[j] = lip[j];
+			if (lip[j] > maxint[j]) maxint[j] = lip[j];
 		}
-		lint3 = lf;
-		if (lint3 < minint[2]) minint[2] = lint3;
-		if (lint3 > maxint[2]) maxint[2] = lint3;
-		*lip++ = lint3;
-		lfp++;
-		diff = abs(oldlint1-lint1)+abs(oldlint2-lint2)+abs(oldlint3-lint3);
-		if (diff < mindiff && lfp > ptr + 3)
+	}
+	mindiff = INT_MAX;
+	for (i = 1; i < size; i++)
+	{
+		lip = buf1 + 3*i;
+		diff = abs(lip[-3]-lip[0])+abs(lip[-2]-lip[1])+abs(lip[-1]-lip[2]);
+		if (diff < mindiff)
 			mindiff = diff;
-		oldlint1 = lint1;
-		oldlint2 = lint2;
-		oldlint3 = lint3;
-	}  
+	}
 	xdrfile_write_int(minint,3,stream);
 	xdrfile_write_int(maxint,3,stream);
   
@@ -598,14 +502,17 @@ XTCWriter::XTCWriter(ostream &output, float precision) :
 
 };
 
+void XTCWriter::setPrecision(float precision) {
+	if(precision <= 0)
+		throw(std::runtime_error("XTC precision must be positive"));
+	precision_ = precision;
+}
+
 #define MAGIC 1995
 
 void XTCWriter::append(int step, float time, 
 		        	   const vector<vector<float> > &box,
 				       const vector<vector<float> > &positions) {
-	// write headers
-	int result,magic,n=1;
-	
 	if(box.size() != 3) 
 		throw(std::runtime_error("Bad box size!"));
 	if(box[0].size() != 3)
@@ -615,37 +522,32 @@ void XTCWriter::append(int step, float time,
     for(int i=0;i<positions.size(); i++)
     	if(positions[i].size() != 3)
     		throw(std::runtime_error("One of the positions has size != 3"));
- 
- 	int natoms = positions.size();
 
-	float a_box[3][3];
-    a_box[0][0] = box[0][0]; a_box[0][1] = box[0][1]; a_box[0][2] = box[0][2];
-    a_box[1][0] = box[1][0]; a_box[1][1] = box[1][1]; a_box[1][2] = box[1][2];
-    a_box[2][0] = box[2][0]; a_box[2][1] = box[2][1]; a_box[2][2] = box[2][2];
+	float a_box[9];
+	for(int i=0;i<3;i++)
+		for(int j=0;j<3;j++)
+			a_box[3*i+j] = box[i][j];
+	flat_.resize(3*positions.size());
+	for(int i=0;i<positions.size(); i++)
+		for(int j=0;j<3;j++)
+			flat_[3*i+j] = positions[i][j];
+	append(step, time, a_box, &flat_[0], positions.size());
+}
 
-	magic  = MAGIC;
-	if ((result = xdrfile_write_int(&magic,n,output_)) != n)
-		throw std::runtime_error("exdrINT");
-	if (magic != MAGIC)
-		throw std::runtime_error("exdrMAGIC");
-	if (xdrfile_write_int(&natoms,n,output_) != n)
-		throw std::runtime_error("exdrINT");
-	if (xdrfile_write_int(&step,n,output_) != n)
-		throw std::runtime_error("exdrINT");
-	if (xdrfile_write_float(&time,n,output_) != n)
-		throw std::runtime_error("exdrFLOAT");
-	// write coords
-	if (3*3 != xdrfile_write_float(a_box[0],3*3,output_))
-		throw std::runtime_error("exdrFLOAT");
-	// convert positions to expected xtc format
-	typedef float rvec[3];
-    rvec *coords = (rvec *) malloc(sizeof(rvec)*natoms);
-    for(int i=0;i<positions.size(); i++) {
-        for(int j=0;j<3;j++) {
-            coords[i][j] = positions[i][j];
-        }
-    }
-	if (xdrfile_compress_coord_float(coords[0],natoms,precision_,output_) != natoms)
+void XTCWriter::append(int step, float time, const float *box,
+					   const float *positions, int natoms) {
+	if(natoms <= 0)
+		throw(std::runtime_error("Empty positions"));
+	int magic = MAGIC;
+	out_.clear();
+	// header and box, plus the worst case for the compressed coordinates
+	out_.reserve(23*4 + 12*natoms + 64);
+	xdrfile_write_int(&magic,1,out_);
+	xdrfile_write_int(&natoms,1,out_);
+	xdrfile_write_int(&step,1,out_);
+	xdrfile_write_float(&time,1,out_);
+	xdrfile_write_float(box,3*3,out_);
+	if (xdrfile_compress_coord_float(positions,natoms,precision_,out_,buf1_,buf2_) != natoms)
 		throw std::runtime_error("exdr3DX");
-	free(coords);
+	output_.write(&out_[0], out_.size());
 }
@@ -46,10 +46,24 @@ public:
 		        const std::vector<std::vector<float> > &box,
 				const std::vector<std::vector<float> > &positions);
 
+	// box holds the three box vectors one after another, positions holds
+	// natoms xyz triples. Scratch space is kept between calls, so reusing one
+	// writer for every frame of a trajectory avoids per-frame allocations.
+	void append(int step, float time, const float *box,
+				const float *positions, int natoms);
+
+	// Precision of the coordinates of the frames appended from now on, eg.
+	// 1000 keeps 3 decimals in nm. Coarser precisions compress better.
+	void setPrecision(float precision);
+
 private:
 
 	std::ostream &output_;
-	const float precision_;
+	float precision_;
+	std::vector<char> out_;
+	std::vector<int> buf1_;
+	std::vector<int> buf2_;
+	std::vector<float> flat_;
 
 };
 
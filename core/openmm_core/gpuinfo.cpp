@@ -16,6 +16,8 @@
 #include <map>
 #include <string>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
 
 using namespace std;
 
@@ -25,15 +27,11 @@ using namespace std;
 #else
 #include <CL/cl.h>
 #endif
-void Util::listOpenCLDevices() {
+vector<Util::Device> Util::openCLDevices() {
+    vector<Device> result;
     cl_platform_id platforms[100];
     cl_uint platforms_n = 0;
     clGetPlatformIDs(100, platforms, &platforms_n);
-    if (platforms_n == 0) {
-        cout << "No OpenCL Compatible Devices Found" << endl;
-        return;
-    }
-    cout << "OpenCL compatible devices: " << endl;
     for(int j=0; j<platforms_n; j++) {
         cl_device_id devices[100];
         cl_uint devices_n = 0;
@@ -41,36 +39,71 @@ void Util::listOpenCLDevices() {
         for (int i=0; i<devices_n; i++) {
             char buffer[10240];
             clGetDeviceInfo(devices[i], CL_DEVICE_NAME, sizeof(buffer), buffer, NULL);
-            string deviceName(buffer);
-            cout << "name: " << deviceName << " | platformId: " << j << " deviceId: " << i << endl;
+            Device device;
+            device.name = buffer;
+            stringstream platform_index, device_index;
+            platform_index << j;
+            device_index << i;
+            device.properties["OpenCLPlatformIndex"] = platform_index.str();
+            device.properties["OpenCLDeviceIndex"] = device_index.str();
+            result.push_back(device);
         }
     }
+    return result;
+}
+
+void Util::listOpenCLDevices() {
+    vector<Device> devices = openCLDevices();
+    if (devices.size() == 0) {
+        cout << "No OpenCL Compatible Devices Found" << endl;
+        return;
+    }
+    cout << "OpenCL compatible devices: " << endl;
+    for(unsigned i=0; i<devices.size(); i++) {
+        cout << "name: " << devices[i].name
+             << " | platformId: " << devices[i].properties["OpenCLPlatformIndex"]
+             << " deviceId: " << devices[i].properties["OpenCLDeviceIndex"] << endl;
+    }
 }
 #elif OPENMM_CUDA
 #include <cuda.h>
-void Util::listCUDADevices() {
+vector<Util::Device> Util::cudaDevices() {
     CUresult errorMsg = cuInit(0);
-    if(errorMsg != CUDA_SUCCESS) {
-        cout << "CUDA ERROR: cannot initialize CUDA." << endl;
-        return;
-    }
+    if(errorMsg != CUDA_SUCCESS)
+        throw std::runtime_error("CUDA ERROR: cannot initialize CUDA.");
     int numDevices = 0;
     errorMsg = cuDeviceGetCount(&numDevices);
-    if(errorMsg != CUDA_SUCCESS) {
-        cout << "CUDA ERROR: cannot get number of devices." << endl;
-        return;
-    }
-    if(numDevices == 0) {
-        cout << "No CUDA Compatible Devices Found" << endl;
-        return;
-    }
-    map<string, int> deviceMap;
+    if(errorMsg != CUDA_SUCCESS)
+        throw std::runtime_error("CUDA ERROR: cannot get number of devices.");
+    vector<Device> result;
     for(int i=0; i<numDevices;i++) {
         CUdevice device;
         cuDeviceGet(&device, i);
         char name[500];
         cuDeviceGetName(name, 500, device);
-        cout << "name: " << name << " | deviceId: " << i << endl;
+        Device info;
+        info.name = name;
+        stringstream device_index;
+        device_index << i;
+        info.properties["CudaDeviceIndex"] = device_index.str();
+        result.push_back(info);
+    }
+    return result;
+}
+
+void Util::listCUDADevices() {
+    vector<Device> devices;
+    try {
+        devices = cudaDevices();
+    } catch(const std::exception &e) {
+        cout << e.what() << endl;
+        return;
+    }
+    if(devices.size() == 0) {
+        cout << "No CUDA Compatible Devices Found" << endl;
+        return;
     }
+    for(unsigned i=0; i<devices.size(); i++)
+        cout << "name: " << devices[i].name << " | deviceId: " << devices[i].properties["CudaDeviceIndex"] << endl;
 }
 #endif
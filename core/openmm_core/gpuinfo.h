@@ -17,12 +17,24 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 namespace Util {
 
+/* A visible device and the context properties that select it */
+struct Device {
+    std::string name;
+    std::map<std::string, std::string> properties;
+};
+
+/* every device of every OpenCL platform */
+std::vector<Device> openCLDevices();
 void listOpenCLDevices();
+
+/* every CUDA device, throws if the driver cannot be queried */
+std::vector<Device> cudaDevices();
 void listCUDADevices();
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -19,11 +19,26 @@
 #include "OpenMMCore.h"
 #include "ezOptionParser.h"
 #include "ExitSignal.h"
+#include "FileCache.h"
+#include "CoreWorker.h"
+#include "PrefixedLog.h"
+#include "AutoTune.h"
+
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/Process.h>
+#include <Poco/Thread.h>
+#include <Poco/Environment.h>
 
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cstdlib>
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <ctime>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -34,10 +49,56 @@
     }
 #else
     #include <unistd.h>
+    #include <signal.h>
+    #include <cerrno>
 #endif
 
 using namespace std;
 
+// whether the process pid still exists, so a spool named after it is in use
+static bool processRunning(long pid) {
+#ifdef _WIN32
+    HANDLE process = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, DWORD(pid));
+    if(process == NULL)
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    DWORD code = 0;
+    bool running = GetExitCodeProcess(process, &code) && code == STILL_ACTIVE;
+    CloseHandle(process);
+    return running;
+#else
+    return kill(pid_t(pid), 0) == 0 || errno == EPERM;
+#endif
+}
+
+// Each core spools into uploads/<pid> under the spool directory, so cores
+// sharing it leave each other's uploads alone. Streams cannot be resumed
+// across runs, so neither can their uploads: the spools of cores that have
+// exited are removed, along with a stale spool of a reused pid.
+static string prepareSpoolDir(const string &spool_root) {
+    Poco::Path uploads(Poco::Path(spool_root).makeDirectory(), "uploads");
+    uploads.makeDirectory();
+    Poco::File uploads_file(uploads.toString());
+    if(uploads_file.exists()) {
+        vector<string> entries;
+        uploads_file.list(entries);
+        for(unsigned i=0; i < entries.size(); i++) {
+            if(entries[i].empty() || entries[i].find_first_not_of("0123456789") != string::npos)
+                continue;
+            long pid = atol(entries[i].c_str());
+            if(pid == long(Poco::Process::id()) || !processRunning(pid)) {
+                try {
+                    Poco::File(Poco::Path(uploads, entries[i]).toString()).remove(true);
+                } catch(...) {
+                    // another core may be clearing it at the same time
+                }
+            }
+        }
+    }
+    stringstream pid;
+    pid << Poco::Process::id();
+    return Poco::Path(uploads, pid.str()).toString();
+}
+
 #ifdef OPENMM_OPENCL 
 #include "gpuinfo.h"
 #ifdef FAH_CORE
@@ -98,6 +159,59 @@ static string getPlatformId(const string& gpuvendor) {
 #include "gpuinfo.h"
 #endif
 
+#if defined(OPENMM_OPENCL) || defined(OPENMM_CUDA)
+// every precision on each visible device that agrees with the fixed
+// properties and, when given, is one of the devices
+static vector<AutoTune::Candidate> tuning_candidates(const vector<Util::Device> &visible,
+                                                     const map<string, string> &fixed,
+                                                     const vector<string> &devices,
+                                                     const string &device_property,
+                                                     const string &precision_property) {
+    const char *precisions[] = {"single", "mixed"};
+    vector<AutoTune::Candidate> candidates;
+    for(unsigned i=0; i < visible.size(); i++) {
+        map<string, string> properties(fixed);
+        bool allowed = true;
+        for(map<string, string>::const_iterator it = visible[i].properties.begin();
+            it != visible[i].properties.end(); it++) {
+            map<string, string>::const_iterator value = fixed.find(it->first);
+            if(value != fixed.end() && value->second != it->second)
+                allowed = false;
+            if(it->first == device_property && !devices.empty() &&
+               find(devices.begin(), devices.end(), it->second) == devices.end())
+                allowed = false;
+            properties[it->first] = it->second;
+        }
+        if(!allowed)
+            continue;
+        for(int j=0; j < 2; j++) {
+            AutoTune::Candidate candidate;
+            stringstream name;
+            name << visible[i].name << " (";
+            for(map<string, string>::const_iterator it = visible[i].properties.begin();
+                it != visible[i].properties.end(); it++)
+                name << it->first << " " << it->second << ", ";
+            name << precisions[j] << ")";
+            candidate.name = name.str();
+            candidate.properties = properties;
+            candidate.properties[precision_property] = precisions[j];
+            candidates.push_back(candidate);
+        }
+    }
+    return candidates;
+}
+#endif
+
+// "0,2,3" -> {"0", "2", "3"}
+static vector<string> split_devices(const string &ids) {
+    vector<string> devices;
+    stringstream ss(ids);
+    string id;
+    while(getline(ss, id, ','))
+        devices.push_back(id);
+    return devices;
+}
+
 static void write_spoiler(ostream &outstream) {
     outstream << "                                          O              O                     " << std::endl;
     outstream << "   P R O T E N E E R     C--N              \\              \\               N    " << std::endl;
@@ -222,6 +336,78 @@ int main(int argc, const char * argv[]) {
         "Number of seconds the core should run before exiting",
         "--duration");
 
+    opt.add(
+        "4",
+        0,
+        1,
+        0,
+        "Number of frames and checkpoints that can be uploading in the background, 0 uploads synchronously",
+        "--upload_queue");
+
+    opt.add(
+        "",
+        0,
+        1,
+        0,
+        "Number of threads used to gzip frames, defaults to the number of processors up to 4",
+        "--gzip_threads");
+
+    opt.add(
+        "",
+        0,
+        0,
+        0,
+        "Fetch the next stream in the background when a stream stops with an error",
+        "--prefetch");
+
+    opt.add(
+        "",
+        0,
+        1,
+        0,
+        "Directory to cache system and integrator files of recent targets in, and compiled kernels when supported",
+        "--cache_dir");
+
+    opt.add(
+        "",
+        0,
+        1,
+        0,
+        "Directory to spool frames and checkpoints to while the server is unreachable, so the simulation keeps running. Several cores may share it, but spooled uploads do not survive a restart",
+        "--spool_dir");
+
+    opt.add(
+        "1024",
+        0,
+        1,
+        0,
+        "Disk space in MB the spool may use, split between the streams",
+        "--spool_mb");
+
+    opt.add(
+        "1",
+        0,
+        1,
+        0,
+        "Number of streams to run concurrently on each device, to keep large GPUs busy with small systems",
+        "--streams_per_device");
+
+    opt.add(
+        "",
+        0,
+        1,
+        0,
+        "Only ask for targets of at most this many atoms, defaults to 25000 when running several streams per device",
+        "--max_atoms");
+
+    opt.add(
+        "",
+        0,
+        1,
+        0,
+        "File to append per stream timing histograms to as JSON lines, every progress interval",
+        "--metrics");
+
 #ifdef FAH_CORE
     opt.add(
         "",
@@ -270,7 +456,7 @@ int main(int argc, const char * argv[]) {
         0,
         1,
         0,
-        "Which OpenCL device to use",
+        "Which OpenCL device to use. A comma separated list runs one stream on each device",
         "--deviceId");
 
     opt.add(
@@ -280,13 +466,21 @@ int main(int argc, const char * argv[]) {
         0,
         "List all OpenCL platforms and devices",
         "--devices");
+
+    opt.add(
+        "",
+        0,
+        0,
+        0,
+        "Pick the fastest device and precision that pass the accuracy checks by benchmarking each, the choice is cached",
+        "--autotune");
 #elif OPENMM_CUDA
     opt.add(
         "",
         0,
         1,
         0,
-        "Which CUDA device to use",
+        "Which CUDA device to use. A comma separated list runs one stream on each device",
         "--deviceId");
 
     opt.add(
@@ -296,6 +490,14 @@ int main(int argc, const char * argv[]) {
         0,
         "List all CUDA devices",
         "--devices");
+
+    opt.add(
+        "",
+        0,
+        0,
+        0,
+        "Pick the fastest device and precision that pass the accuracy checks by benchmarking each, the choice is cached",
+        "--autotune");
 #endif 
 
     opt.parse(argc, argv);
@@ -331,6 +533,9 @@ int main(int argc, const char * argv[]) {
     }
 
     map<string, string> contextProperties;
+    // one worker is run per device, each running its own streams
+    vector<string> devices;
+    string device_property;
 
 #ifdef OPENMM_OPENCL
 #ifdef FAH_CORE
@@ -367,11 +572,8 @@ int main(int argc, const char * argv[]) {
     if(opt.isSet("--deviceId")) {
         string did;
         opt.get("--deviceId")->getString(did);
-        if(did.find(",") != string::npos) {
-            output << "Using multiple GPUs to run the same simulation is not currently supported" << endl;
-            return 1;
-        };
-        contextProperties["OpenCLDeviceIndex"] = did;
+        devices = split_devices(did);
+        device_property = "OpenCLDeviceIndex";
     }
 #endif 
 #elif OPENMM_CUDA
@@ -383,11 +585,8 @@ int main(int argc, const char * argv[]) {
     if(opt.isSet("--deviceId")) {
         string did;
         opt.get("--deviceId")->getString(did);
-        if(did.find(",") != string::npos) {
-            output << "Using multiple GPUs to run the same simulation is not currently supported" << endl;
-            return 1;
-        };
-        contextProperties["CudaDeviceIndex"] = did;
+        devices = split_devices(did);
+        device_property = "CudaDeviceIndex";
     }
 #endif
 
@@ -401,8 +600,24 @@ int main(int argc, const char * argv[]) {
     }
     string donor_token;
 
+    int gzip_threads = std::min(int(Poco::Environment::processorCount()), 4);
+    if(opt.isSet("--gzip_threads")) {
+        opt.get("--gzip_threads")->getInt(gzip_threads);
+        if(gzip_threads < 1) {
+            output << "gzip_threads must be greater than or equal to 1" << endl;
+            return 1;
+        }
+    }
+
     int progress_interval;
     opt.get("--progress")->getInt(progress_interval);
+
+    int upload_queue_size;
+    opt.get("--upload_queue")->getInt(upload_queue_size);
+    if(upload_queue_size < 0) {
+        output << "upload_queue must be greater than or equal to 0" << endl;
+        return 1;
+    }
  
     if(opt.isSet("--donor_token")) {
         opt.get("--donor_token")->getString(donor_token);
@@ -424,10 +639,98 @@ int main(int argc, const char * argv[]) {
         opt.get("--proxy")->getString(proxy_string);
     }
 
+    int streams_per_device;
+    opt.get("--streams_per_device")->getInt(streams_per_device);
+    if(streams_per_device < 1) {
+        output << "streams_per_device must be greater than or equal to 1" << endl;
+        return 1;
+    }
+#ifdef FAH_CORE
+    if(streams_per_device > 1) {
+        output << "streams_per_device is not supported by FAHClient" << endl;
+        return 1;
+    }
+#endif
+    int max_atoms = streams_per_device > 1 ? 25000 : 0;
+    if(opt.isSet("--max_atoms")) {
+        opt.get("--max_atoms")->getInt(max_atoms);
+    }
+
+
+    FileCache *file_cache = NULL;
+    string autotune_file("autotune.json");
+    if(opt.isSet("--cache_dir")) {
+        string cache_dir;
+        opt.get("--cache_dir")->getString(cache_dir);
+        Poco::Path cache_path = Poco::Path(cache_dir).makeDirectory();
+        Poco::File(cache_path.toString()).createDirectories();
+        autotune_file = Poco::Path(cache_path, "autotune.json").toString();
+        file_cache = new FileCache(Poco::Path(cache_path, "targets").toString());
+        file_cache->addCacheableFile("system.xml");
+        file_cache->addCacheableFile("integrator.xml");
+#ifdef OPENMM_CUDA
+        // the CUDA platform reuses modules it finds compiled in its temp dir
+        if(contextProperties.find("CudaTempDirectory") == contextProperties.end()) {
+            string kernel_dir = Poco::Path(cache_path, "kernels").makeDirectory().toString();
+            Poco::File(kernel_dir).createDirectories();
+            contextProperties["CudaTempDirectory"] = kernel_dir;
+        }
+#endif
+    }
+
+    string spool_dir;
+    int spool_mb;
+    opt.get("--spool_mb")->getInt(spool_mb);
+    if(opt.isSet("--spool_dir")) {
+        if(upload_queue_size == 0) {
+            output << "spool_dir needs an upload_queue greater than 0" << endl;
+            return 1;
+        }
+        if(spool_mb < 1) {
+            output << "spool_mb must be greater than or equal to 1" << endl;
+            return 1;
+        }
+        string spool_root;
+        opt.get("--spool_dir")->getString(spool_root);
+        spool_dir = prepareSpoolDir(spool_root);
+    }
 
     ExitSignal::init();
     OpenMMCore::registerComponents();
 
+#if defined(OPENMM_OPENCL) || defined(OPENMM_CUDA)
+    if(opt.isSet("--autotune")) {
+        try {
+#ifdef OPENMM_OPENCL
+            vector<Util::Device> visible = Util::openCLDevices();
+            string precision_property("OpenCLPrecision");
+#else
+            vector<Util::Device> visible = Util::cudaDevices();
+            string precision_property("CudaPrecision");
+#endif
+            map<string, string> fixed(contextProperties);
+            fixed.erase(precision_property);
+            vector<AutoTune::Candidate> candidates = tuning_candidates(visible,
+                fixed, devices, device_property, precision_property);
+            if(candidates.empty()) {
+                output << "autotune: no device to benchmark" << endl;
+                return 1;
+            }
+            AutoTune::Candidate choice = AutoTune::select(OpenMMCore::platformName(),
+                candidates, autotune_file, output);
+            // the choice of device is only taken when none was given
+            for(map<string, string>::const_iterator it = choice.properties.begin();
+                it != choice.properties.end(); it++) {
+                if(it->first != device_property)
+                    contextProperties[it->first] = it->second;
+            }
+        } catch(const std::exception &e) {
+            output << e.what() << endl;
+            return 1;
+        }
+    }
+#endif
+
 #ifdef FAH_CORE
     if(opt.isSet("-lifeline")) {
         int lifeline;
@@ -436,39 +739,105 @@ int main(int argc, const char * argv[]) {
     }
 #endif
 
-    int delay_in_sec = 1;
-    time_t next_sleep_time = time(NULL);
+    ofstream metrics_log;
+    if(opt.isSet("--metrics")) {
+        string metrics_path;
+        opt.get("--metrics")->getString(metrics_path);
+        metrics_log.open(metrics_path.c_str(), std::ios::app);
+        if(!metrics_log) {
+            output << "Cannot open " << metrics_path << endl;
+            return 1;
+        }
+    }
 
-    while(!ExitSignal::shouldExit()) {
-        try {
-            OpenMMCore core(ENGINE_KEY,
-                            contextProperties
+    WorkerSettings settings;
+    settings.core_key = ENGINE_KEY;
+    settings.cc_uri = cc_uri;
+    settings.donor_token = donor_token;
+    settings.target_id = target_id;
+    settings.proxy_string = proxy_string;
+    settings.checkpoint_frequency = checkpoint_frequency;
+    settings.progress_interval = progress_interval;
+    settings.upload_queue_size = upload_queue_size;
+    settings.gzip_threads = gzip_threads;
+    settings.max_atoms = max_atoms;
+    settings.prefetch = opt.isSet("--prefetch");
+    settings.file_cache = file_cache;
+    settings.metrics_log = metrics_log.is_open() ? &metrics_log : NULL;
 #ifdef FAH_CORE
-                            ,
-                            logfile
+    settings.wu_dir = wu_dir;
 #endif
-                            );
-#ifdef FAH_CORE
-            core.wu_dir = wu_dir;
-#endif
-            output << "setting checkpoint interval to " << checkpoint_frequency << " seconds" << endl;
-            core.setCheckpointSendInterval(checkpoint_frequency);
-            core.setProgressUpdateInterval(progress_interval);
-            output << "sleeping for " << delay_in_sec << " seconds" << endl;
-            next_sleep_time = time(NULL) + delay_in_sec;
-            while(time(NULL) < next_sleep_time) {
-                if(ExitSignal::shouldExit()) {
-                    exit(0);
+
+    // without --deviceId the platform picks the device
+    if(devices.empty())
+        devices.push_back("");
+
+    settings.spool_dir = spool_dir;
+    settings.spool_bytes = size_t(spool_mb)*1024*1024/(devices.size()*streams_per_device);
+
+    if(devices.size() == 1 && streams_per_device == 1) {
+        if(!device_property.empty())
+            contextProperties[device_property] = devices[0];
+        CoreWorker worker(settings, contextProperties, output);
+        worker.run();
+    } else {
+        vector<PrefixedLog*> logs;
+        vector<CoreWorker*> workers;
+        vector<Poco::Thread*> threads;
+        for(unsigned i=0; i < devices.size(); i++) {
+            map<string, string> properties(contextProperties);
+            if(!device_property.empty())
+                properties[device_property] = devices[i];
+            for(int j=0; j < streams_per_device; j++) {
+                stringstream prefix;
+                prefix << "[device " << (devices[i].empty() ? "default" : devices[i]);
+                if(streams_per_device > 1)
+                    prefix << " stream " << j;
+                prefix << "] ";
+                logs.push_back(new PrefixedLog(output, prefix.str()));
+                workers.push_back(new CoreWorker(settings, properties, *logs.back()));
+                threads.push_back(new Poco::Thread);
+                threads.back()->start(*workers.back());
+            }
+        }
+        // report the throughput of each device and of the process until
+        // every worker has exited, streams report their own. The report
+        // shares the workers' lock on output, so lines never interleave.
+        PrefixedLog report(output, "");
+        time_t next_report = time(NULL) + progress_interval;
+        vector<bool> exited(threads.size(), false);
+        unsigned running = threads.size();
+        while(running > 0) {
+            // a thread is joined once, and the second is shared out among
+            // the threads that are still running
+            long wait_ms = 1000/running;
+            for(unsigned i=0; i < threads.size(); i++) {
+                if(!exited[i] && threads[i]->tryJoin(wait_ms)) {
+                    exited[i] = true;
+                    running--;
                 }
             }
-            delay_in_sec = min(delay_in_sec * 5, 300);
-            core.startStream(cc_uri, donor_token, target_id, proxy_string);
-            delay_in_sec = 1;
-            core.main();
-        } catch(const exception &e) {
-            output << e.what() << endl;
+            if(running > 0 && time(NULL) >= next_report) {
+                float total = 0;
+                for(unsigned i=0; i < devices.size(); i++) {
+                    float device_total = 0;
+                    for(int j=0; j < streams_per_device; j++)
+                        device_total += workers[i*streams_per_device+j]->nsPerDay();
+                    if(devices.size() > 1 && streams_per_device > 1)
+                        report << "device " << devices[i] << " ns/day: " << device_total << endl;
+                    total += device_total;
+                }
+                report << "total ns/day across " << workers.size() << " streams: " << total << endl;
+                next_report = time(NULL) + progress_interval;
+            }
+        }
+        for(unsigned i=0; i < workers.size(); i++) {
+            delete threads[i];
+            delete workers[i];
+            delete logs[i];
         }
     }
 
-     return 0;
+    delete file_cache;
+    return 0;
 }
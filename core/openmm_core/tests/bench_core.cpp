@@ -0,0 +1,226 @@
+#include <OpenMM.h>
+#include <Poco/Clock.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "XTCWriter.h"
+#include "XTCReader.h"
+#include "StateTests.h"
+#include "PayloadEncoder.h"
+#include "md5.h"
+#include "picojson.h"
+
+using namespace std;
+
+// Microbenchmarks for the per frame work of the core. Usage:
+//
+//     bench_core [n_atoms ...] > results.json
+//
+// Defaults to 1000 10000 100000 1000000 atoms. Inputs are generated from a
+// fixed seed, so results are comparable between core versions. Each
+// benchmark is repeated for at least MIN_SECONDS and MIN_ITERATIONS.
+
+static const double MIN_SECONDS = 0.5;
+static const int MIN_ITERATIONS = 3;
+
+// Runs the work of one iteration
+class Benchmark {
+public:
+    virtual ~Benchmark() {}
+    virtual void run() = 0;
+};
+
+static picojson::value measure(const string &name, int n_atoms,
+                               size_t bytes, Benchmark &benchmark) {
+    cerr << name << " " << n_atoms << " atoms... " << flush;
+    benchmark.run();
+    int iterations = 0;
+    double total = 0;
+    double best = 0;
+    Poco::Clock start;
+    while(iterations < MIN_ITERATIONS || start.elapsed()/1e6 < MIN_SECONDS) {
+        Poco::Clock iteration_start;
+        benchmark.run();
+        double seconds = iteration_start.elapsed()/1e6;
+        if(iterations == 0 || seconds < best)
+            best = seconds;
+        total += seconds;
+        iterations++;
+    }
+    double mean = total/iterations;
+    cerr << mean*1e3 << " ms" << endl;
+    picojson::object result;
+    result["name"] = picojson::value(name);
+    result["atoms"] = picojson::value(double(n_atoms));
+    result["iterations"] = picojson::value(double(iterations));
+    result["mean_ms"] = picojson::value(mean*1e3);
+    result["min_ms"] = picojson::value(best*1e3);
+    result["ns_per_atom"] = picojson::value(mean*1e9/n_atoms);
+    if(bytes > 0) {
+        result["bytes"] = picojson::value(double(bytes));
+        result["mb_per_s"] = picojson::value(bytes/mean/1e6);
+    }
+    return picojson::value(result);
+}
+
+class XTCAppend : public Benchmark {
+public:
+    XTCAppend(const vector<float> &positions) :
+        positions_(positions), writer_(output_) {
+        for(int i=0; i < 9; i++)
+            box_[i] = (i % 4 == 0) ? 10 : 0;
+    }
+    void run() {
+        output_.str("");
+        writer_.append(0, 0, box_, &positions_[0], positions_.size()/3);
+    }
+    string frame() const { return output_.str(); }
+private:
+    const vector<float> &positions_;
+    stringstream output_;
+    XTCWriter writer_;
+    float box_[9];
+};
+
+// decodes the frame and checks it against what was written, so the
+// benchmark doubles as a round trip test of XTCWriter and XTCReader
+class XTCRead : public Benchmark {
+public:
+    XTCRead(const string &frame, const vector<float> &positions) :
+        positions_(positions), reader_(frame.data(), frame.size()) {}
+    void run() {
+        float box[9];
+        reader_.read(0, box, decoded_);
+        if(decoded_.size() != positions_.size())
+            throw std::runtime_error("xtc_read: bad atom count");
+        // the writer rounds to 1/1000 nm
+        for(size_t i=0; i < decoded_.size(); i++)
+            if(fabs(decoded_[i]-positions_[i]) > 0.0006)
+                throw std::runtime_error("xtc_read: positions differ from the written ones");
+    }
+private:
+    const vector<float> &positions_;
+    XTCReader reader_;
+    vector<float> decoded_;
+};
+
+class Base64 : public Benchmark {
+public:
+    Base64(const string &data, bool gzip) : data_(data), gzip_(gzip) {}
+    void run() {
+        PayloadEncoder encoder(gzip_ ? 0 : PayloadEncoder::encodedSize("", data_.size()));
+        encoder.appendBase64(data_, gzip_);
+        string body, md5;
+        encoder.finish(body, md5);
+    }
+private:
+    const string &data_;
+    bool gzip_;
+};
+
+class MD5 : public Benchmark {
+public:
+    MD5(const string &data) : data_(data) {}
+    void run() {
+        md5_state_s state;
+        md5_init(&state);
+        md5_append(&state, reinterpret_cast<const unsigned char *>(data_.data()), data_.size());
+        unsigned char digest[16];
+        md5_finish(&state, digest);
+    }
+private:
+    const string &data_;
+};
+
+// the body Core::sendFrame() builds for a single frame
+class FrameMessage : public Benchmark {
+public:
+    FrameMessage(const string &frame) : frame_(frame) {}
+    void run() {
+        PayloadEncoder encoder(PayloadEncoder::encodedSize("frames.xtc", frame_.size()));
+        encoder.append("{\"frames\":1,\"files\":{");
+        encoder.appendFile("frames.xtc", frame_, false);
+        encoder.append("}}");
+        string body, md5;
+        encoder.finish(body, md5);
+    }
+private:
+    const string &frame_;
+};
+
+class CheckState : public Benchmark {
+public:
+    CheckState(const OpenMM::State &state) : state_(state) {}
+    void run() {
+        StateTests::checkState(state_, &state_);
+    }
+private:
+    const OpenMM::State &state_;
+};
+
+static void bench_atoms(int n_atoms, picojson::array &results) {
+    srand(2014);
+    vector<float> positions(3*n_atoms);
+    vector<OpenMM::Vec3> positions_nm(n_atoms);
+    vector<OpenMM::Vec3> velocities(n_atoms);
+    OpenMM::System system;
+    for(int i=0; i < n_atoms; i++) {
+        system.addParticle(1.0);
+        for(int j=0; j < 3; j++) {
+            positions[3*i+j] = 10.0f*rand()/RAND_MAX;
+            positions_nm[i][j] = positions[3*i+j];
+            velocities[i][j] = 2.0*rand()/RAND_MAX-1.0;
+        }
+    }
+
+    XTCAppend xtc(positions);
+    results.push_back(measure("xtc_append", n_atoms, 0, xtc));
+    string frame = xtc.frame();
+    XTCRead xtc_read(frame, positions);
+    results.push_back(measure("xtc_read", n_atoms, frame.size(), xtc_read));
+
+    Base64 b64(frame, false);
+    results.push_back(measure("b64", n_atoms, frame.size(), b64));
+    Base64 gz_b64(frame, true);
+    results.push_back(measure("gz_b64", n_atoms, frame.size(), gz_b64));
+    MD5 md5(frame);
+    results.push_back(measure("md5", n_atoms, frame.size(), md5));
+    FrameMessage message(frame);
+    results.push_back(measure("frame_message", n_atoms, frame.size(), message));
+
+    OpenMM::VerletIntegrator integrator(0.002);
+    OpenMM::Context context(system, integrator,
+        OpenMM::Platform::getPlatformByName("Reference"));
+    context.setPositions(positions_nm);
+    context.setVelocities(velocities);
+    OpenMM::State state = context.getState(OpenMM::State::Positions |
+        OpenMM::State::Velocities | OpenMM::State::Forces | OpenMM::State::Energy);
+    CheckState check(state);
+    results.push_back(measure("check_state", n_atoms, 0, check));
+}
+
+int main(int argc, char *argv[]) {
+    vector<int> atom_counts;
+    for(int i=1; i < argc; i++)
+        atom_counts.push_back(atoi(argv[i]));
+    if(atom_counts.empty()) {
+        atom_counts.push_back(1000);
+        atom_counts.push_back(10000);
+        atom_counts.push_back(100000);
+        atom_counts.push_back(1000000);
+    }
+    picojson::array results;
+    for(unsigned i=0; i < atom_counts.size(); i++)
+        bench_atoms(atom_counts[i], results);
+    picojson::object report;
+    report["core_version"] = picojson::value(double(CORE_VERSION));
+    report["benchmarks"] = picojson::value(results);
+    cout << picojson::value(report).serialize() << endl;
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include <OpenMM.h>
+#include <Poco/Clock.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "OpenMMCore.h"
+#include "CoreWorker.h"
+#include "ExitSignal.h"
+#include "PayloadEncoder.h"
+#include "MockServer.h"
+#include "picojson.h"
+
+using namespace std;
+
+// End to end throughput of a core streaming to an in-process MockServer.
+// Usage:
+//
+//     bench_stream [key=value ...] > results.json
+//
+// atoms, seconds, steps_per_frame, frames_per_upload, upload_queue,
+// prefetch (0/1), latency_ms, bandwidth_kbps, failure_rate and
+// frames_per_stream can be set; see defaults below. The report gives frames
+// per hour, the share of the run the MD loop spent blocked on uploads and
+// the time taken to switch streams after one is stopped.
+
+static map<string, double> parse_args(int argc, char *argv[]) {
+    map<string, double> args;
+    args["atoms"] = 4000;
+    args["seconds"] = 120;
+    args["steps_per_frame"] = 500;
+    args["frames_per_upload"] = 1;
+    args["upload_queue"] = 4;
+    args["prefetch"] = 0;
+    args["latency_ms"] = 50;
+    args["bandwidth_kbps"] = 10000;
+    args["failure_rate"] = 0;
+    args["frames_per_stream"] = 0;
+    for(int i=1; i < argc; i++) {
+        string arg(argv[i]);
+        size_t equals = arg.find('=');
+        if(equals == string::npos || args.find(arg.substr(0, equals)) == args.end())
+            throw std::runtime_error("unknown argument "+arg);
+        args[arg.substr(0, equals)] = atof(arg.substr(equals+1).c_str());
+    }
+    return args;
+}
+
+// a periodic box of argon atoms on a cubic lattice
+static string make_files(int n_atoms) {
+    int per_side = static_cast<int>(ceil(pow(n_atoms, 1.0/3.0)));
+    double spacing = 0.4;
+    double side = per_side*spacing;
+    OpenMM::System system;
+    OpenMM::NonbondedForce *nonbonded = new OpenMM::NonbondedForce;
+    nonbonded->setNonbondedMethod(OpenMM::NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    vector<OpenMM::Vec3> positions;
+    for(int i=0; i < n_atoms; i++) {
+        system.addParticle(39.9);
+        nonbonded->addParticle(0, 0.34, 0.996);
+        positions.push_back(OpenMM::Vec3(spacing*(i % per_side),
+            spacing*(i/per_side % per_side),
+            spacing*(i/per_side/per_side)));
+    }
+    system.addForce(nonbonded);
+    system.setDefaultPeriodicBoxVectors(OpenMM::Vec3(side, 0, 0),
+        OpenMM::Vec3(0, side, 0), OpenMM::Vec3(0, 0, side));
+    OpenMM::LangevinIntegrator integrator(120, 1, 0.002);
+    OpenMM::Context context(system, integrator,
+        OpenMM::Platform::getPlatformByName("Reference"));
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(120);
+    OpenMM::State state = context.getState(OpenMM::State::Positions |
+        OpenMM::State::Velocities | OpenMM::State::Parameters |
+        OpenMM::State::Energy | OpenMM::State::Forces);
+
+    stringstream system_xml, integrator_xml, state_xml;
+    OpenMM::XmlSerializer::serialize<OpenMM::System>(&system, "System", system_xml);
+    OpenMM::XmlSerializer::serialize<OpenMM::Integrator>(&integrator, "Integrator", integrator_xml);
+    OpenMM::XmlSerializer::serialize<OpenMM::State>(&state, "State", state_xml);
+    PayloadEncoder encoder;
+    encoder.append("{");
+    encoder.appendFile("system.xml", system_xml.str(), true);
+    encoder.append(",");
+    encoder.appendFile("integrator.xml", integrator_xml.str(), true);
+    encoder.append(",");
+    encoder.appendFile("state.xml", state_xml.str(), true);
+    encoder.append("}");
+    string files, md5;
+    encoder.finish(files, md5);
+    return files;
+}
+
+// sum of a phase over the last metrics line of each stream
+static double phase_seconds(const string &metrics, const string &phase) {
+    map<string, double> per_stream;
+    istringstream lines(metrics);
+    string line;
+    while(getline(lines, line)) {
+        picojson::value value;
+        istringstream input(line);
+        if(!picojson::parse(value, input).empty() || !value.is<picojson::object>())
+            continue;
+        const picojson::value &phases = value.get("phases");
+        if(phases.get(phase).is<picojson::object>()) {
+            per_stream[value.get("stream_id").to_str()] =
+                phases.get(phase).get("total_s").get<double>();
+        }
+    }
+    double total = 0;
+    for(map<string, double>::const_iterator it = per_stream.begin();
+        it != per_stream.end(); it++)
+        total += it->second;
+    return total;
+}
+
+int main(int argc, char *argv[]) {
+    map<string, double> args = parse_args(argc, argv);
+    OpenMMCore::registerComponents();
+
+    MockConfig config;
+    config.latency_ms = static_cast<int>(args["latency_ms"]);
+    config.bandwidth_kbps = args["bandwidth_kbps"];
+    config.failure_rate = args["failure_rate"];
+    config.frames_per_stream = static_cast<int>(args["frames_per_stream"]);
+    cerr << "building a system of " << args["atoms"] << " atoms..." << endl;
+    config.files = make_files(static_cast<int>(args["atoms"]));
+    picojson::object options;
+    options["steps_per_frame"] = picojson::value(args["steps_per_frame"]);
+    options["frames_per_upload"] = picojson::value(args["frames_per_upload"]);
+    config.options = picojson::value(options).serialize();
+    MockServer server(config, MOCK_CERT_DIR "private.pem", MOCK_CERT_DIR "public.crt");
+
+    stringstream metrics_log;
+    WorkerSettings settings;
+    settings.core_key = "mock_key";
+    settings.cc_uri = server.uri();
+    settings.progress_interval = 1;
+    settings.upload_queue_size = static_cast<int>(args["upload_queue"]);
+    settings.prefetch = args["prefetch"] != 0;
+    settings.metrics_log = &metrics_log;
+    CoreWorker worker(settings, map<string, string>(), cerr);
+
+    ExitSignal::init();
+    ExitSignal::setExitTime(static_cast<int>(args["seconds"]));
+    Poco::Clock start;
+    worker.run();
+    double seconds = start.elapsed()/1e6;
+
+    MockStats stats = server.stats();
+    double blocked = phase_seconds(metrics_log.str(), "blocked");
+    double switch_total = 0, switch_max = 0;
+    for(unsigned i=0; i < stats.switch_seconds.size(); i++) {
+        switch_total += stats.switch_seconds[i];
+        switch_max = max(switch_max, stats.switch_seconds[i]);
+    }
+    picojson::object report;
+    picojson::object settings_json;
+    for(map<string, double>::const_iterator it = args.begin(); it != args.end(); it++)
+        settings_json[it->first] = picojson::value(it->second);
+    report["settings"] = picojson::value(settings_json);
+    report["seconds"] = picojson::value(seconds);
+    report["frames"] = picojson::value(double(stats.frames));
+    report["frames_per_hour"] = picojson::value(stats.frames*3600/seconds);
+    report["blocked_s"] = picojson::value(blocked);
+    report["blocked_fraction"] = picojson::value(blocked/seconds);
+    report["streams"] = picojson::value(double(stats.starts));
+    report["error_stops"] = picojson::value(double(stats.error_stops));
+    report["injected_failures"] = picojson::value(double(stats.injected_failures));
+    report["md5_mismatches"] = picojson::value(double(stats.md5_mismatches));
+    report["bytes_received"] = picojson::value(double(stats.bytes_received));
+    report["switches"] = picojson::value(double(stats.switch_seconds.size()));
+    if(!stats.switch_seconds.empty()) {
+        report["switch_mean_s"] = picojson::value(switch_total/stats.switch_seconds.size());
+        report["switch_max_s"] = picojson::value(switch_max);
+    }
+    cout << picojson::value(report).serialize() << endl;
+    return 0;
+}
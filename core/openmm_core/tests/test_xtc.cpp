@@ -12,8 +12,10 @@ int main() {
 
 
 	stringstream output;
+	stringstream flat_output;
 
 	XTCWriter writer(output);
+	XTCWriter flat_writer(flat_output);
 
 	vector<vector<float> > box(3, vector<float>(3));
 	box[0][0] = 1.0; box[0][1] = 0.0; box[0][2] = 0.0;
@@ -32,6 +34,18 @@ int main() {
 			positions.push_back(coord);
 		}
 		writer.append(i, (float)i/10.0, box, positions);	
+		vector<float> flat_box(9);
+		vector<float> flat_positions(3*natoms);
+		for(int j=0; j < 9; j++)
+			flat_box[j] = box[j/3][j%3];
+		for(int j=0; j < 3*natoms; j++)
+			flat_positions[j] = positions[j/3][j%3];
+		flat_writer.append(i, (float)i/10.0, &flat_box[0], &flat_positions[0], natoms);
+	}
+
+	if(output.str() != flat_output.str()) {
+		cout << "flat and nested appends differ" << endl;
+		return 1;
 	}
 
 	ofstream foutput("test.txt", std::ofstream::binary);
@@ -0,0 +1,243 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#include <Poco/Thread.h>
+#include <Poco/Net/Context.h>
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/SecureServerSocket.h>
+
+#include <cstdio>
+#include <iterator>
+#include <sstream>
+
+#include "MockServer.h"
+#include "md5.h"
+#include "picojson.h"
+
+using namespace std;
+
+static string compute_md5(const string &data) {
+    md5_state_s state;
+    md5_init(&state);
+    md5_append(&state, reinterpret_cast<const unsigned char *>(data.data()), data.size());
+    unsigned char digest[16];
+    md5_finish(&state, digest);
+    char converted[16*2+1];
+    for(int i=0; i < 16; i++)
+        sprintf(&converted[i*2], "%02x", digest[i]);
+    return string(converted, 32);
+}
+
+class MockHandler : public Poco::Net::HTTPRequestHandler {
+public:
+    MockHandler(MockServer &server) : server_(server) {}
+    void handleRequest(Poco::Net::HTTPServerRequest &request,
+                       Poco::Net::HTTPServerResponse &response) {
+        server_.handle(request, response);
+    }
+private:
+    MockServer &server_;
+};
+
+class MockHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
+public:
+    MockHandlerFactory(MockServer &server) : server_(server) {}
+    Poco::Net::HTTPRequestHandler* createRequestHandler(
+        const Poco::Net::HTTPServerRequest &) {
+        return new MockHandler(server_);
+    }
+private:
+    MockServer &server_;
+};
+
+MockConfig::MockConfig() :
+    latency_ms(0),
+    bandwidth_kbps(0),
+    failure_rate(0),
+    frames_per_stream(0),
+    files("{}"),
+    options("{}") {
+
+}
+
+MockStats::MockStats() :
+    assigns(0),
+    starts(0),
+    frame_requests(0),
+    frames(0),
+    checkpoints(0),
+    heartbeats(0),
+    stops(0),
+    error_stops(0),
+    injected_failures(0),
+    md5_mismatches(0),
+    bytes_received(0) {
+
+}
+
+MockServer::Stream::Stream() :
+    started(false),
+    frames(0) {
+
+}
+
+MockServer::MockServer(const MockConfig &config,
+                       const string &private_key_file,
+                       const string &certificate_file,
+                       int port) :
+    config_(config),
+    server_(NULL),
+    next_stream_(0),
+    seed_(2014),
+    switching_(false) {
+    Poco::Net::Context::Ptr context = new Poco::Net::Context(
+        Poco::Net::Context::SERVER_USE, private_key_file, certificate_file,
+        "", Poco::Net::Context::VERIFY_NONE);
+    Poco::Net::SecureServerSocket socket(port, 64, context);
+    Poco::Net::HTTPServerParams::Ptr params = new Poco::Net::HTTPServerParams;
+    params->setKeepAlive(true);
+    server_ = new Poco::Net::HTTPServer(new MockHandlerFactory(*this), socket, params);
+    server_->start();
+}
+
+MockServer::~MockServer() {
+    server_->stop();
+    delete server_;
+}
+
+string MockServer::uri() const {
+    stringstream ss;
+    ss << "127.0.0.1:" << server_->port();
+    return ss.str();
+}
+
+MockStats MockServer::stats() const {
+    Poco::Mutex::ScopedLock lock(mutex_);
+    return stats_;
+}
+
+void MockServer::delay(size_t bytes) const {
+    long ms = config_.latency_ms;
+    if(config_.bandwidth_kbps > 0)
+        ms += static_cast<long>(bytes*8/config_.bandwidth_kbps);
+    if(ms > 0)
+        Poco::Thread::sleep(ms);
+}
+
+bool MockServer::injectFailure() {
+    if(config_.failure_rate <= 0)
+        return false;
+    // a fixed generator, so runs with the same settings fail alike
+    seed_ = seed_*1103515245+12345;
+    double x = ((seed_ >> 16) & 0x7fff)/32768.0;
+    if(x >= config_.failure_rate)
+        return false;
+    stats_.injected_failures++;
+    return true;
+}
+
+void MockServer::handle(Poco::Net::HTTPServerRequest &request,
+                        Poco::Net::HTTPServerResponse &response) {
+    string body((istreambuf_iterator<char>(request.stream())),
+                istreambuf_iterator<char>());
+    delay(body.size());
+    const string &path = request.getURI();
+    string token = request.get("Authorization", "");
+    int status = 200;
+    string reply;
+    bool reply_md5 = false;
+    {
+        Poco::Mutex::ScopedLock lock(mutex_);
+        stats_.bytes_received += body.size();
+        map<string, Stream>::iterator it = streams_.find(token);
+        if(request.has("Content-MD5") &&
+           request.get("Content-MD5") != compute_md5(body)) {
+            stats_.md5_mismatches++;
+            status = 400;
+        } else if(path == "/core/assign") {
+            stats_.assigns++;
+            stringstream id;
+            id << next_stream_++;
+            Stream stream;
+            stream.id = "stream-"+id.str();
+            streams_["token-"+id.str()] = stream;
+            picojson::object obj;
+            obj["token"] = picojson::value("token-"+id.str());
+            obj["url"] = picojson::value("https://"+uri()+"/core/start");
+            reply = picojson::value(obj).serialize();
+        } else if(it == streams_.end()) {
+            status = 400;
+        } else if(path == "/core/start") {
+            stats_.starts++;
+            it->second.started = true;
+            reply = "{\"stream_id\":\""+it->second.id+"\","
+                    "\"target_id\":\"mock-target\","
+                    "\"files\":"+config_.files+","
+                    "\"options\":"+config_.options+"}";
+            reply_md5 = true;
+        } else if(path == "/core/frame") {
+            stats_.frame_requests++;
+            picojson::value value;
+            istringstream input(body);
+            if(config_.frames_per_stream > 0 &&
+               it->second.frames >= config_.frames_per_stream) {
+                status = 400;
+            } else if(injectFailure()) {
+                status = 400;
+            } else if(!picojson::parse(value, input).empty() ||
+                      !value.is<picojson::object>() ||
+                      !value.get("frames").is<double>()) {
+                status = 400;
+            } else {
+                int frames = static_cast<int>(value.get("frames").get<double>());
+                it->second.frames += frames;
+                stats_.frames += frames;
+                if(switching_) {
+                    stats_.switch_seconds.push_back(last_stop_.elapsed()/1e6);
+                    switching_ = false;
+                }
+            }
+        } else if(path == "/core/checkpoint") {
+            if(injectFailure())
+                status = 400;
+            else
+                stats_.checkpoints++;
+        } else if(path == "/core/heartbeat") {
+            if(injectFailure())
+                status = 400;
+            else
+                stats_.heartbeats++;
+        } else if(path == "/core/stop") {
+            stats_.stops++;
+            if(body.find("\"error\"") != string::npos)
+                stats_.error_stops++;
+            streams_.erase(it);
+            last_stop_.update();
+            switching_ = true;
+        } else {
+            status = 404;
+        }
+    }
+    delay(reply.size());
+    response.setStatus(Poco::Net::HTTPResponse::HTTPStatus(status));
+    if(reply_md5)
+        response.set("Content-MD5", compute_md5(reply));
+    response.setContentLength(reply.size());
+    response.send() << reply;
+}
@@ -0,0 +1,120 @@
+// Authors: Yutong Zhao <proteneer@gmail.com>
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may
+// not use this file except in compliance with the License. You may obtain
+// a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations
+// under the License.
+
+
+#ifndef MOCK_SERVER_H_
+#define MOCK_SERVER_H_
+
+#include <Poco/Mutex.h>
+#include <Poco/Timestamp.h>
+#include <Poco/Net/HTTPServer.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/* How the mock behaves. Delays apply to every request. */
+struct MockConfig {
+    MockConfig();
+
+    // added before every reply
+    int latency_ms;
+    // throughput of the simulated link in both directions, 0 for unlimited
+    double bandwidth_kbps;
+    // fraction of frame, checkpoint and heartbeat requests answered with a
+    // 400, drawn from a fixed seed
+    double failure_rate;
+    // frames after which a stream's next frame is refused, forcing the
+    // core to switch streams. 0 never refuses.
+    int frames_per_stream;
+    // JSON object served as "files" and "options" by /core/start
+    std::string files;
+    std::string options;
+};
+
+/* What the mock has seen so far */
+struct MockStats {
+    MockStats();
+
+    int assigns;
+    int starts;
+    int frame_requests;
+    int frames;
+    int checkpoints;
+    int heartbeats;
+    int stops;
+    int error_stops;
+    int injected_failures;
+    int md5_mismatches;
+    long long bytes_received;
+    // from each /core/stop to the first frame of the next stream
+    std::vector<double> switch_seconds;
+};
+
+/**
+ * An in-process stand-in for both the CC and an SCV, serving /core/assign,
+ * /core/start, /core/frame, /core/checkpoint, /core/heartbeat and
+ * /core/stop over HTTPS on 127.0.0.1, so a Core can be driven end to end
+ * without a backend. Every assignment creates a new stream of the same
+ * target. Content-MD5 headers of uploads are verified.
+ */
+class MockServer {
+public:
+    /* Listen on port, or any free port if 0, with the given key pair */
+    MockServer(const MockConfig &config,
+               const std::string &private_key_file,
+               const std::string &certificate_file,
+               int port = 0);
+
+    ~MockServer();
+
+    /* The address to pass as the cc_uri of a core */
+    std::string uri() const;
+
+    MockStats stats() const;
+
+    /* Handle one request, called from the server's threads */
+    void handle(Poco::Net::HTTPServerRequest &request,
+                Poco::Net::HTTPServerResponse &response);
+
+private:
+    MockServer(const MockServer &);
+    MockServer &operator=(const MockServer &);
+
+    struct Stream {
+        Stream();
+        std::string id;
+        bool started;
+        int frames;
+    };
+
+    /* Sleep for the latency plus the time bytes take over the link */
+    void delay(size_t bytes) const;
+
+    /* Whether to fail this request, mutex must be held */
+    bool injectFailure();
+
+    MockConfig config_;
+    Poco::Net::HTTPServer *server_;
+
+    mutable Poco::Mutex mutex_;
+    MockStats stats_;
+    std::map<std::string, Stream> streams_;
+    int next_stream_;
+    unsigned int seed_;
+    bool switching_;
+    Poco::Timestamp last_stop_;
+};
+
+#endif
@@ -21,6 +21,7 @@
 #include <sstream>
 #include <fstream>
 
+#include <Poco/File.h>
 #include <Poco/Net/Context.h>
 #include <Poco/Net/HTTPRequest.h>
 #include <Poco/Net/HTTPResponse.h>
@@ -33,6 +34,15 @@
 #define protected public
 
 #include <Core.h>
+#include <PayloadEncoder.h>
+#include <Metrics.h>
+#include <UploadSpool.h>
+#include <StreamOptions.h>
+#include <Gzip.h>
+#include <StartReply.h>
+#include <FileCache.h>
+#include <FrameAtoms.h>
+#include <StepScheduler.h>
 
 using namespace std;
 
@@ -122,7 +132,230 @@ void testStartStream(string donor_token="", string target_id="") {
     core.stopStream();
 }
 
+void testPayloadEncoder() {
+    PayloadEncoder encoder;
+    encoder.append("{\"files\":{");
+    encoder.appendFile("a.txt", "hello world", false);
+    encoder.append("},\"error\": ");
+    encoder.appendBase64("oops");
+    encoder.append("}");
+    string body, md5;
+    encoder.finish(body, md5);
+    if(body != "{\"files\":{\"a.txt.b64\":\"aGVsbG8gd29ybGQ=\"},\"error\": \"b29wcw==\"}")
+        throw std::runtime_error("testPayloadEncoder: bad body "+body);
+    if(md5 != "c71b73128ac9d8119e84e77234d42113")
+        throw std::runtime_error("testPayloadEncoder: bad md5 "+md5);
+    PayloadEncoder binary;
+    binary.appendBinary("{}");
+    binary.appendPart("a.bin", string("\0\1", 2), false);
+    binary.finish(body, md5);
+    if(body != string("\0\0\0\2{}\0\0\0\5a.bin\0\0\0\2\0\1", 21))
+        throw std::runtime_error("testPayloadEncoder: bad binary body");
+}
+
+void testMetrics() {
+    Metrics metrics;
+    for(int i=0; i < 98; i++)
+        metrics.record("step", 1000);
+    metrics.record("step", 3000);
+    metrics.record("step", 100000);
+    picojson::object summary = metrics.summary();
+    picojson::object &step = summary["step"].get<picojson::object>();
+    if(step["count"].get<double>() != 100)
+        throw std::runtime_error("testMetrics: bad count");
+    if(step["max_ms"].get<double>() != 100)
+        throw std::runtime_error("testMetrics: bad max");
+    // 1000us falls in [512, 1024), 3000us in [2048, 4096)
+    if(step["p50_ms"].get<double>() != 1.024 || step["p99_ms"].get<double>() != 4.096)
+        throw std::runtime_error("testMetrics: bad percentiles "+picojson::value(step).serialize());
+    // a percentile never exceeds the largest sample
+    metrics.record("flush", 1000);
+    summary = metrics.summary();
+    picojson::object &flush = summary["flush"].get<picojson::object>();
+    if(flush["p50_ms"].get<double>() != 1 || flush["p99_ms"].get<double>() != 1)
+        throw std::runtime_error("testMetrics: percentiles above max "+picojson::value(flush).serialize());
+}
+
+void testUploadSpool() {
+    UploadSpool spool("test_spool", 10);
+    if(!spool.fits(100))
+        throw std::runtime_error("testUploadSpool: empty spool must take any entry");
+    spool.write(1, "hello");
+    spool.write(2, "world");
+    if(spool.bytes() != 10 || spool.fits(1))
+        throw std::runtime_error("testUploadSpool: bad budget");
+    string body;
+    spool.read(2, body);
+    if(body != "world")
+        throw std::runtime_error("testUploadSpool: bad body "+body);
+    spool.remove(1);
+    if(spool.bytes() != 5 || !spool.fits(5))
+        throw std::runtime_error("testUploadSpool: bad budget after remove");
+}
+
+void testStreamOptions() {
+    picojson::value json;
+    stringstream ss("{\"steps_per_frame\": 500, \"validation\": \"full\"}");
+    string err = picojson::parse(json, ss);
+    if(!err.empty())
+        throw std::runtime_error("testStreamOptions: "+err);
+    StreamOptions options(json);
+    if(options.get<double>("steps_per_frame") != 500)
+        throw std::runtime_error("testStreamOptions: bad steps_per_frame");
+    if(options.get<double>("frames_per_upload", 1) != 1 || options.has("frames_per_upload"))
+        throw std::runtime_error("testStreamOptions: bad default");
+    bool thrown = false;
+    try {
+        options.get<double>("validation");
+    } catch(const std::runtime_error &e) {
+        thrown = true;
+    }
+    if(!thrown)
+        throw std::runtime_error("testStreamOptions: wrong type not detected");
+}
+
+static vector<int> selectFrameAtoms(const string &option) {
+    // a 3 atom solute, a rigid water with hydrogen masses repartitioned
+    // onto it, a TIP4P water and an ion
+    double masses[] = {12.0, 1.0, 1.0,
+                       12.0, 3.0, 3.0,
+                       16.0, 1.0, 1.0, 0.0,
+                       23.0};
+    vector<double> mass_list(masses, masses+11);
+    vector<vector<int> > molecules(4);
+    for(int i=0; i < 11; i++)
+        molecules[i < 3 ? 0 : i < 6 ? 1 : i < 10 ? 2 : 3].push_back(i);
+    FrameAtoms::Bonds bonds;
+    bonds.insert(make_pair(0, 1));
+    bonds.insert(make_pair(1, 2));
+    bonds.insert(make_pair(3, 4));
+    bonds.insert(make_pair(3, 5));
+    bonds.insert(make_pair(4, 5));
+    bonds.insert(make_pair(6, 7));
+    bonds.insert(make_pair(6, 8));
+    picojson::value json;
+    stringstream ss(option);
+    string err = picojson::parse(json, ss);
+    if(!err.empty())
+        throw std::runtime_error("selectFrameAtoms: "+err);
+    return FrameAtoms::select(json, mass_list, molecules, bonds);
+}
+
+void testFrameAtoms() {
+    if(!selectFrameAtoms("null").empty() || !selectFrameAtoms("\"all\"").empty())
+        throw std::runtime_error("testFrameAtoms: all should select every atom");
+    vector<int> solute = selectFrameAtoms("\"solute\"");
+    if(solute.size() != 3 || solute[0] != 0 || solute[2] != 2)
+        throw std::runtime_error("testFrameAtoms: bad solute");
+    vector<int> indices = selectFrameAtoms("[10, 2, 2, 0]");
+    if(indices.size() != 3 || indices[0] != 0 || indices[1] != 2 || indices[2] != 10)
+        throw std::runtime_error("testFrameAtoms: bad indices");
+    const char *bad[] = {"\"water\"", "[]", "[11]", "[-1]", "[1.5]", "[\"1\"]", "3"};
+    for(int i=0; i < 7; i++) {
+        bool thrown = false;
+        try {
+            selectFrameAtoms(bad[i]);
+        } catch(const std::runtime_error &e) {
+            thrown = true;
+        }
+        if(!thrown)
+            throw std::runtime_error(string("testFrameAtoms: accepted ")+bad[i]);
+    }
+}
+
+void testGzip() {
+    // large enough to be split into several members
+    string data = gen_random(3*Gzip::MIN_CHUNK_SIZE);
+    string gzipped;
+    Gzip::compress(data, 1, 3, gzipped);
+    string decompressed;
+    Gzip::decompress(gzipped, decompressed);
+    if(decompressed != data)
+        throw std::runtime_error("testGzip: multi member round trip failed");
+    gzipped.resize(gzipped.size()/2);
+    bool thrown = false;
+    try {
+        decompressed.clear();
+        Gzip::decompress(gzipped, decompressed);
+    } catch(const std::runtime_error &e) {
+        thrown = true;
+    }
+    if(!thrown)
+        throw std::runtime_error("testGzip: truncated data not detected");
+}
+
+void testStartReply() {
+    PayloadEncoder encoder;
+    encoder.append("{\"stream_id\":\"abc\",\"files\":{");
+    encoder.appendFile("state.xml", "<State/>", true);
+    encoder.append(",");
+    encoder.appendFile("log.txt", "hello", false);
+    encoder.append("}}\n");
+    string body, md5;
+    encoder.finish(body, md5);
+    istringstream input(body);
+    picojson::value reply;
+    map<string, string> files, file_md5s;
+    string body_md5;
+    StartReply::read(input, NULL, reply, files, file_md5s, body_md5);
+    if(files["state.xml"] != "<State/>" || files["log.txt"] != "hello")
+        throw std::runtime_error("testStartReply: bad files");
+    if(body_md5 != md5)
+        throw std::runtime_error("testStartReply: bad md5 "+body_md5);
+    if(reply.get("stream_id").to_str() != "abc" || !reply.get("files").is<picojson::null>())
+        throw std::runtime_error("testStartReply: bad reply "+reply.serialize());
+}
+
+void testStepScheduler() {
+    StepScheduler scheduler(1.0);
+    scheduler.addStepInterval(50);
+    scheduler.addStepInterval(80);
+    // uncalibrated batches are short, but still stop at frame boundaries
+    if(scheduler.nextBatch(0, 100) != 10 || scheduler.nextBatch(45, 100) != 5)
+        throw std::runtime_error("testStepScheduler: bad calibration batch");
+    scheduler.recordBatch(10, 0.01);
+    if(scheduler.secondsPerStep() != 0.001)
+        throw std::runtime_error("testStepScheduler: bad time per step");
+    // the nearest step interval, 80, comes first
+    if(scheduler.nextBatch(70, 100) != 10)
+        throw std::runtime_error("testStepScheduler: crossed a step interval");
+    // 0.02s to the deadline allows 20 steps of 1ms, whatever the intervals
+    if(scheduler.nextBatch(0, 0.02) != 20)
+        throw std::runtime_error("testStepScheduler: overran the deadline");
+    // batches are capped at max_batch_seconds, and always take a step
+    StepScheduler unbounded(0.5);
+    unbounded.recordBatch(10, 0.01);
+    if(unbounded.nextBatch(0, 100) != 500 || unbounded.nextBatch(0, 0) != 1)
+        throw std::runtime_error("testStepScheduler: bad batch size");
+}
+
+void testFileCache() {
+    FileCache cache("test_file_cache");
+    string md5 = "0123456789abcdef0123456789abcdef";
+    cache.put("target_a", md5, "<System/>");
+    cache.put("target_c", md5, "<System/>");
+    // identical files of different targets are listed once in index()
+    if(cache.index() != md5)
+        throw std::runtime_error("testFileCache: bad index "+cache.index());
+    // and may be served to a target that never cached them
+    string data;
+    if(!cache.get("target_b", md5, data) || data != "<System/>")
+        throw std::runtime_error("testFileCache: file of another target not found");
+    if(cache.get("target_b", "fedcba9876543210fedcba9876543210", data))
+        throw std::runtime_error("testFileCache: found a file never cached");
+    Poco::File(cache.directory()).remove(true);
+}
+
 int main() {
+    testPayloadEncoder();
+    testStartReply();
+    testGzip();
+    testMetrics();
+    testUploadSpool();
+    testStreamOptions();
+    testFrameAtoms();
+    testStepScheduler();
+    testFileCache();
     ifstream donor_tokens("donor_tokens.log");
     string donor_token;
     donor_tokens >> donor_token;
@@ -0,0 +1,63 @@
+#include <map>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+
+#include <Core.h>
+#include "MockServer.h"
+
+using namespace std;
+
+// exposes the stream API of the core to the test
+class MockCore : public Core {
+public:
+    MockCore() : Core("mock_key") {}
+    using Core::startStream;
+    using Core::stopStream;
+    using Core::sendFrame;
+    using Core::sendCheckpoint;
+    using Core::sendHeartbeat;
+    using Core::flushUploads;
+    using Core::files_;
+};
+
+static void check(bool condition, const string &message) {
+    if(!condition)
+        throw std::runtime_error("testMockStream: "+message);
+}
+
+void testMockStream(int upload_queue_size) {
+    MockConfig config;
+    // "hello world"
+    config.files = "{\"a.txt.b64\":\"aGVsbG8gd29ybGQ=\"}";
+    config.options = "{\"steps_per_frame\":50000}";
+    config.latency_ms = 5;
+    MockServer server(config, MOCK_CERT_DIR "private.pem", MOCK_CERT_DIR "public.crt");
+
+    MockCore core;
+    core.setUploadQueueSize(upload_queue_size);
+    core.startStream(server.uri());
+    check(core.files_["a.txt"] == "hello world", "bad file");
+    map<string, string> frame_files;
+    frame_files["frames.xtc"] = string(1000, 'x');
+    for(int i=0; i < 5; i++)
+        core.sendFrame(frame_files, 2, i % 2 == 0);
+    core.sendHeartbeat();
+    map<string, string> checkpoint_files;
+    checkpoint_files["state.xml"] = string(1000, 'y');
+    core.sendCheckpoint(checkpoint_files, 10, true);
+    core.stopStream();
+
+    MockStats stats = server.stats();
+    check(stats.assigns == 1 && stats.starts == 1, "bad assignment");
+    check(stats.frames == 10 && stats.frame_requests == 5, "bad frames");
+    check(stats.heartbeats == 1 && stats.checkpoints == 1, "bad uploads");
+    check(stats.stops == 1 && stats.error_stops == 0, "bad stop");
+    check(stats.md5_mismatches == 0, "md5 mismatch");
+}
+
+int main() {
+    testMockStream(0);
+    testMockStream(2);
+    return 0;
+}
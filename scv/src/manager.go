@@ -255,6 +255,9 @@ func (m *Manager) GetActiveStreams() interface{} {
 		result["user"] = stream.activeStream.user
 		result["start_time"] = stream.activeStream.startTime
 		result["engine"] = stream.activeStream.engine
+		if stream.activeStream.status != nil {
+			result["status"] = stream.activeStream.status
+		}
 		finalized[stream.StreamId] = result
 		stream.RUnlock()
 	}
@@ -288,6 +291,13 @@ func (m *Manager) ResetActiveStream(token string) error {
 	return nil
 }
 
+// Seconds between heartbeats cores are asked for. Frames and checkpoints
+// count as heartbeats, so most cores rarely send one. This leaves room for
+// a few missed ones before the stream expires.
+func (m *Manager) HeartbeatInterval() int {
+	return m.expirationTime / 4
+}
+
 func (m *Manager) ActivateStream(targetId, user, engine string, fn func(*Stream) error) (token string, streamId string, err error) {
 	m.Lock()
 
@@ -6,6 +6,7 @@ import (
 	"container/list"
 	"crypto/md5"
 	"encoding/base64"
+	"encoding/binary"
 	"encoding/hex"
 	"encoding/json"
 	"errors"
@@ -19,6 +20,7 @@ import (
 	"path/filepath"
 	"sort"
 	"strconv"
+	"strings"
 	"sync"
 	"syscall"
 	"time"
@@ -440,6 +442,14 @@ func maxCheckpoint(path string) (int, error) {
 	return lastCheckpoint, nil
 }
 
+// lastCheckpointDir returns the directory holding the files of the stream's
+// most recent checkpoint. The directory does not exist if there is none.
+func (app *Application) lastCheckpointDir(stream *Stream) string {
+	frameDir := filepath.Join(app.StreamDir(stream.StreamId), strconv.Itoa(stream.Frames))
+	lastCheckpoint, _ := maxCheckpoint(frameDir)
+	return filepath.Join(frameDir, strconv.Itoa(lastCheckpoint), "checkpoint_files")
+}
+
 /*
 .. http:get:: /streams/download/:stream_id/:filename
 	Download file ``filename`` from ``stream_id``. ``filename`` can be
@@ -813,16 +823,96 @@ func (app *Application) ActiveStreamsHandler() AppHandler {
 	}
 }
 
+// Cores that spool uploads number them with an Upload-Seq header and resend
+// them until they get a reply, so an upload that was applied but whose reply
+// was lost arrives again. uploadSeq returns the sequence number of r, 0 if
+// none was given, and whether it was already applied to the stream.
+func uploadSeq(r *http.Request, stream *Stream) (int, bool, error) {
+	header := r.Header.Get("Upload-Seq")
+	if header == "" {
+		return 0, false, nil
+	}
+	seq, err := strconv.Atoi(header)
+	if err != nil || seq < 1 {
+		return 0, false, errors.New("Bad Upload-Seq")
+	}
+	return seq, seq <= stream.activeStream.uploadSeq, nil
+}
+
+// Content-Type of frames and checkpoints whose files are sent as raw
+// binary parts instead of base64 strings inside JSON. Cores use it once
+// /core/start lists "binary" in upload_formats.
+const binaryUploadType = "application/x-siegetank-parts"
+
+// readPart splits a big endian uint32 length prefixed part off body.
+func readPart(body []byte) (part []byte, rest []byte, err error) {
+	if len(body) < 4 {
+		return nil, nil, errors.New("Truncated binary upload")
+	}
+	size := uint64(binary.BigEndian.Uint32(body))
+	if uint64(len(body)-4) < size {
+		return nil, nil, errors.New("Truncated binary upload")
+	}
+	return body[4 : 4+size], body[4+size:], nil
+}
+
+// decodeUpload decodes the message of a frame or checkpoint into msg and
+// returns its files, and whether they were sent as raw binary. A JSON body
+// carries the files as strings in the field jsonFiles points to. A binary
+// body is the JSON message without files, followed by the name and data of
+// each file, all of them length prefixed.
+func decodeUpload(r *http.Request, body []byte, msg interface{},
+	jsonFiles *map[string]string) (map[string][]byte, bool, error) {
+	files := make(map[string][]byte)
+	if r.Header.Get("Content-Type") != binaryUploadType {
+		if err := json.Unmarshal(body, msg); err != nil {
+			return nil, false, errors.New("Could not decode JSON")
+		}
+		for filename, filestring := range *jsonFiles {
+			files[filename] = []byte(filestring)
+		}
+		return files, false, nil
+	}
+	message, rest, err := readPart(body)
+	if err != nil {
+		return nil, true, err
+	}
+	if err := json.Unmarshal(message, msg); err != nil {
+		return nil, true, errors.New("Could not decode JSON")
+	}
+	for len(rest) > 0 {
+		var name, data []byte
+		if name, rest, err = readPart(rest); err != nil {
+			return nil, true, err
+		}
+		if data, rest, err = readPart(rest); err != nil {
+			return nil, true, err
+		}
+		files[string(name)] = data
+	}
+	return files, true, nil
+}
+
 /*
  ..  http:put:: /core/frame
     Append a frame to the stream's buffer.
     If the core posts to this method, then the WS assumes that the
     frame is valid. The data received is stored in a buffer until a
     checkpoint is received. It is assumed that files given here are
-    binary appendable. Files ending in .b64 or .gz are decoded
-    automatically.
+    binary appendable. Files ending in .b64, .gz or .gz.b64 are decoded
+    automatically, whether sent as JSON or as a binary body. A single request may carry several frames, in which
+    case ``frames`` must be set to the number of frames in the files.
+    Like a heartbeat, a frame keeps the stream from expiring, and may
+    carry the core's ``status``.
     :reqheader Content-MD5: MD5 Sum of the body
     :reqheader Authorization: core Authorization token
+    :reqheader Upload-Seq: optional, increasing per stream; a frame or
+        checkpoint whose number was already applied is acknowledged
+        without being applied again
+    :reqheader Content-Type: optional, ``application/x-siegetank-parts``
+        for a binary body: the JSON message without ``files``, then the
+        name and raw data of each file, each prefixed with its length as a
+        big endian uint32. Files ending in .gz are still decompressed.
     **Example request**
     .. sourcecode:: javascript
         {
@@ -831,6 +921,7 @@ func (app *Application) ActiveStreamsHandler() AppHandler {
                 "log.txt.gz.b64": "file.gz.b64"
             },
             "frames": 25,  // optional, number of frames in the files
+            "status": {"step": 125000} // optional, see /core/heartbeat
         }
     :status 200: OK
     :status 400: Bad request
@@ -845,24 +936,36 @@ func (app *Application) CoreFrameHandler() AppHandler {
 		if md5String != hex.EncodeToString(h.Sum(nil)) {
 			return errors.New("MD5 mismatch")
 		}
-		return app.Manager.ModifyActiveStream(token, func(stream *Stream) error {
+		e := app.Manager.ModifyActiveStream(token, func(stream *Stream) error {
+			seq, applied, err := uploadSeq(r, stream)
+			if err != nil {
+				return err
+			}
+			if applied {
+				return nil
+			}
 			type Message struct {
-				Files  map[string]string `json:"files"`
-				Frames int               `json:"frames"`
+				Files  map[string]string      `json:"files"`
+				Frames int                    `json:"frames"`
+				Status map[string]interface{} `json:"status"`
 			}
 			msg := Message{Frames: 1}
-			decoder := json.NewDecoder(bytes.NewReader(body))
-			err := decoder.Decode(&msg)
+			files, _, err := decodeUpload(r, body, &msg, &msg.Files)
 			if err != nil {
-				return errors.New("Could not decode JSON")
+				return err
+			}
+			if len(msg.Status) > 0 {
+				stream.activeStream.status = msg.Status
+			}
+			if msg.Frames < 1 {
+				return errors.New("frames must be a positive integer")
 			}
 			if md5String == stream.activeStream.frameHash {
 				return errors.New("POSTed same frame twice")
 			}
 			stream.activeStream.frameHash = md5String
-			for filename, filestring := range msg.Files {
+			for filename, filebin := range files {
 				root, ext := splitExt(filename)
-				filebin := []byte(filestring)
 				if ext == ".b64" {
 					filename = root
 					reader := base64.NewDecoder(base64.StdEncoding, bytes.NewReader(filebin))
@@ -871,20 +974,21 @@ func (app *Application) CoreFrameHandler() AppHandler {
 						return err
 					}
 					filebin = filecopy
-					root, ext := splitExt(filename)
-					if ext == ".gz" {
-						filename = root
-						reader, err := gzip.NewReader(bytes.NewReader(filebin))
-						defer reader.Close()
-						if err != nil {
-							return err
-						}
-						filecopy, err := ioutil.ReadAll(reader)
-						if err != nil {
-							return err
-						}
-						filebin = filecopy
+					root, ext = splitExt(filename)
+				}
+				// binary parts arrive without .b64, but may still be gzipped
+				if ext == ".gz" {
+					filename = root
+					reader, err := gzip.NewReader(bytes.NewReader(filebin))
+					if err != nil {
+						return err
 					}
+					defer reader.Close()
+					filecopy, err := ioutil.ReadAll(reader)
+					if err != nil {
+						return err
+					}
+					filebin = filecopy
 				}
 				dir := filepath.Join(app.StreamDir(stream.StreamId), "buffer_files")
 				os.MkdirAll(dir, 0776)
@@ -899,9 +1003,16 @@ func (app *Application) CoreFrameHandler() AppHandler {
 					return err
 				}
 			}
-			stream.activeStream.bufferFrames += 1
+			stream.activeStream.bufferFrames += msg.Frames
+			if seq > 0 {
+				stream.activeStream.uploadSeq = seq
+			}
 			return nil
 		})
+		if e != nil {
+			return e
+		}
+		return app.Manager.ResetActiveStream(token)
 	}
 }
 
@@ -912,6 +1023,9 @@ func (app *Application) CoreFrameHandler() AppHandler {
     frame of the buffered frames.
     :reqheader Content-MD5: MD5 Sum of the body
     :reqheader Authorization: core Authorization token
+    :reqheader Upload-Seq: optional, see /core/frame
+    :reqheader Content-Type: optional, see /core/frame. Files of binary
+        checkpoints are stored base64 encoded with ``.b64`` appended.
     **Example Request**
     .. sourcecode:: javascript
         {
@@ -919,10 +1033,16 @@ func (app *Application) CoreFrameHandler() AppHandler {
                 "state.xml.gz.b64" : "state.xml.gz.b64"
             },
             "frames": 239.98, # number of frames since last checkpoint
+            "status": {"step": 125000} # optional, see /core/heartbeat
         }
     .. note:: filenames must be almost be present in stream_files
     .. note:: If ``frames`` is not provided, the backend uses
         buffer frames an approximation
+    .. note:: Like a frame, a checkpoint keeps the stream from expiring.
+    .. note:: A checkpoint carrying ``state.delta`` files is a delta
+        against the ``state.bin`` of the previous checkpoint, which is
+        carried forward into this one unless it is uploaded again. The
+        checkpoint is rejected if there is no previous ``state.bin``.
     :status 200: OK
     :status 400: Bad request
 */
@@ -936,24 +1056,70 @@ func (app *Application) CoreCheckpointHandler() AppHandler {
 		if md5String != hex.EncodeToString(h.Sum(nil)) {
 			return errors.New("MD5 mismatch")
 		}
-		return app.Manager.ModifyActiveStream(token, func(stream *Stream) error {
+		e := app.Manager.ModifyActiveStream(token, func(stream *Stream) error {
+			seq, applied, err := uploadSeq(r, stream)
+			if err != nil {
+				return err
+			}
+			if applied {
+				return nil
+			}
 			streamDir := app.StreamDir(stream.StreamId)
 			bufferDir := filepath.Join(streamDir, "buffer_files")
 			checkpointDir := filepath.Join(bufferDir, "checkpoint_files")
 			os.MkdirAll(checkpointDir, 0776)
 			type Message struct {
-				Files  map[string]string `json:"files"`
-				Frames float64           `json:"frames"`
+				Files  map[string]string      `json:"files"`
+				Frames float64                `json:"frames"`
+				Status map[string]interface{} `json:"status"`
 			}
 			msg := Message{}
-			decoder := json.NewDecoder(bytes.NewReader(body))
-			err := decoder.Decode(&msg)
+			files, raw, err := decodeUpload(r, body, &msg, &msg.Files)
 			if err != nil {
-				return errors.New("Could not decode JSON")
+				return err
+			}
+			if len(msg.Status) > 0 {
+				stream.activeStream.status = msg.Status
+			}
+			if raw {
+				// stored as if sent in JSON, which is how /core/start serves them
+				encoded := make(map[string][]byte)
+				for filename, filebin := range files {
+					encoded[filename+".b64"] = []byte(base64.StdEncoding.EncodeToString(filebin))
+				}
+				files = encoded
+			}
+			isDelta := false
+			for filename := range files {
+				if strings.HasPrefix(filename, "state.delta") {
+					isDelta = true
+				}
 			}
-			for filename, filestring := range msg.Files {
+			if isDelta {
+				baseDir := app.lastCheckpointDir(stream)
+				baseFiles, _ := ioutil.ReadDir(baseDir)
+				carried := 0
+				for _, fileProp := range baseFiles {
+					name := fileProp.Name()
+					if !strings.HasPrefix(name, "state.bin") {
+						continue
+					}
+					carried += 1
+					if _, ok := files[name]; ok {
+						continue
+					}
+					binary, e := ioutil.ReadFile(filepath.Join(baseDir, name))
+					if e != nil {
+						return errors.New("Cannot read checkpoint file")
+					}
+					ioutil.WriteFile(filepath.Join(checkpointDir, name), binary, 0776)
+				}
+				if carried == 0 {
+					return errors.New("No full checkpoint to apply state.delta to")
+				}
+			}
+			for filename, fileBin := range files {
 				fileDir := filepath.Join(checkpointDir, filename)
-				fileBin := []byte(filestring)
 				ioutil.WriteFile(fileDir, fileBin, 0776)
 			}
 			bufferFrames := stream.activeStream.bufferFrames
@@ -977,17 +1143,40 @@ func (app *Application) CoreCheckpointHandler() AppHandler {
 			stream.Frames = sumFrames
 			stream.activeStream.donorFrames += msg.Frames
 			stream.activeStream.bufferFrames = 0
+			if seq > 0 {
+				stream.activeStream.uploadSeq = seq
+			}
 			// TODO: update frame count in MongoDB (do we want to?)
 			// This stream is mutex'd
 			return nil
 		})
+		if e != nil {
+			return e
+		}
+		return app.Manager.ResetActiveStream(token)
+	}
+}
+
+// The format a checkpoint file is in, as listed in Checkpoint-Formats
+func checkpointFormat(filename string) string {
+	if strings.HasPrefix(filename, "state.delta") {
+		return "delta"
+	}
+	if strings.HasPrefix(filename, "state.bin") {
+		return "binary"
 	}
+	return "xml"
 }
 
 /*
 .. http:get:: /core/start
     Get files needed for the core to start an activated stream.
     :reqheader Authorization: core Authorization token
+    :reqheader Cached-Files: optional comma separated MD5 hexdigests of seed
+        files the core already has
+    :reqheader Checkpoint-Formats: optional comma separated checkpoint
+        formats the core can resume from besides ``xml``, eg.
+        ``binary,delta``
     :resheader Content-MD5: MD5 hexdigest of the body
     **Example reply**
     .. sourcecode:: javascript
@@ -996,8 +1185,10 @@ func (app *Application) CoreCheckpointHandler() AppHandler {
             "target_id": "uuid4",
             "files": {
                 "state.xml.gz.b64": "content.b64",
-                "integrator.xml.gz.b64": "content.b64",
-                "system.xml.gz.b64": "content.b64"
+            }
+            "cached": {
+                "integrator.xml.gz.b64": "md5 hexdigest",
+                "system.xml.gz.b64": "md5 hexdigest"
             }
             "options": {
                 "steps_per_frame": 50000,
@@ -1006,7 +1197,21 @@ func (app *Application) CoreCheckpointHandler() AppHandler {
                     protein used by the MD community."
                 "category": "Benchmark"
             }
+            "upload_formats": ["json", "binary"],
+            "heartbeat_interval": 300
         }
+    .. note:: ``upload_formats`` lists the bodies /core/frame and
+        /core/checkpoint accept, cores fall back to JSON without it.
+    .. note:: ``heartbeat_interval`` is how many seconds the core may go
+        without a frame, checkpoint or heartbeat.
+    .. note:: A stream whose last checkpoint is in a format the core did
+        not list in Checkpoint-Formats is not served. It is deactivated
+        and the request fails, since a core that cannot read the
+        checkpoint would restart from the seed state while resuming the
+        checkpoint's frame count.
+    .. note:: Seed files whose MD5 hexdigest is listed in Cached-Files are
+        sent in ``cached`` instead of ``files``, and the core uses its own
+        copy. Checkpoint files are always sent in full.
     :status 200: OK
     :status 400: Bad request
 */
@@ -1032,12 +1237,30 @@ func (app *Application) CoreStartHandler() AppHandler {
 			StreamId string            `json:"stream_id"`
 			TargetId string            `json:"target_id"`
 			Files    map[string]string `json:"files"`
+			Cached   map[string]string `json:"cached,omitempty"`
 			Options  interface{}       `json:"options"`
+			Formats  []string          `json:"upload_formats"`
+			Interval int               `json:"heartbeat_interval"`
 		}
 		rep := Reply{
 			Files:   make(map[string]string),
+			Cached:  make(map[string]string),
 			Options: make(map[string]interface{}),
+			Formats:  []string{"json", "binary"},
+			Interval: app.Manager.HeartbeatInterval(),
+		}
+		coreCache := make(map[string]bool)
+		for _, hash := range strings.Split(r.Header.Get("Cached-Files"), ",") {
+			hash = strings.TrimSpace(hash)
+			if hash != "" {
+				coreCache[hash] = true
+			}
 		}
+		coreFormats := map[string]bool{"xml": true}
+		for _, format := range strings.Split(r.Header.Get("Checkpoint-Formats"), ",") {
+			coreFormats[strings.TrimSpace(format)] = true
+		}
+		unreadable := false
 		e := app.Manager.ModifyActiveStream(token, func(stream *Stream) error {
 			rep.StreamId = stream.StreamId
 			rep.TargetId = stream.TargetId
@@ -1050,14 +1273,16 @@ func (app *Application) CoreStartHandler() AppHandler {
 			rep.Options = mgoRes["options"]
 			// Load the streams' files
 			if stream.Frames > 0 {
-				frameDir := filepath.Join(app.StreamDir(rep.StreamId), strconv.Itoa(stream.Frames))
-				lastCheckpoint, _ := maxCheckpoint(frameDir)
-				checkpointDir := filepath.Join(frameDir, strconv.Itoa(lastCheckpoint), "checkpoint_files")
+				checkpointDir := app.lastCheckpointDir(stream)
 				checkpointFiles, e := ioutil.ReadDir(checkpointDir)
 				if e != nil {
 					return errors.New("Cannot load checkpoint directory")
 				}
 				for _, fileProp := range checkpointFiles {
+					if format := checkpointFormat(fileProp.Name()); !coreFormats[format] {
+						unreadable = true
+						return errors.New("Core cannot resume from a " + format + " checkpoint")
+					}
 					binary, e := ioutil.ReadFile(filepath.Join(checkpointDir, fileProp.Name()))
 					if e != nil {
 						return errors.New("Cannot read checkpoint file")
@@ -1077,11 +1302,22 @@ func (app *Application) CoreStartHandler() AppHandler {
 					if e != nil {
 						return errors.New("Cannot read seed files")
 					}
-					rep.Files[fileProp.Name()] = string(binary)
+					h := md5.New()
+					h.Write(binary)
+					hash := hex.EncodeToString(h.Sum(nil))
+					if coreCache[hash] {
+						rep.Cached[fileProp.Name()] = hash
+					} else {
+						rep.Files[fileProp.Name()] = string(binary)
+					}
 				}
 			}
 			return nil
 		})
+		if unreadable {
+			// hand the stream to a core that can resume it
+			app.Manager.DeactivateStream(token, 0)
+		}
 		if e != nil {
 			return e
 		}
@@ -1132,14 +1368,47 @@ func (app *Application) CoreStopHandler() AppHandler {
 /*
 .. http:post:: /core/heartbeat
     Cores POST to this handler to notify the WS that it is still
-    alive.
+    alive. The body may contain a JSON object describing the state of
+    the core, which is reported by /active_streams.
     :reqheader Authorization: core Authorization token
+    **Example Request**
+    .. sourcecode:: javascript
+        {
+            "step": 125000, // optional
+            "ns_per_day": 42.5, // optional
+            "validation": "every:10", // optional
+            "frames_validated": 3, // optional
+            "frames_seen": 25, // optional
+            "timings": { // optional, per phase timing histograms
+                "step": {"count": 120, "total_s": 58.1, "mean_ms": 484.2,
+                         "p50_ms": 501.3, "p90_ms": 501.3,
+                         "p99_ms": 501.3, "max_ms": 501.3}
+            }
+        }
     :status 200: OK
     :status 400: Bad request
 */
 func (app *Application) CoreHeartbeatHandler() AppHandler {
 	return func(w http.ResponseWriter, r *http.Request) (err error) {
 		token := r.Header.Get("Authorization")
+		status := make(map[string]interface{})
+		if r.Body != nil {
+			body, _ := ioutil.ReadAll(r.Body)
+			if len(body) > 0 {
+				if json.Unmarshal(body, &status) != nil {
+					return errors.New("Could not decode JSON")
+				}
+			}
+		}
+		if len(status) > 0 {
+			e := app.Manager.ModifyActiveStream(token, func(stream *Stream) error {
+				stream.activeStream.status = status
+				return nil
+			})
+			if e != nil {
+				return e
+			}
+		}
 		return app.Manager.ResetActiveStream(token)
 	}
 }
@@ -2,7 +2,10 @@ package scv
 
 import (
 	"bytes"
+	"compress/gzip"
 	"crypto/md5"
+	"encoding/base64"
+	"encoding/binary"
 	"encoding/hex"
 	"encoding/json"
 	"fmt"
@@ -254,6 +257,40 @@ func (f *Fixture) putCheckpoint(token string, data string) (code int) {
 	return
 }
 
+// PUT a frame or checkpoint numbered with an Upload-Seq header
+func (f *Fixture) putUploadSeq(uri, token, data string, seq int) (code int) {
+	dataBuffer := bytes.NewBuffer([]byte(data))
+	req, _ := http.NewRequest("PUT", uri, dataBuffer)
+	h := md5.New()
+	io.WriteString(h, string(data))
+	req.Header.Add("Authorization", token)
+	req.Header.Add("Content-MD5", hex.EncodeToString(h.Sum(nil)))
+	req.Header.Add("Upload-Seq", strconv.Itoa(seq))
+	w := httptest.NewRecorder()
+	f.app.Router.ServeHTTP(w, req)
+	code = w.Code
+	return
+}
+
+// PUT a frame or checkpoint as binary parts, parts alternate names and data
+func (f *Fixture) putBinary(uri, token, message string, parts ...string) (code int) {
+	var body bytes.Buffer
+	for _, part := range append([]string{message}, parts...) {
+		binary.Write(&body, binary.BigEndian, uint32(len(part)))
+		body.WriteString(part)
+	}
+	h := md5.New()
+	h.Write(body.Bytes())
+	req, _ := http.NewRequest("PUT", uri, &body)
+	req.Header.Add("Authorization", token)
+	req.Header.Add("Content-MD5", hex.EncodeToString(h.Sum(nil)))
+	req.Header.Add("Content-Type", binaryUploadType)
+	w := httptest.NewRecorder()
+	f.app.Router.ServeHTTP(w, req)
+	code = w.Code
+	return
+}
+
 func (f *Fixture) postStream(token string, data string) (stream_id string, code int) {
 	dataBuffer := bytes.NewBuffer([]byte(data))
 	req, _ := http.NewRequest("POST", "/streams", dataBuffer)
@@ -286,6 +323,14 @@ func (f *Fixture) coreHeartbeat(token string) (code int) {
 	return w.Code
 }
 
+func (f *Fixture) coreHeartbeatStatus(token string, status string) (code int) {
+	req, _ := http.NewRequest("POST", "/core/heartbeat", bytes.NewBuffer([]byte(status)))
+	req.Header.Add("Authorization", token)
+	w := httptest.NewRecorder()
+	f.app.Router.ServeHTTP(w, req)
+	return w.Code
+}
+
 func (f *Fixture) coreStop(token string, error_string string) (code int) {
 	body := `{"error": "` + error_string + `"}`
 	req, _ := http.NewRequest("PUT", "/core/stop", bytes.NewBuffer([]byte(body)))
@@ -310,6 +355,15 @@ func (f *Fixture) coreStart(token string) (streamId string, code int) {
 	return
 }
 
+func (f *Fixture) coreStartFormats(token, formats string) (code int) {
+	req, _ := http.NewRequest("GET", "/core/start", nil)
+	req.Header.Add("Authorization", token)
+	req.Header.Add("Checkpoint-Formats", formats)
+	w := httptest.NewRecorder()
+	f.app.Router.ServeHTTP(w, req)
+	return w.Code
+}
+
 func (f *Fixture) loadMongoStream(stream_id string) map[string]interface{} {
 	cursor := f.app.Mongo.DB("streams").C(f.app.Config.Name)
 	result := make(map[string]interface{})
@@ -942,6 +996,156 @@ func TestStreamSync(t *testing.T) {
 
 }
 
+func TestMultiFramePut(t *testing.T) {
+	f := NewFixture()
+	defer f.shutdown()
+	target_id := "12345"
+	jsonData := `{"target_id":"` + target_id + `",
+				"files": {"openmm": "ZmlsZWRhdGFibGFoYmFsaA==",
+				"amber": "ZmlsZWRhdGFibGFoYmFsaA=="}}`
+	auth_token := f.addManager("yutong", 1)
+	stream_id, _ := f.postStream(auth_token, jsonData)
+	token, code := f.activateStream(target_id, "some_engine", "some_donor", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+
+	assert.Equal(t, f.putFrame(token, `{"files": {"some_file": "12345"}, "frames": 3}`), 200)
+	assert.Equal(t, f.app.Manager.streams[stream_id].activeStream.bufferFrames, 3)
+	assert.Equal(t, f.putFrame(token, `{"files": {"some_file": "67890"}}`), 200)
+	assert.Equal(t, f.app.Manager.streams[stream_id].activeStream.bufferFrames, 4)
+	assert.Equal(t, f.putFrame(token, `{"files": {"some_file": "abcde"}, "frames": 0}`), 400)
+	assert.Equal(t, f.app.Manager.streams[stream_id].activeStream.bufferFrames, 4)
+
+	assert.Equal(t, f.putCheckpoint(token, `{"files": {"chkpt": "data"}, "frames": 4}`), 200)
+	assert.Equal(t, f.app.Manager.streams[stream_id].Frames, 4)
+	assert.Equal(t, f.download(auth_token, stream_id, "4/0/some_file"), []byte("1234567890"))
+	assert.Equal(t, f.coreStop(token, ""), 200)
+}
+
+func TestUploadSeq(t *testing.T) {
+	f := NewFixture()
+	defer f.shutdown()
+	target_id := "12345"
+	jsonData := `{"target_id":"` + target_id + `",
+				"files": {"openmm": "ZmlsZWRhdGFibGFoYmFsaA==",
+				"amber": "ZmlsZWRhdGFibGFoYmFsaA=="}}`
+	auth_token := f.addManager("yutong", 1)
+	stream_id, _ := f.postStream(auth_token, jsonData)
+	token, code := f.activateStream(target_id, "some_engine", "some_donor", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+
+	frame := `{"files": {"some_file": "12345"}, "frames": 2}`
+	assert.Equal(t, f.putUploadSeq("/core/frame", token, frame, 1), 200)
+	// a retry of an applied upload is acknowledged but not applied again
+	assert.Equal(t, f.putUploadSeq("/core/frame", token, frame, 1), 200)
+	assert.Equal(t, f.app.Manager.streams[stream_id].activeStream.bufferFrames, 2)
+	assert.Equal(t, f.putUploadSeq("/core/frame", token, `{"files": {"some_file": "67890"}}`, 3), 200)
+	assert.Equal(t, f.app.Manager.streams[stream_id].activeStream.bufferFrames, 3)
+
+	checkpoint := `{"files": {"chkpt": "data"}, "frames": 3}`
+	assert.Equal(t, f.putUploadSeq("/core/checkpoint", token, checkpoint, 4), 200)
+	assert.Equal(t, f.putUploadSeq("/core/checkpoint", token, checkpoint, 4), 200)
+	assert.Equal(t, f.putUploadSeq("/core/frame", token, frame, 2), 200)
+	assert.Equal(t, f.app.Manager.streams[stream_id].activeStream.bufferFrames, 0)
+	assert.Equal(t, f.app.Manager.streams[stream_id].Frames, 3)
+	assert.Equal(t, f.download(auth_token, stream_id, "3/0/some_file"), []byte("1234567890"))
+	assert.Equal(t, f.putUploadSeq("/core/frame", token, frame, 0), 400)
+	assert.Equal(t, f.coreStop(token, ""), 200)
+}
+
+func TestDeltaCheckpoint(t *testing.T) {
+	f := NewFixture()
+	defer f.shutdown()
+	target_id := "12345"
+	jsonData := `{"target_id":"` + target_id + `",
+				"files": {"openmm": "ZmlsZWRhdGFibGFoYmFsaA==",
+				"amber": "ZmlsZWRhdGFibGFoYmFsaA=="}}`
+	auth_token := f.addManager("yutong", 1)
+	stream_id, _ := f.postStream(auth_token, jsonData)
+	token, code := f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+
+	delta := `{"files": {"state.delta.gz.b64": "delta"}, "frames": 0}`
+	// there is no full checkpoint to apply the delta to yet
+	assert.Equal(t, f.putCheckpoint(token, delta), 400)
+	assert.Equal(t, f.putFrame(token, `{"files": {"some_file": "12345"}, "frames": 2}`), 200)
+	assert.Equal(t, f.putCheckpoint(token, `{"files": {"state.bin.gz.b64": "base"}, "frames": 2}`), 200)
+	assert.Equal(t, f.putCheckpoint(token, delta), 200)
+	assert.Equal(t, f.download(auth_token, stream_id, "2/1/checkpoint_files/state.bin.gz.b64"), []byte("base"))
+	assert.Equal(t, f.download(auth_token, stream_id, "2/1/checkpoint_files/state.delta.gz.b64"), []byte("delta"))
+	// a checkpoint without deltas replaces the base
+	assert.Equal(t, f.putCheckpoint(token, `{"files": {"state.bin.gz.b64": "base2"}, "frames": 0}`), 200)
+	assert.Equal(t, f.putCheckpoint(token, delta), 200)
+	assert.Equal(t, f.download(auth_token, stream_id, "2/3/checkpoint_files/state.bin.gz.b64"), []byte("base2"))
+}
+
+func TestCheckpointFormats(t *testing.T) {
+	f := NewFixture()
+	defer f.shutdown()
+	target_id := "12345"
+	f.addTarget("12345", "yutong", `{"options": {"steps_per_frame": 1}}`)
+	jsonData := `{"target_id":"` + target_id + `",
+				"files": {"openmm": "ZmlsZWRhdGFibGFoYmFsaA==",
+				"amber": "ZmlsZWRhdGFibGFoYmFsaA=="}}`
+	auth_token := f.addManager("yutong", 1)
+	f.postStream(auth_token, jsonData)
+	token, code := f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+	assert.Equal(t, f.putFrame(token, `{"files": {"some_file": "12345"}}`), 200)
+	assert.Equal(t, f.putCheckpoint(token, `{"files": {"state.bin.gz.b64": "base"}}`), 200)
+	assert.Equal(t, f.coreStop(token, ""), 200)
+
+	// a core that does not list binary gets nothing, and the stream is freed
+	token, code = f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+	assert.Equal(t, f.coreStartFormats(token, ""), 400)
+	assert.Equal(t, f.coreStop(token, ""), 400)
+	token, code = f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+	assert.Equal(t, f.coreStartFormats(token, "binary"), 200)
+	assert.Equal(t, f.putCheckpoint(token, `{"files": {"state.delta.gz.b64": "delta"}}`), 200)
+	assert.Equal(t, f.coreStop(token, ""), 200)
+
+	// resuming from a delta needs both formats
+	token, code = f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+	assert.Equal(t, f.coreStartFormats(token, "binary"), 400)
+	token, code = f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+	assert.Equal(t, f.coreStartFormats(token, "binary,delta"), 200)
+	assert.Equal(t, f.coreStop(token, ""), 200)
+}
+
+func TestBinaryUpload(t *testing.T) {
+	f := NewFixture()
+	defer f.shutdown()
+	target_id := "12345"
+	jsonData := `{"target_id":"` + target_id + `",
+				"files": {"openmm": "ZmlsZWRhdGFibGFoYmFsaA==",
+				"amber": "ZmlsZWRhdGFibGFoYmFsaA=="}}`
+	auth_token := f.addManager("yutong", 1)
+	stream_id, _ := f.postStream(auth_token, jsonData)
+	token, code := f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+
+	assert.Equal(t, f.putBinary("/core/frame", token, `{"frames": 2}`, "frames.xtc", "\x00\x01\xff"), 200)
+	assert.Equal(t, f.putBinary("/core/frame", token, `{}`, "frames.xtc", "\x02"), 200)
+	// gzipped parts are inflated before being appended
+	var gzipped bytes.Buffer
+	writer := gzip.NewWriter(&gzipped)
+	writer.Write([]byte("\x03\x04"))
+	writer.Close()
+	assert.Equal(t, f.putBinary("/core/frame", token, `{}`, "frames.xtc.gz", gzipped.String()), 200)
+	assert.Equal(t, f.download(auth_token, stream_id, "buffer_files/frames.xtc"), []byte("\x00\x01\xff\x02\x03\x04"))
+	assert.Equal(t, f.app.Manager.streams[stream_id].activeStream.bufferFrames, 4)
+	assert.Equal(t, f.putBinary("/core/checkpoint", token, `{"frames": 4}`, "state.bin", "\x00state"), 200)
+	assert.Equal(t, f.download(auth_token, stream_id, "4/0/frames.xtc"), []byte("\x00\x01\xff\x02\x03\x04"))
+	// checkpoints are kept base64 encoded, as /core/start serves them
+	assert.Equal(t, f.download(auth_token, stream_id, "4/0/checkpoint_files/state.bin.b64"),
+		[]byte(base64.StdEncoding.EncodeToString([]byte("\x00state"))))
+	// a file without its data
+	assert.Equal(t, f.putBinary("/core/frame", token, `{}`, "frames.xtc"), 400)
+}
+
 func TestStreamCycle(t *testing.T) {
 	// Test POSTing frames, checkpoints, starting and stopping.
 	f := NewFixture()
@@ -1124,6 +1328,86 @@ func TestCoreHeartbeat(t *testing.T) {
 	assert.Equal(t, f.coreStop(token, ""), 400)
 }
 
+func TestCoreHeartbeatStatus(t *testing.T) {
+	f := NewFixture()
+	defer f.shutdown()
+	target_id := "12345"
+	f.addTarget("12345", "yutong", `{"options": {"steps_per_frame": 1}}`)
+	jsonData := `{"target_id":"` + target_id + `",
+				"files": {"openmm": "ZmlsZWRhdGFibGFoYmFsaA==",
+				"amber": "ZmlsZWRhdGFibGFoYmFsaA=="}}`
+	auth_token := f.addManager("yutong", 1)
+	stream_id, _ := f.postStream(auth_token, jsonData)
+	token, code := f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+	assert.Equal(t, f.coreHeartbeatStatus(token, "{}"), 200)
+	_, ok := f.activeStreams()[stream_id].(map[string]interface{})["status"]
+	assert.False(t, ok)
+	assert.Equal(t, f.coreHeartbeatStatus(token, `{"validation": "every:10"}`), 200)
+	status := f.activeStreams()[stream_id].(map[string]interface{})["status"].(map[string]interface{})
+	assert.Equal(t, status["validation"], "every:10")
+	assert.Equal(t, f.coreHeartbeatStatus(token, `{"validation"`), 400)
+	assert.Equal(t, f.coreStop(token, ""), 200)
+}
+
+func TestFrameHeartbeat(t *testing.T) {
+	f := NewFixture()
+	defer f.shutdown()
+	f.app.Manager.expirationTime = 5
+	target_id := "12345"
+	f.addTarget("12345", "yutong", `{"options": {"steps_per_frame": 1}}`)
+	jsonData := `{"target_id":"` + target_id + `",
+				"files": {"openmm": "ZmlsZWRhdGFibGFoYmFsaA==",
+				"amber": "ZmlsZWRhdGFibGFoYmFsaA=="}}`
+	auth_token := f.addManager("yutong", 1)
+	stream_id, _ := f.postStream(auth_token, jsonData)
+	token, code := f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+	time.Sleep(time.Duration(3) * time.Second)
+	// a frame keeps the stream alive and updates its status
+	assert.Equal(t, f.putFrame(token, `{"files": {"some_file": "ZGF0YQ=="}, "status": {"step": 100}}`), 200)
+	status := f.activeStreams()[stream_id].(map[string]interface{})["status"].(map[string]interface{})
+	assert.Equal(t, status["step"], 100.0)
+	time.Sleep(time.Duration(3) * time.Second)
+	assert.Equal(t, f.coreStop(token, ""), 200)
+}
+
+func TestCoreStartCached(t *testing.T) {
+	f := NewFixture()
+	defer f.shutdown()
+	target_id := "12345"
+	f.addTarget("12345", "yutong", `{"options": {"steps_per_frame": 1}}`)
+	jsonData := `{"target_id":"` + target_id + `",
+				"files": {"openmm": "ZmlsZWRhdGFibGFoYmFsaA==",
+				"amber": "YW1iZXJibGFoYmxhaA=="}}`
+	auth_token := f.addManager("yutong", 1)
+	f.postStream(auth_token, jsonData)
+	token, code := f.activateStream(target_id, "a", "b", f.app.Config.Password)
+	assert.Equal(t, code, 200)
+	h := md5.New()
+	io.WriteString(h, "ZmlsZWRhdGFibGFoYmFsaA==")
+	openmmHash := hex.EncodeToString(h.Sum(nil))
+	req, _ := http.NewRequest("GET", "/core/start", nil)
+	req.Header.Add("Authorization", token)
+	req.Header.Add("Cached-Files", "deadbeef, "+openmmHash)
+	w := httptest.NewRecorder()
+	f.app.Router.ServeHTTP(w, req)
+	assert.Equal(t, w.Code, 200)
+	type Reply struct {
+		Files  map[string]string `json:"files"`
+		Cached map[string]string `json:"cached"`
+	}
+	rep := Reply{}
+	json.Unmarshal(w.Body.Bytes(), &rep)
+	_, ok := rep.Files["openmm"]
+	assert.False(t, ok)
+	assert.Equal(t, rep.Cached["openmm"], openmmHash)
+	assert.Equal(t, rep.Files["amber"], "YW1iZXJibGFoYmxhaA==")
+	_, ok = rep.Cached["amber"]
+	assert.False(t, ok)
+	assert.Equal(t, f.coreStop(token, ""), 200)
+}
+
 func TestAlive(t *testing.T) {
 	f := NewFixture()
 	defer f.shutdown()
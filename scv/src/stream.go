@@ -41,8 +41,10 @@ type ActiveStream struct {
 	user         string  // donor id
 	startTime    int     // time the stream was activated
 	frameHash    string  // md5 hash of the last frame
+	uploadSeq    int     // Upload-Seq of the last frame or checkpoint applied
 	engine       string  // core engine type the stream is assigned to
 	timer        *time.Timer
+	status       map[string]interface{} // last status reported by the core's heartbeat
 }
 
 func NewActiveStream(user, token, engine string) *ActiveStream {
@@ -141,9 +141,11 @@ class TestSimple(tornado.testing.AsyncTestCase):
         self.client.fetch(uri, self.stop, **kwargs)
         return self.wait()
 
-    def _post_target(self, host, stage='public', weight=1):
+    def _post_target(self, host, stage='public', weight=1, n_atoms=None):
         headers = {'Authorization': self.auth_token}
         options = {'steps_per_frame': 50000}
+        if n_atoms is not None:
+            options['n_atoms'] = n_atoms
         body = {
             'description': 'test project',
             'engines': ['openmm'],
@@ -188,7 +190,7 @@ class TestSimple(tornado.testing.AsyncTestCase):
         return json.loads(reply.body.decode())
 
     def _assign(self, host, target_id=None, core_key=None,
-                donor_token=None, expected_code=200):
+                donor_token=None, max_atoms=None, expected_code=200):
         if core_key is None:
             manager_headers = {'Authorization': self.auth_token}
             body = {'engine': 'openmm', 'description': 'testing'}
@@ -202,6 +204,8 @@ class TestSimple(tornado.testing.AsyncTestCase):
             body['donor_token'] = donor_token
         if target_id:
             body['target_id'] = target_id
+        if max_atoms is not None:
+            body['max_atoms'] = max_atoms
         reply = self.fetch(host, '/core/assign', method='POST',
                            body=json.dumps(body), headers=core_headers)
         self.assertEqual(reply.code, expected_code)
@@ -325,6 +329,21 @@ class TestSimple(tornado.testing.AsyncTestCase):
         self._assign(self.cc_host, target_id, expected_code=400)
         self._assign(self.cc_host, expected_code=400)
 
+    def test_assign_max_atoms(self):
+        large_id = self._post_target(self.cc_host, n_atoms=50000)['target_id']
+        self._post_stream(large_id)
+        # only the large target exists, so nothing fits
+        self._assign(self.cc_host, max_atoms=25000, expected_code=400)
+        small_id = self._post_target(self.cc_host, n_atoms=20000)['target_id']
+        self._post_stream(small_id)
+        for i in range(10):
+            content = self._assign(self.cc_host, max_atoms=25000)
+            token, url = content['token'], content['url']
+            content = self._core_start(url, token)
+            self.assertEqual(content['target_id'], small_id)
+            host = urllib.parse.urlparse(url).netloc
+            self._core_stop(host, token)
+
     def test_assign_multiple_managers(self):
         # post using the proteneer account
         content = self._post_target(self.cc_host)